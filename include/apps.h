@@ -11,5 +11,17 @@ int camino_main(int argc, char *argv[]);			// camino.c
 int camino_ns_main(int argc, char *argv[]);			// camino_ns.c
 int prodcons_main(int argc, char *argv[]);			// prodcons.c
 int divz_main(int argc, char *argv[]);				// divz.c
+int top_main(int argc, char *argv[]);				// top.c
+int ps_main(int argc, char *argv[]);				// top.c
+int ktrace_main(int argc, char *argv[]);			// ktrace.c
+int locks_main(int argc, char *argv[]);				// locks.c
+int pools_main(int argc, char *argv[]);				// pools.c
+int ipcbench_main(int argc, char *argv[]);			// ipcbench.c
+int affinity_main(int argc, char *argv[]);			// affinity.c
+int bench_main(int argc, char *argv[]);				// bench.c
+int fibers_main(int argc, char *argv[]);				// fibers.c
+int stacks_main(int argc, char *argv[]);				// stacks.c
+int waitmulti_main(int argc, char *argv[]);			// waitmulti.c
+int irqstat_main(int argc, char *argv[]);			// irqstat.c
 
 #endif
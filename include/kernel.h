@@ -4,16 +4,21 @@
 #include "mtask.h"
 #include "segments.h"
 
+typedef struct Cpu_t Cpu_t;
+
 /* gdt_idt.c */
 
 void mt_setup_gdt_idt(void);
+void mt_load_gdt_idt(void);
+unsigned mt_cpu_segment(unsigned cpu, void *base);
 
 /* interrupts.asm */
 
-// Excepciones 0-31, interrupciones de HW 32-47
+// Excepciones 0-31, interrupciones de HW 32-47 (PIC), 48-63 (APIC local)
 #define INT_STUB_SIZE 16
-#define NUM_INTS 48
+#define NUM_INTS 64
 #define NUM_EXCEPT 32
+#define NUM_PIC_IRQS 16
 
 typedef char int_stub[INT_STUB_SIZE];
 extern int_stub mt_int_stubs[NUM_INTS];
@@ -25,20 +30,202 @@ void mt_load_idt(const region_desc *idt);
 void mt_context_switch(void);
 void mt_sti(void);
 void mt_cli(void);
+unsigned mt_irqsave(void);
+void mt_irqrestore(unsigned flags);
 void mt_finit(void);
 void mt_fsave(void *buf);
 void mt_frstor(void *buf);
 void mt_stts(void);
 void mt_clts(void);
+void mt_halt(void);
+void mt_cpuid(unsigned leaf, unsigned regs[4]);
+unsigned long long mt_rdtsc(void);
+unsigned long long mt_rdmsr(unsigned msr);
+void mt_wrmsr(unsigned msr, unsigned long long value);
+void mt_load_fs(unsigned selector);
+void mt_pause(void);
+Cpu_t *mt_this_cpu(void);
+Task_t *mt_current_task(void);
+
+/* smp.c */
+
+#define MAX_CPUS		8
+#define AP_TRAMPOLINE	0x8000			// código de arranque de los APs, < 1 MB
+
+// Datos propios de cada CPU. Cada CPU tiene cargado en FS un segmento cuya
+// base es su estructura Cpu_t, así que su dirección se lee en un solo acceso
+// con mt_this_cpu(). Los offsets de los primeros campos deben mantenerse
+// sincronizados con interrupts.asm y libasm.asm.
+struct Cpu_t
+{
+	Cpu_t *			self;			// offset = 0
+	Task_t *		curr_task;		// offset = 4, tarea en ejecución
+	Task_t *		last_task;		// offset = 8, tarea anterior
+	unsigned		int_level;		// offset = 12, anidamiento de interrupciones
+	unsigned		int_stack;		// offset = 16, tope del stack de interrupciones
+	Task_t *		fpu_task;		// tarea que tiene el coprocesador
+	Task_t *		null_task;
+	Task_t *		prev_task;		// tarea que dejó la CPU, hasta cambiar de stack
+	unsigned		ticks_to_run;	// ranura de tiempo
+	unsigned		id;				// índice en mt_cpus
+	unsigned		apic_id;
+	volatile bool	online;
+	unsigned		migrations;		// tareas recibidas de otras CPUs
+	Task_t *		handoff;		// tarea a la que se cede la CPU
+	unsigned		handoffs;		// cesiones directas (Send)
+	unsigned		softirq_pending;	// softirqs pendientes, un bit por numero
+	unsigned long long	timer_tsc;	// TSC de la ultima interrupcion de timer
+	unsigned		sti_level;		// nivel de DisableInts que debe habilitar al salir
+};
+
+extern Cpu_t mt_cpus[MAX_CPUS];
+extern unsigned mt_ncpus;
+
+unsigned mt_smp_discover(unsigned apic_ids[], unsigned max);
+bool mt_start_ap(Cpu_t *cpu);
+void mt_ap_main(void);
+
+/* spinlock.c */
+
+#define LOCK_NAME_SIZE	16
+
+typedef struct							// copia de las estadisticas de un lock
+{
+	char				name[LOCK_NAME_SIZE];
+	unsigned			count;
+	unsigned			contended;
+	unsigned long long	spin_cycles;
+	unsigned long long	hold_cycles;
+	unsigned long long	max_hold;
+}
+LockStats_t;
+
+void mt_spin_init(Spinlock_t *lock, const char *name);
+void mt_spin_register(Spinlock_t *lock);
+void mt_spin_unregister(Spinlock_t *lock);
+void mt_spin_lock(Spinlock_t *lock);
+void mt_spin_unlock(Spinlock_t *lock);
+unsigned mt_spin_lock_irqsave(Spinlock_t *lock);
+void mt_spin_unlock_irqrestore(Spinlock_t *lock, unsigned flags);
+unsigned mt_spin_stats(LockStats_t stats[], unsigned max);
+void mt_spin_reset_stats(void);
+
+/* malloc.c */
+
+void mt_heap_init(void);
+
+/* pool.c */
+
+#define POOL_CLASSES	8				// bloques de control y 7 clases de stacks
+
+typedef struct
+{
+	unsigned		size;			// tamaño de los objetos
+	unsigned		hits;			// pedidos atendidos desde el pool
+	unsigned		misses;			// pedidos que fueron al heap
+	unsigned		cached;			// objetos libres en el pool
+}
+PoolStats_t;
+
+void mt_pool_init(void);
+Task_t *mt_pool_get_task(void);
+void mt_pool_put_task(Task_t *task);
+char *mt_pool_get_stack(unsigned *size, bool clear);
+void mt_pool_put_stack(char *stack, unsigned size);
+unsigned mt_pool_stats(PoolStats_t stats[], unsigned max);
+void mt_pool_drain(void);
 
 /* kernel.c */
 
-extern Task_t * volatile mt_curr_task;
-extern Task_t * volatile mt_last_task;
-extern Task_t * volatile mt_fpu_task;
+#define MSPERTICK 		20				/* 50 Hz */
+#define USPERTICK		(MSPERTICK * 1000)
+
+#define mt_curr_task	mt_current_task()
+#define mt_last_task	(mt_this_cpu()->last_task)
+#define mt_fpu_task		(mt_this_cpu()->fpu_task)
+#define mt_int_level	(mt_this_cpu()->int_level)
+
 extern unsigned long long volatile mt_ticks;
+extern Task_t *mt_task_list;
+extern unsigned mt_idle_pct;
+extern bool mt_ipc_handoff;
 void mt_main(void);
+void mt_update_stats(Task_t *task);
 bool mt_select_task(void);
+void mt_int_enter(void);
+void mt_int_exit(void);
+unsigned mt_int_unlock(void);
+void mt_int_relock(unsigned level);
+void mt_switch_done(void);
+void mt_ap_start(Cpu_t *cpu);
+void mt_idle_wakeup(unsigned irq);
+void mt_reclaim(void);
+unsigned long long mt_last_timer_tsc(void);
+
+#define FOREVER_US (~0ULL)
+
+struct WaitEntry_t						/* espera de WaitMultiple en una cola */
+{
+	Task_t *		task;
+	TaskQueue_t *	queue;
+	unsigned		index;				// posicion del objeto en WaitMultiple
+	WaitEntry_t *	prev;
+	WaitEntry_t *	next;
+};
+
+#define mt_waiting(queue)	(mt_peeklast(queue) || (queue)->waits_head)
+
+unsigned long long mt_timeout_ms(unsigned msecs);
+unsigned long long mt_timeout_us(unsigned usecs);
+bool mt_wait_queue(TaskQueue_t *queue, unsigned long long usecs);
+bool mt_wait_queue_unlock(TaskQueue_t *queue, unsigned long long usecs, Spinlock_t *lock);
+void mt_set_owner(TaskQueue_t *queue, Task_t *owner);
+
+/* sem.c */
+
+bool mt_wait_sem(Semaphore_t *sem, unsigned long long usecs);
+
+/* stack.c */
+
+#define STACK_PAINT			0x5AA55AA5	// relleno de los stacks nuevos
+#define STACK_MARGIN		512			// margen sobre el maximo aprendido
+#define MIN_LEARNED_STACK	1024		// minimo de un stack aprendido
+#define STACK_NAME_SIZE		16			// caracteres del nombre registrados
+
+typedef struct
+{
+	char			name[STACK_NAME_SIZE];
+	unsigned		max_used;		// maximo usado por las tareas del nombre
+	unsigned		samples;		// tareas que terminaron
+}
+StackStats_t;
+
+void mt_stack_init(void);
+void mt_stack_paint(Task_t *task);
+unsigned mt_stack_used(Task_t *task);
+unsigned mt_stack_scan(char *stack, unsigned size);
+void mt_stack_learn(Task_t *task);
+unsigned mt_stack_learned(char *name);
+unsigned mt_stack_stats(StackStats_t stats[], unsigned max);
+
+/* swtimer.c */
+
+void mt_run_timers(void);
+unsigned mt_next_timer(void);
+
+/* msgqueue.c */
+
+void mt_msgqueue_get(MsgQueue_t *mq, void *msg);
+void mt_msgqueue_put(MsgQueue_t *mq, void *msg);
+
+/* fiber.c */
+
+Fiber_t *mt_fiber_dequeue(Semaphore_t *sem);
+void mt_fiber_wakeup(Fiber_t *fiber, bool status);
+
+/* mutex.c */
+
+bool mt_enter_mutex(Mutex_t *mut, unsigned long long usecs);
 
 /* irq.c */
 
@@ -60,7 +247,6 @@ typedef struct
 }
 mt_regs_t;
 
-extern unsigned mt_int_level;
 void mt_int_handler(unsigned int_num, unsigned except_error, mt_regs_t *regs);
 
 typedef void (*exception_handler)(unsigned except_number, unsigned error, mt_regs_t *regs);
@@ -71,6 +257,32 @@ void mt_set_int_handler(unsigned irq_num, interrupt_handler handler);
 void mt_set_exception_handler(unsigned except_num, exception_handler handler);
 void mt_enable_irq(unsigned irq);
 void mt_disable_irq(unsigned irq);
+bool mt_irq_pending(unsigned irq);
+
+typedef struct
+{
+	unsigned		num;			// irq o numero de softirq
+	const char *	name;
+	unsigned		count;			// ejecuciones
+	unsigned long long	cycles;		// ciclos de TSC acumulados
+	unsigned		max_cycles;
+}
+HandlerStats_t;
+
+unsigned mt_irq_stats(HandlerStats_t stats[], unsigned max);
+
+/* softirq.c */
+
+#define NUM_SOFTIRQS	8
+
+enum { SoftirqTimer, SoftirqKbd };		// numeros de softirq, por prioridad
+
+typedef void (*softirq_handler)(void);
+
+void mt_set_softirq(unsigned num, const char *name, softirq_handler handler);
+void mt_raise_softirq(unsigned num);
+void mt_do_softirqs(void);
+unsigned mt_softirq_stats(HandlerStats_t stats[], unsigned max);
 
 /* cons.c */
 
@@ -97,6 +309,10 @@ enum COLORS
 	WHITE
 };
 
+void mt_cons_init(void);
+unsigned mt_cons_lock(void);
+void mt_cons_unlock(unsigned flags);
+
 void mt_cons_clear(void);
 void mt_cons_clreol(void);
 void mt_cons_clreom(void);
@@ -125,6 +341,7 @@ void mt_cons_bs(void);
 void mt_kbd_init(void);
 bool mt_kbd_getch(unsigned *c);
 bool mt_kbd_getch_timed(unsigned *c, unsigned timeout);
+MsgQueue_t *mt_kbd_queue(void);
 const char *mt_kbd_getlayout(void);
 bool mt_kbd_setlayout(const char *name);
 const char **mt_kbd_layouts(void);
@@ -135,19 +352,122 @@ unsigned mt_getline(char *buf, unsigned size);
 
 /* timer.c */
 
-void mt_setup_timer(unsigned freq);
+void mt_setup_timer(unsigned msecs);
+void mt_timer_periodic(void);
+void mt_timer_oneshot(unsigned count);
+unsigned mt_timer_count(void);
+unsigned mt_timer_period(void);
+void mt_timer_busywait(unsigned msecs);
+
+/* apic.c */
+
+// Interrupciones del APIC local, numeradas a continuación de las del PIC
+#define LAPIC_TIMER_IRQ		(NUM_PIC_IRQS + 0)		// vector 48
+#define LAPIC_RESCHED_IRQ	(NUM_PIC_IRQS + 1)		// vector 49, IPI
+#define LAPIC_SPURIOUS_IRQ	(NUM_INTS - NUM_EXCEPT - 1)	// vector 63
+
+bool mt_setup_apic(void);
+void mt_setup_apic_ap(void);
+unsigned mt_lapic_id(void);
+void mt_lapic_ipi(unsigned apic_id, unsigned irq);
+void mt_lapic_init_sipi(unsigned apic_id, unsigned page);
+void mt_lapic_eoi(void);
+unsigned mt_tsc_khz(void);
+void mt_lapic_timer_arm(unsigned long long tsc);
+
+/* trace.c */
+
+typedef enum
+{
+	TraceSwitch,						// task: nueva tarea, arg: anterior
+	TraceWakeup,						// arg: estado anterior
+	TraceBlock,							// arg: nuevo estado
+	TraceExpire,						// arg: 0 rueda de tiempo, 1 alta resolución
+	TraceIrqEnter,						// arg: nro. de irq
+	TraceIrqExit						// arg: nro. de irq
+}
+TraceEvent_t;
+
+typedef struct
+{
+	unsigned long long	tsc;
+	unsigned			cpu;
+	unsigned			event;
+	Task_t *			task;
+	unsigned			arg;
+}
+TraceEntry_t;
+
+typedef struct
+{
+	unsigned			pos[MAX_CPUS];	// proximo evento de cada CPU
+}
+TraceCursor_t;
+
+void mt_trace(unsigned event, Task_t *task, unsigned arg);
+bool mt_trace_enable(bool on);
+void mt_trace_clear(void);
+unsigned mt_trace_count(void);
+void mt_trace_start(TraceCursor_t *cur, unsigned skip);
+bool mt_trace_next(TraceCursor_t *cur, TraceEntry_t *entry);
+
+/* serial.c */
+
+#define SERIAL_BAUD		115200
+
+bool mt_serial_init(unsigned baud);
+void mt_serial_putc(char ch);
+void mt_serial_puts(const char *str);
+
+/* rbtree.c */
+
+typedef struct
+{
+	RbNode_t *		root;
+	RbNode_t *		leftmost;		// el menor
+}
+RbTree_t;
+
+void mt_rb_insert(RbTree_t *tree, RbNode_t *node, RbNode_t *parent, RbNode_t **link);
+void mt_rb_erase(RbTree_t *tree, RbNode_t *node);
+RbNode_t *mt_rb_first(RbTree_t *tree);
+RbNode_t *mt_rb_next(RbNode_t *node);
 
 /* queue.c */
 
+// Tarea de la clase SchedFair, salvo que haya heredado prioridad
+#define mt_fair(task)	((task)->policy == SchedFair && !(task)->period && \
+						 (task)->priority == (task)->base_priority)
+
+#define FAIR_PRIO		DEFAULT_PRIO	// la clase fair va justo debajo de este nivel
+#define FAIR_LATENCY_MS	120				// periodo en que ejecutan todas las tareas fair
+#define FAIR_CREDIT_MS	(FAIR_LATENCY_MS / 2)	// credito maximo al despertar
+#define FAIR_WAKEUP_MS	4				// ventaja minima para desalojar al despertar
+
 void mt_enqueue(Task_t *task, TaskQueue_t *queue);
 void mt_dequeue(Task_t *task);
 Task_t *mt_peeklast(TaskQueue_t *queue);
 Task_t *mt_getlast(TaskQueue_t *queue);
 
+void mt_enqueue_ready(Task_t *task, unsigned cpu);
+void mt_enqueue_ready_first(Task_t *task, unsigned cpu);
+unsigned mt_ready_cpu(Task_t *task);
+unsigned mt_count_ready(unsigned cpu);
+Task_t *mt_peeklast_ready(unsigned cpu);
+Task_t *mt_getlast_ready(unsigned cpu);
+Task_t *mt_getlast_ready_for(unsigned cpu, unsigned to);
+void mt_fair_advance(unsigned cpu, unsigned long long vruntime);
+unsigned mt_fair_weight(unsigned cpu);
+
 void mt_enqueue_time(Task_t *task, unsigned ticks);
 void mt_dequeue_time(Task_t *task);
-Task_t *mt_peekfirst_time(void);
+void mt_tick_time(void);
 Task_t *mt_getfirst_time(void);
+unsigned mt_next_time(void);
+
+void mt_enqueue_hrtime(Task_t *task);
+Task_t *mt_peekfirst_hrtime(void);
+Task_t *mt_getfirst_hrtime(void);
 
 /* math.c */
 
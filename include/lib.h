@@ -42,6 +42,12 @@ int vprintk(const char *fmt, va_list args);
 int printk(const char *fmt, ...);
 void cprintk(unsigned fg, unsigned bg, char *fmt, ...);
 
+#define PRINTK_LINE		200				// maximo de una linea formateada
+#define OUT_CONSOLE		0x01			// destinos de outk
+#define OUT_SERIAL		0x02
+
+void outk(unsigned where, unsigned fg, const char *fmt, ...);
+
 /* malloc.c */
 
 void *malloc(unsigned nbytes);
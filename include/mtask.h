@@ -5,7 +5,10 @@
 
 #define MIN_PRIO		0
 #define DEFAULT_PRIO	50
+#define MAX_PRIO		255
 #define FOREVER			-1U
+#define ALL_CPUS		-1U				// afinidad: cualquier CPU
+#define DEFAULT_WEIGHT	1024			// peso de una tarea SchedFair
 
 #ifndef NULL
 #define NULL 0
@@ -34,15 +37,39 @@ typedef enum
 } 
 TaskState_t;
 
+typedef enum
+{
+	SchedDefault,						// ranura de tiempo del sistema
+	SchedFifo,							// sin ranura de tiempo
+	SchedRR,							// ranura de tiempo propia
+	SchedFair							// reparto proporcional al peso
+}
+SchedPolicy_t;
+
 typedef struct Task_t Task_t;
+typedef struct TaskQueue_t TaskQueue_t;
+typedef struct WaitEntry_t WaitEntry_t;
 
-typedef struct
+typedef struct RbNode_t					// nodo de arbol rojo-negro (rbtree.c)
+{
+	struct RbNode_t *	parent;
+	struct RbNode_t *	left;
+	struct RbNode_t *	right;
+	bool				red;
+}
+RbNode_t;
+
+struct TaskQueue_t
 {
 	char *			name;
 	Task_t *		head;
 	Task_t *		tail;
-}
-TaskQueue_t;
+	bool			inherit;		// herencia de prioridad hacia el dueño
+	Task_t *		owner;
+	TaskQueue_t *	owned_next;		// lista de colas del mismo dueño
+	WaitEntry_t *	waits_head;		// tareas en WaitMultiple (kernel.c)
+	WaitEntry_t *	waits_tail;
+};
 
 struct Task_t
 {
@@ -53,6 +80,9 @@ struct Task_t
 	unsigned		disint_level;
 	unsigned 		esp;			// offset = 20, sincronizar con interrupts.asm
 	char *			stack;
+	unsigned		stack_size;
+	bool			stack_painted;	// stack rellenado, se puede medir su uso
+	char			name_buf[16];	// nombre, si es corto
 	void *			math_data;
 	TaskQueue_t	*	queue;
 	Task_t *		prev;
@@ -61,12 +91,53 @@ struct Task_t
 	bool			in_time_q;
 	Task_t *		time_prev;
 	Task_t *		time_next;
+	TaskQueue_t *	time_slot;
 	unsigned		ticks;
+	unsigned long long	timeout;
 	void *			data;
 	Task_t *		from;
 	void *			msg;
 	unsigned 		size;
 	TaskQueue_t 	send_queue;
+	bool			calling;		// en Call(), esperando respuesta
+	void *			reply;			// buffer de respuesta de Call()
+	unsigned		reply_size;
+	WaitEntry_t *	waits;			// esperas en WaitMultiple
+	unsigned		nwaits;
+	unsigned		wait_index;		// objeto que completo WaitMultiple
+	unsigned		base_priority;	// prioridad sin herencia
+	SchedPolicy_t	policy;
+	unsigned		slice;			// ranura de tiempo en ticks
+
+	// Tareas periodicas (EDF), tiempos en ticks
+	unsigned		period;			// cero si no es periodica
+	unsigned		runtime;		// tiempo de CPU por periodo
+	unsigned		rel_deadline;	// plazo relativo al inicio del periodo
+	unsigned		budget;			// tiempo de CPU restante en el periodo
+	unsigned long long	release;	// inicio del periodo actual
+	unsigned long long	deadline;	// plazo absoluto
+	unsigned		misses;			// plazos no cumplidos
+	TaskQueue_t *	owned;			// colas con herencia que posee
+	struct Cpu_t *	cpu;			// CPU en que se ejecuta, o NULL
+	struct Cpu_t *	last_cpu;		// ultima CPU en que ejecuto
+	unsigned		affinity;		// CPUs permitidas, bit n: CPU n
+	Task_t *		list_prev;		// lista de todas las tareas
+	Task_t *		list_next;
+
+	// Contabilidad, en ciclos del TSC
+	unsigned long long	run_cycles;		// en ejecución
+	unsigned long long	ready_cycles;	// en la cola de ready
+	unsigned long long	blocked_cycles;	// bloqueada o suspendida
+	unsigned long long	stamp;			// último cambio de estado
+	unsigned		vol_switches;	// cambios de contexto voluntarios
+	unsigned		invol_switches;	// cambios de contexto involuntarios
+	unsigned		wakeups;		// veces que fue despertada
+	unsigned		migrations;		// cambios de CPU
+
+	// Clase SchedFair
+	unsigned		weight;			// peso, DEFAULT_WEIGHT es el normal
+	unsigned long long	vruntime;	// tiempo de CPU ponderado, en ciclos
+	RbNode_t		fair_node;		// nodo en el arbol de la CPU
 };
 
 typedef void (*TaskFunc_t)(void *arg);
@@ -75,11 +146,25 @@ typedef void (*Switcher_t)(Task_t *save, Task_t *restore);
 /* API principal */
 
 Task_t *			CreateTask(TaskFunc_t func, unsigned stacksize, void *arg, char *name, unsigned priority);
+Task_t *			CreatePeriodicTask(TaskFunc_t func, unsigned stacksize, void *arg, char *name,
+						unsigned period, unsigned runtime, unsigned deadline);
+bool				WaitNextPeriod(void);
 Task_t *			CurrentTask(void);
 void				DeleteTask(Task_t *task);
 	
 unsigned			GetPriority(Task_t *task);
 void				SetPriority(Task_t *task, unsigned priority);
+SchedPolicy_t		GetSchedPolicy(Task_t *task);
+void				SetSchedPolicy(Task_t *task, SchedPolicy_t policy, unsigned slice_us);
+unsigned			GetWeight(Task_t *task);
+void				SetWeight(Task_t *task, unsigned weight);
+unsigned			GetStackUsed(Task_t *task);
+void				SetStackLearning(bool on);
+bool				GetStackLearning(void);
+void				SetStackTracking(bool on);
+bool				GetStackTracking(void);
+unsigned			GetAffinity(Task_t *task);
+bool				SetAffinity(Task_t *task, unsigned cpumask);
 void				Suspend(Task_t *task);
 void				Ready(Task_t *task);
 
@@ -87,6 +172,7 @@ TaskQueue_t *		CreateQueue(char *name);
 void				DeleteQueue(TaskQueue_t *queue);
 bool				WaitQueue(TaskQueue_t *queue);
 bool				WaitQueueTimed(TaskQueue_t *queue, unsigned msecs);
+bool				WaitQueueTimedUs(TaskQueue_t *queue, unsigned usecs);
 bool				SignalQueue(TaskQueue_t *queue);
 void				FlushQueue(TaskQueue_t *queue, bool success);
 
@@ -96,10 +182,13 @@ bool				SendTimed(Task_t *to, void *msg, unsigned size, unsigned msecs);
 bool				Receive(Task_t **from, void *msg, unsigned *size);
 bool				ReceiveCond(Task_t **from, void *msg, unsigned *size);
 bool				ReceiveTimed(Task_t **from, void *msg, unsigned *size, unsigned msecs);
+bool				Call(Task_t *to, void *req, unsigned req_size, void *reply, unsigned *reply_size);
+bool				ReplyWait(Task_t *to, void *reply, unsigned size, Task_t **from, void *req, unsigned *req_size);
 
 void				Pause(void);
 void				Yield(void);
 void				Delay(unsigned msecs);
+void				DelayUs(unsigned usecs);
 void				Exit(void);
 
 void				Atomic(void);
@@ -108,6 +197,7 @@ void	 			DisableInts(void);
 void				RestoreInts(void);
 
 void *				Malloc(unsigned size);
+void *				TryMalloc(unsigned size);
 char *				StrDup(char *str);
 void 				Free(void *mem);
 
@@ -116,12 +206,35 @@ void				SetSwitcher(Switcher_t switcher);
 
 void				Panic(char *msg);
 
+/* Spinlocks, de uso interno del kernel */
+
+typedef struct Spinlock_t Spinlock_t;
+
+struct Spinlock_t
+{
+	volatile unsigned	next;		// próximo número a entregar
+	volatile unsigned	serving;	// número que tiene el lock
+	const char *		name;
+	unsigned long long	acquired;	// TSC al tomarlo
+	unsigned			count;		// veces que se tomó
+	unsigned			contended;	// veces que hubo que esperar
+	unsigned long long	spin_cycles;	// ciclos esperando
+	unsigned long long	hold_cycles;	// ciclos tomado
+	unsigned long long	max_hold;	// máximo tiempo tomado
+	Spinlock_t *		list_next;	// lista de locks registrados
+};
+
 /* Semáforos */
 
+typedef struct Fiber_t Fiber_t;
+
 typedef struct
 {
 	unsigned		value;
 	TaskQueue_t *	queue;
+	Spinlock_t		lock;			// protege value sin el lock del kernel
+	Fiber_t *		fiber_head;		// fibers esperando (fiber.c)
+	Fiber_t *		fiber_tail;
 }
 Semaphore_t;
 
@@ -130,6 +243,7 @@ void 				DeleteSem(Semaphore_t *sem);
 bool 				WaitSem(Semaphore_t *sem);
 bool 				WaitSemCond(Semaphore_t *sem);
 bool 				WaitSemTimed(Semaphore_t *sem, unsigned msecs);
+bool 				WaitSemTimedUs(Semaphore_t *sem, unsigned usecs);
 void 				SignalSem(Semaphore_t *sem);
 unsigned			ValueSem(Semaphore_t *sem);
 void 				FlushSem(Semaphore_t *sem, bool wait_ok);
@@ -149,6 +263,7 @@ void 				DeleteMutex(Mutex_t *mut);
 bool				EnterMutex(Mutex_t *mut);
 bool				EnterMutexCond(Mutex_t *mut);
 bool				EnterMutexTimed(Mutex_t *mut, unsigned msecs);
+bool				EnterMutexTimedUs(Mutex_t *mut, unsigned usecs);
 void				LeaveMutex(Mutex_t *mut);
 
 /* Monitores y variables de condición */
@@ -228,9 +343,101 @@ void				DeleteMsgQueue(MsgQueue_t *mq);
 bool				GetMsgQueue(MsgQueue_t *mq, void *msg);
 bool				GetMsgQueueCond(MsgQueue_t *mq, void *msg);
 bool				GetMsgQueueTimed(MsgQueue_t *mq, void *msg, unsigned msecs);
+bool				GetMsgQueueTimedUs(MsgQueue_t *mq, void *msg, unsigned usecs);
 bool				PutMsgQueue(MsgQueue_t *mq, void *msg);
 bool				PutMsgQueueCond(MsgQueue_t *mq, void *msg);
 bool				PutMsgQueueTimed(MsgQueue_t *mq, void *msg, unsigned msecs);
+bool				PutMsgQueueTimedUs(MsgQueue_t *mq, void *msg, unsigned usecs);
 unsigned			AvailMsgQueue(MsgQueue_t *mq);
 
+/* Espera múltiple */
+
+#define MAX_WAIT_OBJECTS	16
+
+typedef enum { WaitForQueue, WaitForSem, WaitForMsgQueue, WaitForPipe } WaitType_t;
+
+typedef struct
+{
+	WaitType_t		type;
+	void *			object;			// TaskQueue_t, Semaphore_t, MsgQueue_t o Pipe_t
+	void *			msg;			// WaitForMsgQueue: donde copiar el mensaje
+}
+WaitObject_t;
+
+bool				WaitMultiple(WaitObject_t objects[], unsigned n, unsigned msecs, unsigned *index);
+
+/* Timers de software */
+
+typedef void (*TimerFunc_t)(void *arg);
+typedef struct Timer_t Timer_t;
+
+struct Timer_t
+{
+	TimerFunc_t		func;			// ejecuta en el tick, sin bloquearse
+	void *			arg;
+	unsigned long long	expires;	// tick en que vence
+	unsigned		period;			// ticks, 0 si no es periodico
+	bool			active;
+	Timer_t *		prev;			// ranura de la rueda de timers
+	Timer_t *		next;
+};
+
+Timer_t *			CreateTimer(TimerFunc_t func, void *arg);
+void				DeleteTimer(Timer_t *timer);
+void				StartTimer(Timer_t *timer, unsigned msecs, bool periodic);
+void				StopTimer(Timer_t *timer);
+
+/* Fibers */
+
+typedef struct FiberHost_t FiberHost_t;
+typedef bool (*FiberFunc_t)(Fiber_t *fiber);
+
+typedef enum { FiberReady, FiberRunning, FiberWaiting } FiberState_t;
+
+struct Fiber_t
+{
+	FiberFunc_t		func;			// retorna false cuando la fiber termina
+	void *			arg;
+	FiberHost_t *	host;
+	unsigned short	resume;			// punto de continuacion (FIBER_AWAIT)
+	unsigned char	state;			// FiberState_t
+	bool			pending;		// suspendida en una operacion
+	bool			status;			// resultado de la ultima espera
+	Fiber_t *		prev;			// cola de listas o de espera
+	Fiber_t *		next;
+	Semaphore_t *	sem;			// semaforo en que espera
+	unsigned long long	deadline;	// TSC en que vence la espera, 0 si no hay
+	RbNode_t		timer_node;		// nodo en el arbol de esperas del host
+};
+
+/*
+	Una fiber es una funcion reanudable: cada vez que se suspende retorna al
+	host, y cuando se reanuda vuelve a empezar desde FIBER_BEGIN, que salta al
+	punto en que se habia suspendido. Las variables locales no se conservan:
+	el estado que deba sobrevivir a una espera va en arg. No puede haber dos
+	FIBER_AWAIT en la misma linea.
+*/
+
+#define FIBER_BEGIN(f)		switch ( (f)->resume ) { case 0:
+#define FIBER_END(f)		} return false
+#define FIBER_EXIT(f)		return false
+#define FIBER_AWAIT(f, op)	do { (f)->resume = __LINE__; case __LINE__: \
+								 if ( op ) return true; } while ( false )
+
+#define FIBER_YIELD(f)						FIBER_AWAIT(f, FiberYield(f))
+#define FIBER_DELAY(f, msecs)				FIBER_AWAIT(f, FiberDelay(f, msecs))
+#define FIBER_WAIT_SEM(f, sem, msecs)		FIBER_AWAIT(f, FiberWaitSem(f, sem, msecs))
+#define FIBER_GET_MSGQUEUE(f, mq, msg, msecs)	FIBER_AWAIT(f, FiberGetMsgQueue(f, mq, msg, msecs))
+#define FIBER_PUT_MSGQUEUE(f, mq, msg, msecs)	FIBER_AWAIT(f, FiberPutMsgQueue(f, mq, msg, msecs))
+
+FiberHost_t *		CreateFiberHost(char *name);
+void				DeleteFiberHost(FiberHost_t *host);
+Fiber_t *			CreateFiber(FiberHost_t *host, FiberFunc_t func, void *arg);
+void				RunFibers(FiberHost_t *host);
+bool				FiberYield(Fiber_t *fiber);
+bool				FiberDelay(Fiber_t *fiber, unsigned msecs);
+bool				FiberWaitSem(Fiber_t *fiber, Semaphore_t *sem, unsigned msecs);
+bool				FiberGetMsgQueue(Fiber_t *fiber, MsgQueue_t *mq, void *msg, unsigned msecs);
+bool				FiberPutMsgQueue(Fiber_t *fiber, MsgQueue_t *mq, void *msg, unsigned msecs);
+
 #endif
@@ -0,0 +1,80 @@
+#include "kernel.h"
+
+/*
+	affinity: consulta o cambia las CPUs en que puede ejecutar una tarea.
+
+	"affinity tarea" muestra las CPUs permitidas; "affinity tarea 0 2" la
+	restringe a las CPUs 0 y 2, y "affinity tarea all" le permite cualquiera.
+	Si hay varias tareas con el mismo nombre se toma la primera. La tarea se
+	busca y se cambia con las interrupciones deshabilitadas, y el resultado
+	se muestra despues, fuera de la seccion critica.
+*/
+
+static void
+usage(void)
+{
+	cprintk(LIGHTRED, BLACK, "Uso: affinity tarea [cpu... | all]\n");
+}
+
+static void
+show(char *name, unsigned mask)
+{
+	unsigned i;
+
+	printk("%s:", name);
+	for ( i = 0 ; i < mt_ncpus ; i++ )
+		if ( mask & (1U << i) )
+			printk(" %u", i);
+	printk("\n");
+}
+
+int
+affinity_main(int argc, char *argv[])
+{
+	Task_t *task;
+	unsigned i, cpu, mask = 0;
+	bool changed = true;
+
+	if ( argc < 2 )
+	{
+		usage();
+		return 1;
+	}
+	if ( argc > 2 && strcmp(argv[2], "all") == 0 )
+		mask = ALL_CPUS;
+	else
+		for ( i = 2 ; i < argc ; i++ )
+		{
+			if ( (cpu = atoi(argv[i])) >= mt_ncpus || (!cpu && strcmp(argv[i], "0")) )
+			{
+				cprintk(LIGHTRED, BLACK, "CPU invalida: %s\n", argv[i]);
+				return 1;
+			}
+			mask |= 1U << cpu;
+		}
+
+	DisableInts();
+	for ( task = mt_task_list ; task ; task = task->list_next )
+		if ( task->name && strcmp(task->name, argv[1]) == 0 )
+			break;
+	if ( task )
+	{
+		if ( mask )
+			changed = SetAffinity(task, mask);
+		mask = GetAffinity(task);
+	}
+	RestoreInts();
+
+	if ( !task )
+	{
+		cprintk(LIGHTRED, BLACK, "Tarea %s inexistente\n", argv[1]);
+		return 1;
+	}
+	if ( !changed )
+	{
+		cprintk(LIGHTRED, BLACK, "No se puede cambiar la afinidad de %s\n", argv[1]);
+		return 1;
+	}
+	show(argv[1], mask);
+	return 0;
+}
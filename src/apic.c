@@ -0,0 +1,249 @@
+#include "kernel.h"
+
+/*
+	APIC local: timer de alta resolución.
+
+	El APIC local se usa en modo flat, accediendo a sus registros en la
+	dirección física que indica el MSR IA32_APIC_BASE (no hay paginación).
+	El timer se programa siempre en modo one-shot: si la CPU soporta el modo
+	TSC-deadline se le escribe directamente el valor del TSC en que debe
+	interrumpir; si no, se convierte la distancia al vencimiento a cuentas
+	del timer. Las frecuencias del TSC y del timer se calibran contra el PIT.
+*/
+
+#define CPUID_FEATURES	1				// cpuid: información de características
+#define CPUID_TSC		(1 << 4)		// edx: hay TSC
+#define CPUID_APIC		(1 << 9)		// edx: hay APIC local
+#define CPUID_DEADLINE	(1 << 24)		// ecx: timer en modo TSC-deadline
+
+#define MSR_APIC_BASE	0x1B			// dirección base y habilitación
+#define MSR_DEADLINE	0x6E0			// IA32_TSC_DEADLINE
+#define APIC_ENABLE		(1 << 11)		// habilitación global
+#define APIC_BASE_MASK	0xFFFFF000
+
+// Registros del APIC local (offsets)
+#define LAPIC_ID		0x020
+#define LAPIC_EOI		0x0B0
+#define LAPIC_SVR		0x0F0			// spurious interrupt vector
+#define LAPIC_LVT_TIMER	0x320
+#define LAPIC_INIT		0x380			// cuenta inicial del timer
+#define LAPIC_CURR		0x390			// cuenta actual del timer
+#define LAPIC_DIV		0x3E0			// divisor del timer
+#define LAPIC_ICR_LOW	0x300			// envío de interrupciones entre CPUs
+#define LAPIC_ICR_HIGH	0x310			// destino
+
+#define SVR_ENABLE		(1 << 8)		// habilitación por software
+#define LVT_MASKED		(1 << 16)
+#define LVT_DEADLINE	(2 << 17)		// modo TSC-deadline
+#define DIV_16			0x3				// dividir el reloj del bus por 16
+
+#define ICR_INIT		0x00000500		// modo de entrega INIT
+#define ICR_STARTUP		0x00000600		// modo de entrega STARTUP
+#define ICR_ASSERT		0x00004000
+#define ICR_BUSY		0x00001000		// entrega pendiente
+#define ICR_DEST(id)	((id) << 24)
+
+#define VECTOR(irq)		((irq) + NUM_EXCEPT)
+#define CALIBRATE_MS	10				// duración de la calibración
+#define INIT_DELAY_MS	10				// espera después de INIT
+#define SIPI_DELAY_MS	1				// espera después de cada STARTUP
+
+static volatile unsigned *lapic;		// registros mapeados en memoria
+static bool deadline_mode;				// timer en modo TSC-deadline
+static unsigned tsc_khz;				// frecuencia del TSC
+static unsigned timer_khz;				// frecuencia del timer (con divisor)
+
+static void
+spurious(unsigned irq)
+{
+	// Las interrupciones espúreas no requieren EOI ni tienen efecto
+}
+
+static unsigned
+lapic_read(unsigned reg)
+{
+	return lapic[reg / sizeof(unsigned)];
+}
+
+static void
+lapic_write(unsigned reg, unsigned value)
+{
+	lapic[reg / sizeof(unsigned)] = value;
+}
+
+/* Medir las frecuencias del TSC y del timer del APIC contra el PIT */
+static void
+calibrate(void)
+{
+	unsigned long long tsc;
+
+	lapic_write(LAPIC_DIV, DIV_16);
+	lapic_write(LAPIC_LVT_TIMER, LVT_MASKED | VECTOR(LAPIC_TIMER_IRQ));
+	lapic_write(LAPIC_INIT, 0xFFFFFFFF);
+	tsc = mt_rdtsc();
+	mt_timer_busywait(CALIBRATE_MS);
+	tsc = mt_rdtsc() - tsc;
+	timer_khz = (0xFFFFFFFF - lapic_read(LAPIC_CURR)) / CALIBRATE_MS;
+	tsc_khz = tsc / CALIBRATE_MS;
+	lapic_write(LAPIC_INIT, 0);
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_setup_apic - inicializar el APIC local y su timer
+
+Retorna false si la CPU no tiene APIC local o TSC; en ese caso no se usan
+timers de alta resolución. Debe llamarse con interrupciones deshabilitadas,
+después de mt_setup_interrupts().
+--------------------------------------------------------------------------------
+*/
+
+bool
+mt_setup_apic(void)
+{
+	unsigned regs[4];
+	unsigned long long base;
+
+	mt_cpuid(CPUID_FEATURES, regs);
+	if ( !(regs[3] & CPUID_TSC) || !(regs[3] & CPUID_APIC) )
+		return false;
+	deadline_mode = (regs[2] & CPUID_DEADLINE) != 0;
+
+	/* Habilitar el APIC local */
+	base = mt_rdmsr(MSR_APIC_BASE) | APIC_ENABLE;
+	mt_wrmsr(MSR_APIC_BASE, base);
+	lapic = (volatile unsigned *)(unsigned)(base & APIC_BASE_MASK);
+	mt_set_int_handler(LAPIC_SPURIOUS_IRQ, spurious);
+	lapic_write(LAPIC_SVR, SVR_ENABLE | VECTOR(LAPIC_SPURIOUS_IRQ));
+
+	calibrate();
+	if ( !tsc_khz || !timer_khz )
+		return false;
+
+	lapic_write(LAPIC_LVT_TIMER, VECTOR(LAPIC_TIMER_IRQ) |
+		(deadline_mode ? LVT_DEADLINE : 0));
+	return true;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_setup_apic_ap - inicializar el APIC local de un procesador secundario
+
+Las frecuencias ya fueron calibradas por el procesador principal.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_setup_apic_ap(void)
+{
+	mt_wrmsr(MSR_APIC_BASE, mt_rdmsr(MSR_APIC_BASE) | APIC_ENABLE);
+	lapic_write(LAPIC_SVR, SVR_ENABLE | VECTOR(LAPIC_SPURIOUS_IRQ));
+	lapic_write(LAPIC_LVT_TIMER, VECTOR(LAPIC_TIMER_IRQ) |
+		(deadline_mode ? LVT_DEADLINE : 0));
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_lapic_id - identificador del APIC local de la CPU actual
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+mt_lapic_id(void)
+{
+	return lapic_read(LAPIC_ID) >> 24;
+}
+
+static void
+send_ipi(unsigned apic_id, unsigned command)
+{
+	while ( lapic_read(LAPIC_ICR_LOW) & ICR_BUSY )
+		mt_pause();
+	lapic_write(LAPIC_ICR_HIGH, ICR_DEST(apic_id));
+	lapic_write(LAPIC_ICR_LOW, command);
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_lapic_ipi - enviar una interrupción a otra CPU
+
+La interrupción se atiende en la CPU destino como cualquier interrupción del
+APIC local.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_lapic_ipi(unsigned apic_id, unsigned irq)
+{
+	send_ipi(apic_id, ICR_ASSERT | VECTOR(irq));
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_lapic_init_sipi - arrancar un procesador secundario
+
+Envía la secuencia INIT, STARTUP, STARTUP. El procesador arranca en modo real
+ejecutando en el comienzo de la página física indicada, que debe estar por
+debajo de 1 MB.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_lapic_init_sipi(unsigned apic_id, unsigned page)
+{
+	send_ipi(apic_id, ICR_ASSERT | ICR_INIT);
+	mt_timer_busywait(INIT_DELAY_MS);
+	send_ipi(apic_id, ICR_ASSERT | ICR_STARTUP | page);
+	mt_timer_busywait(SIPI_DELAY_MS);
+	send_ipi(apic_id, ICR_ASSERT | ICR_STARTUP | page);
+	mt_timer_busywait(SIPI_DELAY_MS);
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_lapic_eoi - fin de interrupción del APIC local
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_lapic_eoi(void)
+{
+	lapic_write(LAPIC_EOI, 0);
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_tsc_khz - frecuencia del TSC en KHz, cero si no fue calibrado
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+mt_tsc_khz(void)
+{
+	return tsc_khz;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_lapic_timer_arm - programar la interrupción del timer para un valor del TSC
+
+Reemplaza cualquier programación anterior. Si el vencimiento ya pasó, la
+interrupción se produce de inmediato.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_lapic_timer_arm(unsigned long long tsc)
+{
+	unsigned long long now, count;
+
+	if ( deadline_mode )
+	{
+		mt_wrmsr(MSR_DEADLINE, tsc);
+		return;
+	}
+
+	now = mt_rdtsc();
+	count = tsc > now ? (tsc - now) * timer_khz / tsc_khz : 0;
+	lapic_write(LAPIC_INIT, count ? min(count, 0xFFFFFFFF) : 1);
+}
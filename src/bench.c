@@ -0,0 +1,376 @@
+#include "kernel.h"
+
+/*
+	bench: microbenchmarks del kernel, en ciclos del TSC.
+
+	Cada prueba toma n muestras y muestra el minimo, la mediana, el
+	percentil 99 y el maximo:
+		yield	Yield() entre dos tareas, hasta que ejecuta la otra.
+		sem		SignalSem() hasta que ejecuta la tarea que esperaba en
+				WaitSem().
+		msg		ida y vuelta Send/Receive.
+		pipe	ida y vuelta PutPipe/GetPipe.
+		mqueue	ida y vuelta PutMsgQueue/GetMsgQueue.
+		timer	interrupcion de timer hasta que ejecuta la tarea que
+				desperto (a lo sumo TIMER_SAMPLES muestras).
+	Las tareas de prueba tienen mayor prioridad que el shell y, como el
+	shell mientras dura la prueba, ejecutan en la misma CPU. Los resultados
+	tambien se envian por el puerto serie, si existe, junto con un
+	histograma en potencias de 2, para poder compararlos entre versiones.
+	"bench n" toma n muestras por prueba.
+*/
+
+#define SAMPLES			1000
+#define MAX_SAMPLES		1000000			// maximo de muestras por prueba
+#define TIMER_SAMPLES	100
+#define TIMER_US		1000			// espera de la prueba de timer
+#define STACK_SIZE		4096
+#define PIPE_SIZE		64
+#define HIST_BUCKETS	32
+
+#define HEAD_FMT		"%-8s %6s %9s %9s %9s %9s"
+#define LINE_FMT		"%-8s %6u %9u %9u %9u %9u"
+
+#define HEAD_FG			YELLOW
+#define LINE_FG			LIGHTGRAY
+
+typedef struct
+{
+	char *			name;
+	void			(*run)(void);
+}
+Test_t;
+
+static unsigned where;					// destinos de la salida (outk)
+static unsigned *samples;
+static unsigned nsamples, count;
+static unsigned long long volatile stamp;
+static Semaphore_t *done;
+static unsigned prio;					// prioridad de las tareas de prueba
+static unsigned cpu;					// CPU de las pruebas
+
+static void
+record(unsigned long long cycles)
+{
+	if ( count < nsamples )
+		samples[count++] = cycles;
+}
+
+/* Crear una tarea de prueba en la CPU de las pruebas; avisa en done al terminar */
+static Task_t *
+start(TaskFunc_t func, char *name)
+{
+	Task_t *task = CreateTask(func, STACK_SIZE, NULL, name, prio);
+
+	SetAffinity(task, 1U << cpu);
+	Ready(task);
+	return task;
+}
+
+/* Prueba: Yield */
+
+static void
+yielder(void *arg)
+{
+	unsigned long long now;
+
+	while ( count < nsamples )
+	{
+		now = mt_rdtsc();
+		if ( stamp )
+			record(now - stamp);
+		stamp = mt_rdtsc();
+		Yield();
+	}
+	SignalSem(done);
+}
+
+static void
+test_yield(void)
+{
+	stamp = 0;
+	Atomic();						// que empiecen las dos juntas
+	start(yielder, "Yield 1");
+	start(yielder, "Yield 2");
+	Unatomic();
+	WaitSem(done);
+	WaitSem(done);
+}
+
+/* Prueba: semaforos */
+
+static Semaphore_t *sem;
+
+static void
+sem_waiter(void *arg)
+{
+	unsigned i;
+
+	for ( i = 0 ; i < nsamples ; i++ )
+	{
+		WaitSem(sem);
+		record(mt_rdtsc() - stamp);
+	}
+	SignalSem(done);
+}
+
+static void
+test_sem(void)
+{
+	unsigned i;
+
+	sem = CreateSem("Bench", 0);
+	start(sem_waiter, "Sem waiter");
+	for ( i = 0 ; i < nsamples ; i++ )
+	{
+		stamp = mt_rdtsc();
+		SignalSem(sem);
+	}
+	WaitSem(done);
+	DeleteSem(sem);
+}
+
+/* Prueba: mensajes */
+
+static void
+msg_server(void *arg)
+{
+	Task_t *from;
+	unsigned n, size;
+
+	do
+	{
+		from = NULL;
+		size = sizeof n;
+		Receive(&from, &n, &size);
+		Send(from, &n, sizeof n);
+	}
+	while ( n );
+	SignalSem(done);
+}
+
+static void
+test_msg(void)
+{
+	Task_t *srv = start(msg_server, "Msg server");
+	unsigned i, n, size;
+	unsigned long long t;
+
+	for ( i = 0 ; i <= nsamples ; i++ )
+	{
+		n = nsamples - i;
+		size = sizeof n;
+		t = mt_rdtsc();
+		Send(srv, &n, sizeof n);
+		Receive(&srv, &n, &size);
+		record(mt_rdtsc() - t);
+	}
+	WaitSem(done);
+}
+
+/* Prueba: pipes */
+
+static Pipe_t *pipe_req, *pipe_resp;
+
+static void
+pipe_server(void *arg)
+{
+	unsigned n;
+
+	do
+	{
+		GetPipe(pipe_req, &n, sizeof n);
+		PutPipe(pipe_resp, &n, sizeof n);
+	}
+	while ( n );
+	SignalSem(done);
+}
+
+static void
+test_pipe(void)
+{
+	unsigned i, n;
+	unsigned long long t;
+
+	pipe_req = CreatePipe("Bench req", PIPE_SIZE);
+	pipe_resp = CreatePipe("Bench resp", PIPE_SIZE);
+	start(pipe_server, "Pipe server");
+	for ( i = 0 ; i <= nsamples ; i++ )
+	{
+		n = nsamples - i;
+		t = mt_rdtsc();
+		PutPipe(pipe_req, &n, sizeof n);
+		GetPipe(pipe_resp, &n, sizeof n);
+		record(mt_rdtsc() - t);
+	}
+	WaitSem(done);
+	DeletePipe(pipe_req);
+	DeletePipe(pipe_resp);
+}
+
+/* Prueba: colas de mensajes */
+
+static MsgQueue_t *mq_req, *mq_resp;
+
+static void
+mq_server(void *arg)
+{
+	unsigned n;
+
+	do
+	{
+		GetMsgQueue(mq_req, &n);
+		PutMsgQueue(mq_resp, &n);
+	}
+	while ( n );
+	SignalSem(done);
+}
+
+static void
+test_mqueue(void)
+{
+	unsigned i, n;
+	unsigned long long t;
+
+	mq_req = CreateMsgQueue("Bench req", 1, sizeof n, false, false);
+	mq_resp = CreateMsgQueue("Bench resp", 1, sizeof n, false, false);
+	start(mq_server, "MQ server");
+	for ( i = 0 ; i <= nsamples ; i++ )
+	{
+		n = nsamples - i;
+		t = mt_rdtsc();
+		PutMsgQueue(mq_req, &n);
+		GetMsgQueue(mq_resp, &n);
+		record(mt_rdtsc() - t);
+	}
+	WaitSem(done);
+	DeleteMsgQueue(mq_req);
+	DeleteMsgQueue(mq_resp);
+}
+
+/* Prueba: latencia de la interrupcion de timer */
+
+static void
+timer_waiter(void *arg)
+{
+	unsigned long long now, irq;
+
+	while ( count < nsamples )
+	{
+		DelayUs(TIMER_US);
+		now = mt_rdtsc();
+		if ( (irq = mt_last_timer_tsc()) && irq < now )
+			record(now - irq);
+	}
+	SignalSem(done);
+}
+
+static void
+test_timer(void)
+{
+	nsamples = min(nsamples, TIMER_SAMPLES);
+	start(timer_waiter, "Timer waiter");
+	WaitSem(done);
+}
+
+static Test_t tests[] =
+{
+	{ "yield",	test_yield },
+	{ "sem",	test_sem },
+	{ "msg",	test_msg },
+	{ "pipe",	test_pipe },
+	{ "mqueue",	test_mqueue },
+	{ "timer",	test_timer },
+	{ }
+};
+
+/* Ordenar las muestras (Shell sort) */
+static void
+sort(unsigned *v, unsigned n)
+{
+	unsigned gap, i, j, x;
+
+	for ( gap = n / 2 ; gap ; gap /= 2 )
+		for ( i = gap ; i < n ; i++ )
+		{
+			x = v[i];
+			for ( j = i ; j >= gap && v[j - gap] > x ; j -= gap )
+				v[j] = v[j - gap];
+			v[j] = x;
+		}
+}
+
+static void
+report(char *name)
+{
+	unsigned i, b, hist[HIST_BUCKETS];
+	char buf[PRINTK_LINE], *p;
+
+	if ( !count )
+	{
+		outk(where, LINE_FG, "%-8s %6u\n", name, 0);
+		return;
+	}
+	sort(samples, count);
+	outk(where, LINE_FG, LINE_FMT "\n", name, count, samples[0], samples[count / 2],
+		samples[(count * 99) / 100], samples[count - 1]);
+
+	if ( !(where & OUT_SERIAL) )
+		return;
+	memset(hist, 0, sizeof hist);
+	for ( i = 0 ; i < count ; i++ )
+	{
+		for ( b = 0 ; b < HIST_BUCKETS - 1 && (samples[i] >> b) > 1 ; b++ )
+			;
+		hist[b]++;
+	}
+	p = buf + sprintf(buf, "# hist %s", name);
+	for ( b = 0 ; b < HIST_BUCKETS && p < buf + PRINTK_LINE - 24 ; b++ )
+		if ( hist[b] )
+			p += sprintf(p, " %u:%u", 1U << b, hist[b]);
+	sprintf(p, "\n");
+	mt_serial_puts(buf);
+}
+
+int
+bench_main(int argc, char *argv[])
+{
+	Task_t *self = CurrentTask();
+	unsigned n = argc > 1 ? atoi(argv[1]) : SAMPLES;
+	unsigned affinity = GetAffinity(self);
+	Test_t *t;
+
+	if ( !n || n > MAX_SAMPLES )
+	{
+		cprintk(LIGHTRED, BLACK, "Uso: bench [muestras], a lo sumo %u\n", MAX_SAMPLES);
+		return 1;
+	}
+	if ( !(samples = TryMalloc(n * sizeof(unsigned))) )
+	{
+		cprintk(LIGHTRED, BLACK, "No hay memoria para %u muestras\n", n);
+		return 2;
+	}
+
+	where = OUT_CONSOLE | (mt_serial_init(SERIAL_BAUD) ? OUT_SERIAL : 0);
+	done = CreateSem("Bench done", 0);
+	prio = GetPriority(self) + 1;
+	DisableInts();
+	cpu = mt_this_cpu()->id;
+	SetAffinity(self, 1U << cpu);
+	RestoreInts();
+
+	outk(where, HEAD_FG, "# mtask bench khz=%u cpus=%u\n", mt_tsc_khz(), mt_ncpus);
+	outk(where, HEAD_FG, HEAD_FMT "\n", "Prueba", "N", "Minimo", "Mediana", "P99", "Maximo");
+	for ( t = tests ; t->name ; t++ )
+	{
+		nsamples = n;
+		count = 0;
+		t->run();
+		report(t->name);
+	}
+
+	SetAffinity(self, affinity);
+	DeleteSem(done);
+	Free(samples);
+	return 0;
+}
@@ -23,6 +23,16 @@ static bool cursor_on = true;
 static bool raw;
 static unsigned scrolls;
 
+/*
+	La salida de las distintas CPUs se serializa con un lock propio de la
+	consola, sin el lock del kernel. El lock es anidable en la misma CPU,
+	para que una secuencia de operaciones (posicionar el cursor, escribir,
+	borrar el resto de la linea) pueda tomarlo alrededor de printk.
+*/
+static Spinlock_t cons_lock;
+static Cpu_t *lock_owner;
+static unsigned lock_depth;
+
 static void
 setcursor(void)
 {
@@ -65,6 +75,39 @@ put(unsigned char ch)
 
 /* Interfaz pública */
 
+void
+mt_cons_init(void)
+{
+	mt_spin_init(&cons_lock, "console");
+	mt_spin_register(&cons_lock);
+}
+
+unsigned
+mt_cons_lock(void)
+{
+	unsigned flags = mt_irqsave();
+	Cpu_t *cpu = mt_this_cpu();
+
+	if (lock_owner != cpu)
+	{
+		mt_spin_lock(&cons_lock);
+		lock_owner = cpu;
+	}
+	lock_depth++;
+	return flags;
+}
+
+void
+mt_cons_unlock(unsigned flags)
+{
+	if (!--lock_depth)
+	{
+		lock_owner = NULL;
+		mt_spin_unlock(&cons_lock);
+	}
+	mt_irqrestore(flags);
+}
+
 void
 mt_cons_clear(void)
 {
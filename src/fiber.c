@@ -0,0 +1,374 @@
+#include "kernel.h"
+
+/*
+	Fibers: actividades livianas que ejecutan dentro de una tarea, el host.
+
+	Una fiber no tiene stack ni bloque de control de tarea: es una funcion
+	reanudable (ver FIBER_BEGIN en mtask.h) mas un Fiber_t. Cuando tiene que
+	esperar, registra la espera y retorna al host, que ejecuta otra. Puede
+	esperar en semaforos, en colas de mensajes y por tiempo; las esperas con
+	timeout se guardan en un arbol rojo-negro del host, ordenado por
+	vencimiento. Cuando no tiene fibers listas, el host duerme en su semaforo
+	wake hasta que alguna se despierte o venza la primera espera.
+
+	Las esperas en semaforos se registran en el semaforo con el lock del
+	kernel y el del semaforo tomados, y se despiertan con el lock del kernel
+	tomado, de modo que el estado de una fiber en espera solo cambia con el
+	lock del kernel. La cola de listas del host tiene su propio lock.
+	Las fibers no usan los mutexes de serializacion de las colas de mensajes:
+	no deben compartir un extremo serializado de una cola con tareas.
+*/
+
+#define TIMER_FIBER(node)	((Fiber_t *)((char *)(node) - __builtin_offsetof(Fiber_t, timer_node)))
+
+struct FiberHost_t
+{
+	Spinlock_t		lock;				// protege la cola de listas y count
+	Fiber_t *		ready_head;			// cola de fibers listas
+	Fiber_t *		ready_tail;
+	bool			idle;				// el host va a dormir en wake
+	unsigned		count;				// fibers vivas
+	Semaphore_t *	wake;
+	RbTree_t		timers;				// esperas con timeout, por vencimiento
+};
+
+/* Poner una fiber al final de la cola de listas de su host */
+static void
+ready(Fiber_t *fiber)
+{
+	FiberHost_t *host = fiber->host;
+	unsigned flags = mt_spin_lock_irqsave(&host->lock);
+	bool wake = host->idle;
+
+	host->idle = false;
+	fiber->state = FiberReady;
+	fiber->next = NULL;
+	if ( (fiber->prev = host->ready_tail) )
+		host->ready_tail->next = fiber;
+	else
+		host->ready_head = fiber;
+	host->ready_tail = fiber;
+	mt_spin_unlock_irqrestore(&host->lock, flags);
+	if ( wake )
+		SignalSem(host->wake);
+}
+
+/* Registrar el vencimiento de una espera en el arbol del host */
+static void
+arm_timer(Fiber_t *fiber, unsigned msecs)
+{
+	RbTree_t *timers = &fiber->host->timers;
+	RbNode_t **link = &timers->root, *parent = NULL;
+
+	fiber->deadline = mt_rdtsc() + (unsigned long long) mt_tsc_khz() * msecs;
+	while ( *link )
+	{
+		parent = *link;
+		link = fiber->deadline < TIMER_FIBER(parent)->deadline ? &parent->left : &parent->right;
+	}
+	mt_rb_insert(timers, &fiber->timer_node, parent, link);
+}
+
+static void
+disarm_timer(Fiber_t *fiber)
+{
+	if ( !fiber->deadline )
+		return;
+	mt_rb_erase(&fiber->host->timers, &fiber->timer_node);
+	fiber->deadline = 0;
+}
+
+/* Sacar una fiber de la lista de espera de un semaforo, con su lock tomado */
+static void
+unlink_sem(Fiber_t *fiber, Semaphore_t *sem)
+{
+	if ( fiber->prev )
+		fiber->prev->next = fiber->next;
+	else
+		sem->fiber_head = fiber->next;
+	if ( fiber->next )
+		fiber->next->prev = fiber->prev;
+	else
+		sem->fiber_tail = fiber->prev;
+	fiber->prev = fiber->next = NULL;
+	fiber->sem = NULL;
+}
+
+/*
+--------------------------------------------------------------------------------
+expire - despierta las fibers cuyas esperas vencieron
+
+Una fiber que esperaba en un semaforo completa la espera con false; una que
+esperaba por tiempo, con true. Si ya la habia despertado el semaforo, solo
+se desarma el timer.
+--------------------------------------------------------------------------------
+*/
+
+static void
+expire(FiberHost_t *host)
+{
+	unsigned long long now = mt_rdtsc();
+	Fiber_t *fiber;
+	Semaphore_t *sem;
+
+	while ( host->timers.leftmost && (fiber = TIMER_FIBER(host->timers.leftmost))->deadline <= now )
+	{
+		disarm_timer(fiber);
+		DisableInts();
+		if ( fiber->state == FiberWaiting )
+		{
+			if ( (sem = fiber->sem) )
+			{
+				mt_spin_lock(&sem->lock);
+				unlink_sem(fiber, sem);
+				mt_spin_unlock(&sem->lock);
+			}
+			mt_fiber_wakeup(fiber, !sem);
+		}
+		RestoreInts();
+	}
+}
+
+/* Dormir hasta que haya una fiber lista o venza la primera espera */
+static void
+idle(FiberHost_t *host)
+{
+	unsigned long long now, deadline, usecs;
+
+	if ( !host->timers.leftmost )
+	{
+		WaitSem(host->wake);
+		return;
+	}
+	now = mt_rdtsc();
+	if ( (deadline = TIMER_FIBER(host->timers.leftmost)->deadline) <= now )
+		return;
+	usecs = (deadline - now) * 1000 / mt_tsc_khz() + 1;
+	WaitSemTimedUs(host->wake, min(usecs, FOREVER - 1ULL));
+}
+
+/*
+--------------------------------------------------------------------------------
+CreateFiberHost, DeleteFiberHost - creacion y destruccion de un host de fibers
+
+Un host no se puede destruir mientras tenga fibers vivas.
+--------------------------------------------------------------------------------
+*/
+
+FiberHost_t *
+CreateFiberHost(char *name)
+{
+	FiberHost_t *host = Malloc(sizeof(FiberHost_t));
+
+	host->wake = CreateSem(name, 0);
+	mt_spin_init(&host->lock, host->wake->queue->name);
+	mt_spin_register(&host->lock);
+	return host;
+}
+
+void
+DeleteFiberHost(FiberHost_t *host)
+{
+	if ( host->count )
+		Panic("DeleteFiberHost: hay fibers vivas");
+	mt_spin_unregister(&host->lock);
+	DeleteSem(host->wake);
+	Free(host);
+}
+
+/*
+--------------------------------------------------------------------------------
+CreateFiber - crea una fiber lista para ejecutar en un host
+
+Se puede llamar desde cualquier tarea o desde otra fiber. La fiber ejecuta
+func(fiber) cada vez que se reanuda, con fiber->arg igual a arg, hasta que
+func retorna false; entonces el host la destruye.
+--------------------------------------------------------------------------------
+*/
+
+Fiber_t *
+CreateFiber(FiberHost_t *host, FiberFunc_t func, void *arg)
+{
+	Fiber_t *fiber = Malloc(sizeof(Fiber_t));
+	unsigned flags;
+
+	fiber->func = func;
+	fiber->arg = arg;
+	fiber->host = host;
+	flags = mt_spin_lock_irqsave(&host->lock);
+	host->count++;
+	mt_spin_unlock_irqrestore(&host->lock, flags);
+	ready(fiber);
+	return fiber;
+}
+
+/*
+--------------------------------------------------------------------------------
+RunFibers - ejecuta las fibers de un host en la tarea actual
+
+Retorna cuando no quedan fibers vivas en el host. Las fibers listas ejecutan
+en orden de llegada.
+--------------------------------------------------------------------------------
+*/
+
+void
+RunFibers(FiberHost_t *host)
+{
+	Fiber_t *fiber;
+	unsigned flags;
+
+	while ( true )
+	{
+		expire(host);
+
+		flags = mt_spin_lock_irqsave(&host->lock);
+		if ( !host->count )
+		{
+			mt_spin_unlock_irqrestore(&host->lock, flags);
+			return;
+		}
+		if ( (fiber = host->ready_head) && !(host->ready_head = fiber->next) )
+			host->ready_tail = NULL;
+		host->idle = !fiber;
+		mt_spin_unlock_irqrestore(&host->lock, flags);
+
+		if ( !fiber )
+		{
+			idle(host);
+			continue;
+		}
+
+		disarm_timer(fiber);
+		fiber->prev = fiber->next = NULL;
+		fiber->state = FiberRunning;
+		if ( fiber->func(fiber) )
+			continue;
+
+		flags = mt_spin_lock_irqsave(&host->lock);
+		host->count--;
+		mt_spin_unlock_irqrestore(&host->lock, flags);
+		Free(fiber);
+	}
+}
+
+/*
+--------------------------------------------------------------------------------
+FiberYield, FiberDelay, FiberWaitSem, FiberGetMsgQueue, FiberPutMsgQueue -
+operaciones que pueden suspender a una fiber
+
+Se usan a traves de las macros FIBER_YIELD, FIBER_DELAY, etc. Retornan true
+si la fiber debe suspenderse; cuando se reanuda, FIBER_AWAIT vuelve a llamar
+a la misma operacion, que completa y retorna false. El resultado de las
+esperas queda en fiber->status, con el mismo significado que en WaitSemTimed,
+GetMsgQueueTimed, etc. Un timeout cero no suspende y FOREVER no vence.
+--------------------------------------------------------------------------------
+*/
+
+bool
+FiberYield(Fiber_t *fiber)
+{
+	if ( fiber->pending )
+		return fiber->pending = false;
+	ready(fiber);
+	return fiber->pending = true;
+}
+
+bool
+FiberDelay(Fiber_t *fiber, unsigned msecs)
+{
+	fiber->status = true;
+	if ( fiber->pending || !msecs )
+		return fiber->pending = false;
+	if ( msecs == FOREVER )
+		Panic("FiberDelay: espera infinita");
+	fiber->state = FiberWaiting;
+	arm_timer(fiber, msecs);
+	return fiber->pending = true;
+}
+
+bool
+FiberWaitSem(Fiber_t *fiber, Semaphore_t *sem, unsigned msecs)
+{
+	if ( fiber->pending )
+		return fiber->pending = false;
+	if ( sem->queue->inherit )
+		Panic("FiberWaitSem: semaforo con herencia de prioridad");
+
+	DisableInts();
+	mt_spin_lock(&sem->lock);
+	if ( (fiber->status = sem->value > 0) )
+		sem->value--;
+	else if ( msecs )
+	{
+		fiber->state = FiberWaiting;
+		fiber->sem = sem;
+		fiber->next = NULL;
+		if ( (fiber->prev = sem->fiber_tail) )
+			sem->fiber_tail->next = fiber;
+		else
+			sem->fiber_head = fiber;
+		sem->fiber_tail = fiber;
+		fiber->pending = true;
+	}
+	mt_spin_unlock(&sem->lock);
+	RestoreInts();
+
+	if ( fiber->pending && msecs != FOREVER )
+		arm_timer(fiber, msecs);
+	return fiber->pending;
+}
+
+bool
+FiberGetMsgQueue(Fiber_t *fiber, MsgQueue_t *mq, void *msg, unsigned msecs)
+{
+	if ( FiberWaitSem(fiber, mq->sem_get, msecs) )
+		return true;
+	if ( fiber->status )
+		mt_msgqueue_get(mq, msg);
+	return false;
+}
+
+bool
+FiberPutMsgQueue(Fiber_t *fiber, MsgQueue_t *mq, void *msg, unsigned msecs)
+{
+	if ( FiberWaitSem(fiber, mq->sem_put, msecs) )
+		return true;
+	if ( fiber->status )
+		mt_msgqueue_put(mq, msg);
+	return false;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_fiber_dequeue - saca la primera fiber que espera en un semaforo
+
+Se llama con el lock del kernel y el del semaforo tomados. Retorna NULL si
+no espera ninguna.
+--------------------------------------------------------------------------------
+*/
+
+Fiber_t *
+mt_fiber_dequeue(Semaphore_t *sem)
+{
+	Fiber_t *fiber;
+
+	if ( (fiber = sem->fiber_head) )
+		unlink_sem(fiber, sem);
+	return fiber;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_fiber_wakeup - completa la espera de una fiber y la pone en la cola de
+				  listas de su host
+
+Se llama con el lock del kernel tomado.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_fiber_wakeup(Fiber_t *fiber, bool status)
+{
+	fiber->status = status;
+	ready(fiber);
+}
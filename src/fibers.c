@@ -0,0 +1,113 @@
+#include "kernel.h"
+
+/*
+	fibers: prueba de fibers (ver fiber.c).
+
+	Crea n fibers productoras y una consumidora en un host que ejecuta en la
+	tarea del shell. Cada productora espera un tiempo al azar y envia su
+	numero por una cola de mensajes, ROUNDS veces; la consumidora recibe
+	todos los mensajes y verifica que llegue la misma cantidad de cada una.
+	Muestra el tiempo total y la memoria que ocupa una fiber comparada con
+	la de una tarea. "fibers n" crea n productoras.
+*/
+
+#define FIBERS			1000
+#define MAX_FIBERS		10000			// acota la memoria que usa la prueba
+#define ROUNDS			10
+#define DELAY_MS		50				// espera maxima de una productora
+#define QUEUE_SIZE		64
+
+typedef struct
+{
+	unsigned		round;
+	unsigned		received;
+}
+Producer_t;
+
+static Producer_t *producers;
+static unsigned nproducers;
+static MsgQueue_t *mq;
+
+typedef struct
+{
+	unsigned		count;
+	unsigned		id;
+}
+Consumer_t;
+
+static bool
+producer(Fiber_t *f)
+{
+	Producer_t *p = f->arg;
+	unsigned id = p - producers;
+
+	FIBER_BEGIN(f);
+	for ( p->round = 0 ; p->round < ROUNDS ; p->round++ )
+	{
+		FIBER_DELAY(f, 1 + rand() % DELAY_MS);
+		FIBER_PUT_MSGQUEUE(f, mq, &id, FOREVER);
+	}
+	FIBER_END(f);
+}
+
+static bool
+consumer(Fiber_t *f)
+{
+	Consumer_t *c = f->arg;
+
+	FIBER_BEGIN(f);
+	for ( c->count = 0 ; c->count < nproducers * ROUNDS ; c->count++ )
+	{
+		FIBER_GET_MSGQUEUE(f, mq, &c->id, FOREVER);
+		if ( c->id < nproducers )
+			producers[c->id].received++;
+	}
+	FIBER_END(f);
+}
+
+int
+fibers_main(int argc, char *argv[])
+{
+	FiberHost_t *host;
+	Consumer_t cons;
+	unsigned i, bad = 0, msecs, khz;
+	unsigned long long start;
+
+	nproducers = argc > 1 ? atoi(argv[1]) : FIBERS;
+	if ( !nproducers || nproducers > MAX_FIBERS )
+	{
+		cprintk(LIGHTRED, BLACK, "Uso: fibers [n], a lo sumo %u\n", MAX_FIBERS);
+		return 1;
+	}
+	if ( !(producers = TryMalloc(nproducers * sizeof(Producer_t))) )
+	{
+		cprintk(LIGHTRED, BLACK, "No hay memoria para %u fibers\n", nproducers);
+		return 2;
+	}
+
+	mq = CreateMsgQueue("Fibers", QUEUE_SIZE, sizeof(unsigned), false, false);
+	host = CreateFiberHost("Fibers");
+
+	start = mt_rdtsc();
+	CreateFiber(host, consumer, &cons);
+	for ( i = 0 ; i < nproducers ; i++ )
+		CreateFiber(host, producer, &producers[i]);
+	RunFibers(host);
+	msecs = (khz = mt_tsc_khz()) ? (mt_rdtsc() - start) / khz : 0;
+
+	for ( i = 0 ; i < nproducers ; i++ )
+		if ( producers[i].received != ROUNDS )
+			bad++;
+
+	cprintk(LIGHTGRAY, BLACK, "Fibers: %u, mensajes: %u, tiempo: %u ms\n",
+		nproducers + 1, cons.count, msecs);
+	cprintk(LIGHTGRAY, BLACK, "Bytes por fiber: %u (mas su estado), por tarea: %u (mas su stack)\n",
+		sizeof(Fiber_t), sizeof(Task_t));
+	if ( bad )
+		cprintk(LIGHTRED, BLACK, "%u fibers con mensajes perdidos\n", bad);
+
+	DeleteFiberHost(host);
+	DeleteMsgQueue(mq);
+	Free(producers);
+	return bad ? 2 : 0;
+}
@@ -3,13 +3,17 @@
 /*
 	Trabajamos en modo flat y en ring 0.
 	Utilizamos una GDT con dos segmentos, uno de código (CS = 0x8) y 
-	otro de	datos (DS, ES, FS, GS y SS = 0x10). No usamos LDT.
+	otro de	datos (DS, ES, GS y SS = 0x10). No usamos LDT.
 	Ambos segmentos empiezan en 0 y abarcan toda la memoria (4 GB).
 	La idea es inicializar los registros de segmento una vez y después no 
 	tocarlos nunca más.
+	La excepción es FS: a continuación hay un segmento de datos por CPU, cuya
+	base son los datos propios de esa CPU (Cpu_t), y cada una lo carga en FS.
 */
 
-static segment_desc gdt[] = 
+#define CPU_DESC	3					// primer descriptor de CPU
+
+static segment_desc gdt[CPU_DESC + MAX_CPUS] = 
 {
 	{
 		/* Primer descriptor nulo */
@@ -41,14 +45,35 @@ setup_gdt(void)
 	mt_load_gdt(&gdtr, 0x8, 0x10);
 }
 
+/*
+	Arma el segmento de datos de una CPU con la base indicada y retorna su
+	selector.
+*/
+unsigned
+mt_cpu_segment(unsigned cpu, void *base)
+{
+	segment_desc *d = &gdt[CPU_DESC + cpu];
+
+	d->type = DESC_MEMRW;
+	d->present = 1;
+	d->bits32 = 1;
+	d->gran = 1;
+	d->base_low = (unsigned) base & 0xFFFFFF;
+	d->base_high = (unsigned) base >> 24;
+	d->limit_low = 0xFFFF;
+	d->limit_high = 0xF;
+	return (CPU_DESC + cpu) * sizeof(segment_desc);
+}
+
 static gate_desc idt[NUM_INTS];
 
+static void load_idt(void);
+
 static void setup_idt(void)
 {
 	unsigned i;
 	int_stub *sptr;
 	gate_desc *dptr;
-	region_desc idtr;
 
 	/* Inicializar las entradas de la IDT con los stubs de interrupción */
 	for ( i = 0, sptr = mt_int_stubs, dptr = idt ; i < NUM_INTS ; i++, sptr++, dptr++ )
@@ -60,10 +85,17 @@ static void setup_idt(void)
 		dptr->offset_high = ((unsigned) sptr) >> 16;
 	}
 
+	/* Cargar IDTR */
+	load_idt();
+}
+
+static void
+load_idt(void)
+{
+	region_desc idtr;
+
 	idtr.base = (unsigned) idt;
 	idtr.limit = sizeof idt - 1;
-
-	/* Cargar IDTR */
 	mt_load_idt(&idtr);
 }
 
@@ -72,3 +104,10 @@ void mt_setup_gdt_idt(void)
 	setup_gdt();
 	setup_idt();
 }
+
+/* Cargar las tablas ya inicializadas, en los procesadores secundarios */
+void mt_load_gdt_idt(void)
+{
+	setup_gdt();
+	load_idt();
+}
@@ -3,10 +3,16 @@ bits 32
 ; Mantener sincronizado con la definición de la estructura Task_t en mtask.h.
 Task_t.esp equ 20	
 
-extern mt_curr_task
-extern mt_select_task
+; Mantener sincronizado con la definición de la estructura Cpu_t en kernel.h.
+Cpu_t.curr_task equ 4
+Cpu_t.int_level equ 12
+Cpu_t.int_stack equ 16
+
 extern mt_int_handler
-extern mt_int_level
+extern mt_int_enter
+extern mt_int_exit
+extern mt_do_softirqs
+extern mt_switch_done
 
 global mt_int_stubs
 
@@ -84,65 +90,102 @@ define_stub 45, noerror
 define_stub 46, noerror
 define_stub 47, noerror
 
+; Interrupciones del APIC local
+
+define_stub 48, noerror
+define_stub 49, noerror
+define_stub 50, noerror
+define_stub 51, noerror
+define_stub 52, noerror
+define_stub 53, noerror
+define_stub 54, noerror
+define_stub 55, noerror
+define_stub 56, noerror
+define_stub 57, noerror
+define_stub 58, noerror
+define_stub 59, noerror
+define_stub 60, noerror
+define_stub 61, noerror
+define_stub 62, noerror
+define_stub 63, noerror
+
 ; Código común para todos los manejadores
 common_handler:
 
-	; Desarmamos el stack y guardamos algunos valores en variables estáticas.
-	; Están protegidas porque están deshabilitadas las interrupciones
-	; (todas las entradas de la IDT son interrupt gates).
-	pop dword [int_number]					; número de interrupción
-	pop dword [except_error]				; código de error
-	pop dword [int_eip]						; dirección de retorno
-	add esp, 4								; descartar segmento de código
-	pop dword [int_eflags]					; flags
-
-	; Ahora armamos nuestro stack frame. Esto tiene que estar
+	; Rearmamos el stack frame en el lugar, sin usar variables estáticas porque
+	; puede haber varias CPUs atendiendo interrupciones al mismo tiempo.
+	; Al entrar el stack tiene número de interrupción, código de error,
+	; dirección de retorno, segmento de código y flags. Esto tiene que estar
 	; sincronizado con la estructura mt_regs_t en kernel.h y con la función
 	; mt_context_switch() en libasm.asm.
-	; Empujar dirección de retorno y contexto. Al no haber segmento ni flags
-	; por encima de la dirección de retorno, esta función terminará con ret
-	; en vez de iret.
-	push dword [int_eip]
-	push dword [int_eflags]
+	; La dirección de retorno queda en el lugar de los flags y estos en el
+	; del segmento de código. Al no haber segmento ni flags por encima de la
+	; dirección de retorno, esta función terminará con ret en vez de iret.
+	; El número de interrupción y el código de error quedan en ecx y ebx, y
+	; sus lugares se usan para guardar los registros.
 	push eax
-	push ebx
-	push ecx
+	mov eax, [esp + 12]						; dirección de retorno
+	xchg eax, [esp + 20]					; eax = flags
+	mov [esp + 16], eax
+	pop eax
+	mov [esp + 8], eax
+	xchg ebx, [esp + 4]						; ebx = código de error
+	xchg ecx, [esp]							; ecx = número de interrupción
 	push edx
 	push esi
 	push edi
 	push ebp
-	mov [regs_ptr], esp						; puntero a los registros
+	mov edx, esp							; puntero a los registros
 
-	; Si se trata de una interrupción de primer nivel, cambiamos a un stack
-	; interno. Para interrupciones anidadas mantenemos el mismo stack.
-	inc dword [mt_int_level]
-	cmp dword [mt_int_level], 1
+	; Si se trata de una interrupción de primer nivel, cambiamos al stack
+	; de interrupciones de esta CPU y tomamos el lock del kernel. Para
+	; interrupciones anidadas mantenemos el mismo stack.
+	inc dword [fs:Cpu_t.int_level]
+	cmp dword [fs:Cpu_t.int_level], 1
 	jne stack_ok1
-	mov eax, [mt_curr_task]
+	mov eax, [fs:Cpu_t.curr_task]
 	mov [eax + Task_t.esp], esp				; guardar stack actual
-	mov esp, int_stack_end					; cambiar a stack interno
+	mov esp, [fs:Cpu_t.int_stack]			; cambiar a stack interno
+	push edx
+	push ecx
+	call mt_int_enter
+	pop ecx
+	pop edx
 
 stack_ok1:
 
 	; Llamamos al manejador genérico en C, pasándole como argumentos número
 	; de interrupción, código de error (que solamente será distinto de cero para
 	; algunas excepciones) y puntero a la estructura de registros.
-	push dword [regs_ptr]
-	push dword [except_error]
-	push dword [int_number]
+	push edx
+	push ebx
+	push ecx
 	call mt_int_handler						; mt_int_handler(int_number, except_error, regs)
 	cli										; por si el manejador habilito interrupciones
 	add esp, 12
 
+	; Al terminar una interrupción de primer nivel ejecutamos las softirqs
+	; pendientes, todavía en el stack de interrupciones y antes de
+	; seleccionar la próxima tarea. mt_do_softirqs() habilita interrupciones
+	; mientras ejecutan y retorna con ellas deshabilitadas; las que lleguen
+	; mientras tanto son anidadas porque int_level sigue en 1.
+	cmp dword [fs:Cpu_t.int_level], 1
+	jne no_softirqs
+	call mt_do_softirqs
+	cli
+no_softirqs:
+
 	; Si estamos retornando de una interrupción de primer nivel,
-	; llamamos a mt_select_task() para que eventualmente cambie el
-	; proceso actual, y cambiamos al stack de ese proceso. Si se trata
-	; de una interrupción anidada seguimos con el mismo stack.
-	dec dword [mt_int_level]
+	; mt_int_exit() llama a mt_select_task() para que eventualmente cambie el
+	; proceso actual, y cambiamos al stack de ese proceso. Ya en ese stack,
+	; mt_switch_done() libera el lock si corresponde. Si se trata de una
+	; interrupción anidada seguimos con el mismo stack.
+	dec dword [fs:Cpu_t.int_level]
 	jnz stack_ok2
-	call mt_select_task	
-	mov eax, [mt_curr_task]
+	call mt_int_exit
+	mov eax, [fs:Cpu_t.curr_task]
 	mov esp, [eax + Task_t.esp]				; cambiar al stack del proceso actual
+	call mt_switch_done
 
 stack_ok2:
 
@@ -156,17 +199,3 @@ stack_ok2:
 	pop eax
 	popfd
 	ret
-
-section .bss
-
-except_error: resd 1
-int_number:resd 1
-int_eip: resd 1
-int_eflags: resd 1
-regs_ptr: resd 1
-
-align 4
-int_stack: resb 0x4000
-int_stack_end:
-
-
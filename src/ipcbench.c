@@ -0,0 +1,150 @@
+#include "kernel.h"
+
+/*
+	ipcbench: costo de ida y vuelta de Send/Receive.
+
+	La tarea del shell envia un mensaje a un servidor de mayor prioridad que
+	espera en Receive, y espera la respuesta. Se mide el promedio de ciclos
+	del TSC por ida y vuelta y los cambios de contexto, con y sin la cesion
+	directa de la CPU al receptor (ver handoff() en kernel.c), y con Call y
+	ReplyWait en lugar de Send y Receive. "ipcbench n" hace n idas y vueltas
+	en cada caso. El shell y el servidor ejecutan en la misma CPU, para que
+	con varias CPUs los casos no mezclen despertares remotos con cesiones.
+*/
+
+#define ROUNDS			10000
+#define STACK_SIZE		4096
+
+#define HEAD_FMT		"%-10s %9s %12s %9s %9s"
+#define LINE_FMT		"%-10s %9u %12u %9u %4u.%02u"
+
+#define HEAD_FG			YELLOW
+#define LINE_FG			LIGHTGRAY
+
+typedef enum { ModeQueue, ModeHandoff, ModeCall } Mode_t;
+
+static unsigned cpu;					// CPU de las pruebas
+
+static void
+server(void *arg)
+{
+	Task_t *from;
+	unsigned n = 1, size;
+
+	do
+	{
+		from = NULL;
+		size = sizeof n;
+		if ( !Receive(&from, &n, &size) )
+			continue;
+		Send(from, &n, sizeof n);
+	}
+	while ( n );
+}
+
+static void
+call_server(void *arg)
+{
+	Task_t *from = NULL;
+	unsigned n = 1, size;
+
+	do
+	{
+		size = sizeof n;
+		if ( !ReplyWait(from, &n, sizeof n, &from, &n, &size) )
+			from = NULL;
+	}
+	while ( n );
+	Send(from, &n, sizeof n);
+}
+
+static unsigned
+handoffs(void)
+{
+	unsigned i, n = 0;
+
+	for ( i = 0 ; i < mt_ncpus ; i++ )
+		n += mt_cpus[i].handoffs;
+	return n;
+}
+
+static unsigned
+switches(Task_t *task)
+{
+	return task->vol_switches + task->invol_switches;
+}
+
+/* Ejecuta rounds idas y vueltas y muestra el resultado */
+static void
+run(char *name, unsigned rounds, Mode_t mode)
+{
+	Task_t *srv, *self = CurrentTask();
+	unsigned i, n, size, count, sw;
+	unsigned long long start;
+	bool save = mt_ipc_handoff;
+
+	mt_ipc_handoff = mode != ModeQueue;
+	srv = CreateTask(mode == ModeCall ? call_server : server, STACK_SIZE, NULL,
+		"IPC server", GetPriority(self) + 1);
+	SetAffinity(srv, 1U << cpu);
+	Ready(srv);
+
+	count = handoffs();
+	sw = switches(self) + switches(srv);
+	start = mt_rdtsc();
+	for ( i = 1 ; i <= rounds ; i++ )
+	{
+		n = i;
+		size = sizeof n;
+		if ( mode == ModeCall )
+			Call(srv, &n, sizeof n, &n, &size);
+		else
+		{
+			Send(srv, &n, sizeof n);
+			Receive(&srv, &n, &size);
+		}
+	}
+	start = mt_rdtsc() - start;
+	count = handoffs() - count;
+	sw = switches(self) + switches(srv) - sw;
+
+	n = 0;
+	Send(srv, &n, sizeof n);
+	Receive(&srv, &n, &size);
+	mt_ipc_handoff = save;
+
+	sw = sw * 100ULL / rounds;
+	cprintk(LINE_FG, BLACK, LINE_FMT, name, rounds, (unsigned)(start / rounds), count,
+		sw / 100, sw % 100);
+	printk("\n");
+}
+
+int
+ipcbench_main(int argc, char *argv[])
+{
+	unsigned rounds = argc > 1 ? atoi(argv[1]) : ROUNDS;
+	Task_t *self = CurrentTask();
+	unsigned affinity;
+
+	if ( !rounds )
+	{
+		cprintk(LIGHTRED, BLACK, "Uso: ipcbench [idas y vueltas]\n");
+		return 1;
+	}
+
+	/* Fijar el shell a la CPU actual mientras duran las pruebas */
+	affinity = GetAffinity(self);
+	DisableInts();
+	cpu = mt_this_cpu()->id;
+	SetAffinity(self, 1U << cpu);
+	RestoreInts();
+
+	cprintk(HEAD_FG, BLACK, HEAD_FMT, "Modo", "Vueltas", "Ciclos/vta", "Cesiones", "Camb/vta");
+	printk("\n");
+	run("cola", rounds, ModeQueue);
+	run("directa", rounds, ModeHandoff);
+	run("call", rounds, ModeCall);
+
+	SetAffinity(self, affinity);
+	return 0;
+}
@@ -3,6 +3,7 @@
 #define MASTER		0x20				// PIC maestro, registro base
 #define SLAVE		0xA0				// PIC esclavo, registro base
 #define CTL(pic)	((pic)+1)			// Registro de control del PIC
+#define READ_IRR	0x0A				// OCW3: leer registro de pedidos
 #define BIT(n)		(1 << ((n) & 0x7))	// Máscara para IRQ n
 
 #define ICW1        0x11				// 4 ICWs, modo cascada, por flanco
@@ -12,7 +13,22 @@
 #define ICW3_SLAVE  0x02 				// Esclavo en IRQ2 del maestro
 #define ICW4        0x01 				// Modo 8086
 
-unsigned mt_int_level;
+// Máscaras de los PICs, un bit por IRQ (bits 8-15 para el esclavo). Cada PIC
+// se programa con la unión de las IRQs deshabilitadas y las que están siendo
+// atendidas, que se enmascaran mientras ejecuta su manejador.
+static unsigned disabled = 0xFFFB;		// Todas menos la 2 (cascada)
+static unsigned in_service;
+
+static void
+write_mask(unsigned irq)
+{
+	unsigned mask = disabled | in_service;
+
+	if ( irq <= 7 )
+		outb(CTL(MASTER), mask & 0xFF);
+	else
+		outb(CTL(SLAVE), mask >> 8);
+}
 
 static void 
 setup_pics(void)
@@ -22,14 +38,14 @@ setup_pics(void)
 	outb(CTL(MASTER), ICW2_MASTER);
 	outb(CTL(MASTER), ICW3_MASTER);
 	outb(CTL(MASTER), ICW4);
-	outb(CTL(MASTER), 0xFB);			// Deshabilitar todas menos la 2
+	write_mask(0);						// Deshabilitar todas menos la 2
 
 	// Esclavo
 	outb(SLAVE, ICW1);
 	outb(CTL(SLAVE), ICW2_SLAVE);
 	outb(CTL(SLAVE), ICW3_SLAVE);
 	outb(CTL(SLAVE), ICW4);
-	outb(CTL(SLAVE), 0xFF);				// Deshabilitar todas
+	write_mask(8);						// Deshabilitar todas
 }
 
 static void 
@@ -37,7 +53,12 @@ eoi(unsigned irq)
 {
 	unsigned command = 0x60 | (irq & 0x7);
 
-	if (irq < 8)
+	if (irq >= NUM_PIC_IRQS)			// APIC local
+	{
+		if (irq != LAPIC_SPURIOUS_IRQ)
+			mt_lapic_eoi();
+	}
+	else if (irq < 8)
 		outb(MASTER, command);
 	else
 	{
@@ -48,6 +69,7 @@ eoi(unsigned irq)
 
 static exception_handler exception[NUM_EXCEPT];
 static interrupt_handler interrupt[NUM_INTS-NUM_EXCEPT];
+static HandlerStats_t irq_stats[NUM_INTS-NUM_EXCEPT];
 
 static void 
 unhandled_exception(unsigned num, unsigned error, mt_regs_t *regs)
@@ -68,16 +90,62 @@ unhandled_interrupt(unsigned num)
 		;
 }
 
+/*
+	Los manejadores de interrupciones de hardware ejecutan con interrupciones
+	habilitadas, enmascarando solamente su propia linea: las del PIC se
+	enmascaran en el PIC y reciben el EOI antes de llamar al manejador; las
+	del APIC local reciben el EOI al final, y hasta entonces el APIC no
+	entrega otra interrupcion de la misma prioridad. Otra interrupcion puede
+	entonces anidarse sobre un manejador lento. En una interrupcion de primer
+	nivel el manejador ejecuta ademas sin el lock del kernel (ver
+	mt_int_unlock), para no demorar a las demas CPUs: un manejador que use
+	estructuras del kernel sin llamar a sus funciones debe hacerlo dentro de
+	DisableInts()/RestoreInts(), que toma el lock solo durante la seccion;
+	las funciones del kernel ya lo hacen. Al salir de la seccion
+	RestoreInts() vuelve a habilitar las interrupciones.
+*/
+
 void
 mt_int_handler(unsigned int_number, unsigned except_error, mt_regs_t *regs)
 {
+	unsigned long long start;
+	unsigned cycles, level;
+	HandlerStats_t *st;
+
 	if ( int_number < NUM_EXCEPT )	// Excepción
 		exception[int_number](int_number, except_error, regs);
 	else							// Interrupción	de HW
 	{
 		int_number -= NUM_EXCEPT;	// Nro. de irq
+		mt_idle_wakeup(int_number);
+		mt_trace(TraceIrqEnter, mt_curr_task, int_number);
+		if ( int_number < NUM_PIC_IRQS )
+		{
+			in_service |= 1 << int_number;
+			write_mask(int_number);
+			eoi(int_number);
+		}
+		start = mt_rdtsc();
+		level = mt_int_unlock();
+		mt_sti();
 		interrupt[int_number](int_number);
-		eoi(int_number);
+		mt_cli();
+		cycles = mt_rdtsc() - start;
+		mt_int_relock(level);
+		if ( int_number < NUM_PIC_IRQS )
+		{
+			in_service &= ~(1 << int_number);
+			write_mask(int_number);
+		}
+		else
+			eoi(int_number);
+		mt_trace(TraceIrqExit, mt_curr_task, int_number);
+
+		// Contadores por manejador, sin el trabajo diferido (softirq.c)
+		st = &irq_stats[int_number];
+		st->count++;
+		st->cycles += cycles;
+		st->max_cycles = max(st->max_cycles, cycles);
 	}
 }
 
@@ -101,6 +169,23 @@ mt_set_int_handler(unsigned irq_num, interrupt_handler handler)
 	interrupt[irq_num] = handler ? handler : unhandled_interrupt;
 }
 
+/* Copia los contadores de las irqs que tuvieron interrupciones */
+unsigned
+mt_irq_stats(HandlerStats_t stats[], unsigned max)
+{
+	unsigned i, n = 0;
+
+	DisableInts();
+	for ( i = 0 ; i < NUM_INTS-NUM_EXCEPT && n < max ; i++ )
+		if ( irq_stats[i].count )
+		{
+			stats[n] = irq_stats[i];
+			stats[n++].num = i;
+		}
+	RestoreInts();
+	return n;
+}
+
 void 
 mt_set_exception_handler(unsigned except_num, exception_handler handler)
 {
@@ -110,23 +195,34 @@ mt_set_exception_handler(unsigned except_num, exception_handler handler)
 void
 mt_disable_irq(unsigned irq)
 {
+	if ( irq >= NUM_PIC_IRQS )			// Las del APIC local se manejan en apic.c
+		return;
 	DisableInts();
-	if ( irq <= 7 )
-		outb(CTL(MASTER), inb(CTL(MASTER)) | BIT(irq));
-	else
-		outb(CTL(SLAVE), inb(CTL(SLAVE)) | BIT(irq));
+	disabled |= 1 << irq;
+	write_mask(irq);
 	RestoreInts();
 }
 
 void
 mt_enable_irq(unsigned irq)
 {
+	if ( irq >= NUM_PIC_IRQS )			// Las del APIC local se manejan en apic.c
+		return;
 	DisableInts();
-	if ( irq <= 7 )
-		outb(CTL(MASTER), inb(CTL(MASTER)) & ~BIT(irq));
-	else
-		outb(CTL(SLAVE), inb(CTL(SLAVE)) & ~BIT(irq));
+	disabled &= ~(1 << irq);
+	write_mask(irq);
 	RestoreInts();
 }
 
+bool
+mt_irq_pending(unsigned irq)
+{
+	unsigned pic = irq <= 7 ? MASTER : SLAVE;
+	bool pending;
 
+	DisableInts();
+	outb(pic, READ_IRR);
+	pending = (inb(pic) & BIT(irq)) != 0;
+	RestoreInts();
+	return pending;
+}
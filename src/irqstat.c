@@ -0,0 +1,55 @@
+#include "kernel.h"
+
+/*
+	irqstat: contadores de los manejadores de interrupcion y de las softirqs.
+
+	Para cada irq que tuvo interrupciones y para cada softirq registrada
+	muestra la cantidad de ejecuciones y el tiempo promedio y maximo de su
+	manejador, en microsegundos (cero si el TSC no fue calibrado). El tiempo
+	de una irq no incluye el trabajo que dejo diferido en sus softirqs.
+*/
+
+#define MAX_HANDLERS	(NUM_INTS - NUM_EXCEPT)
+
+#define HEAD_FMT		"%-10s %10s %9s %9s"
+#define IRQ_FMT			"IRQ %-6u %10u %9u %9u"
+#define SOFTIRQ_FMT		"%-10.10s %10u %9u %9u"
+
+#define HEAD_FG			YELLOW
+#define LINE_FG			LIGHTGRAY
+
+static unsigned
+cycles_to_us(unsigned long long cycles)
+{
+	unsigned khz = mt_tsc_khz();
+
+	return khz ? cycles * 1000 / khz : 0;
+}
+
+int
+irqstat_main(int argc, char *argv[])
+{
+	HandlerStats_t *stats = Malloc(MAX_HANDLERS * sizeof(HandlerStats_t)), *st;
+	unsigned i, n;
+
+	n = mt_irq_stats(stats, MAX_HANDLERS);
+	cprintk(HEAD_FG, BLACK, HEAD_FMT "\n", "Manejador", "Cuenta", "Prom us", "Max us");
+	for ( i = 0 ; i < n ; i++ )
+	{
+		st = &stats[i];
+		cprintk(LINE_FG, BLACK, IRQ_FMT "\n", st->num, st->count,
+			cycles_to_us(st->cycles / st->count), cycles_to_us(st->max_cycles));
+	}
+
+	n = mt_softirq_stats(stats, MAX_HANDLERS);
+	cprintk(HEAD_FG, BLACK, "\n" HEAD_FMT "\n", "Softirq", "Cuenta", "Prom us", "Max us");
+	for ( i = 0 ; i < n ; i++ )
+	{
+		st = &stats[i];
+		cprintk(LINE_FG, BLACK, SOFTIRQ_FMT "\n", st->name, st->count,
+			st->count ? cycles_to_us(st->cycles / st->count) : 0, cycles_to_us(st->max_cycles));
+	}
+
+	Free(stats);
+	return 0;
+}
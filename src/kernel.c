@@ -4,32 +4,99 @@
 #define CLOCKIRQ		0				/* interrupcion de timer */
 #define MIN_STACK		4096			/* tamaño de stack mínimo */ 
 #define INIFL			0x200			/* flags iniciales, IF=1 */
-#define MSPERTICK 		20				/* 50 Hz */
-#define QUANTUM			2				/* 40 mseg */
+#define EFLAGS_IF		0x200			/* flag de interrupciones habilitadas */
+#define QUANTUM			2				/* 40 mseg, politica por defecto */
+#define DYNTICK			true			/* tick dinamico en la tarea nula */
+#define MAX_PIT_COUNT	0xFFFF			/* maxima cuenta del PIT */
+#define LOADTICKS		(1000 / MSPERTICK)	/* periodo de medicion de carga */
+#define BALANCETICKS	(200 / MSPERTICK)	/* periodo de equilibrio entre CPUs */
+#define INT_STACK		0x4000			/* stack de interrupciones por CPU */
+#define EDF_BUDGET		900				/* utilizacion maxima de tareas periodicas,
+										   en milesimos */
+#define REAPER_PRIO		(MIN_PRIO + 1)	/* prioridad del reaper */
+#define REAP_BATCH		8				/* tareas liberadas por pasada */
+#define REAP_HIGH		32				/* pendientes a partir de las cuales
+										   CreateTask libera por su cuenta */
 
-Task_t * volatile mt_curr_task;			/* tarea en ejecucion */
-Task_t * volatile mt_last_task;			/* tarea anterior */
-Task_t * volatile mt_fpu_task;			/* tarea que tiene el coprocesador */
 unsigned long long volatile mt_ticks;	/* ticks ocurridos desde el arranque */
+Task_t *mt_task_list;					/* lista de todas las tareas */
+unsigned mt_idle_pct;					/* % ocioso en el ultimo periodo */
+bool mt_ipc_handoff = true;				/* cesion directa en Send */
 
 static Task_t main_task;				/* tarea principal */
-static volatile unsigned ticks_to_run;	/* ranura de tiempo */
-static TaskQueue_t ready_q;				/* cola de tareas ready */
+static Spinlock_t kernel_lock;			/* lock del kernel */
+static char bsp_int_stack[INT_STACK];	/* stack de interrupciones de la CPU 0 */
 static TaskQueue_t terminated_q;		/* cola de tareas terminadas */
+static unsigned terminated_count;		/* tareas en terminated_q */
+static Task_t *reaper_task;				/* libera las tareas terminadas */
+static TaskQueue_t reaper_q;			/* espera del reaper */
 static Switcher_t save_restore;			/* cambio de contexto adicional */
 
+static enum								/* modo del timer */
+{
+	TickPeriodic,						/* interrupcion en cada tick */
+	TickIdle,							/* one-shot por idle_ticks ticks */
+	TickRealign							/* one-shot hasta el proximo tick */
+}
+tick_mode;
+static unsigned idle_ticks;				/* ticks programados en modo TickIdle */
+
+static bool hrtimers;					/* timers de alta resolucion (APIC) */
+static unsigned tsc_per_tick;			/* ciclos del TSC por tick */
+static unsigned edf_util;				/* utilizacion admitida, en milesimos */
+
 static void scheduler(void);
 
+static void set_state(Task_t *task, TaskState_t state);
+static void update_priority(Task_t *task);
+static int take_ready(Task_t *task);
+static void put_ready(Task_t *task, int cpu);
+static void unqueue(Task_t *task);
+static void link_wait(WaitEntry_t *entry);
+static void unlink_wait(WaitEntry_t *entry);
+static bool try_wait(WaitObject_t *obj, WaitEntry_t *entry);
 static void block(Task_t *task, TaskState_t state);
 static void ready(Task_t *task, bool success);
+static bool handoff(Task_t *task);
+static void deliver(Task_t *to, void *msg, unsigned size);
+static void accept(Task_t *sender, void *msg, unsigned *size);
 static void free_task(Task_t *task);
 
-static unsigned msecs_to_ticks(unsigned msecs);
-static unsigned ticks_to_msecs(unsigned ticks);
-
-static void free_terminated(void);		/* libera tareas terminadas */
+static unsigned usecs_to_ticks(unsigned long long usecs);
+static void set_timeout(Task_t *task, unsigned long long usecs);
+static void arm_timeout(Task_t *task);
+static void expire(Task_t *task);
+static void delay(unsigned long long usecs);
+
+static unsigned density(Task_t *task);
+static void start_period(Task_t *task, unsigned long long release);
+static bool next_period(Task_t *task);
+static void wait_release(Task_t *task);
+static void charge_budget(Task_t *task);
+static int compare_tasks(Task_t *a, Task_t *b);
+static unsigned fair_slice(Task_t *task, Cpu_t *cpu);
+
+static unsigned reap(unsigned max);		/* libera tareas terminadas */
+static void reaper(void *arg);			/* funcion del reaper */
 static void do_nothing(void *arg);		/* funcion de la tarea nula */
 static void clockint(unsigned irq);		/* manejador interrupcion de timer */
+static void hrtimerint(unsigned irq);	/* manejador timer del APIC local */
+static void tick(void);					/* procesamiento de un tick */
+static void idle_enter(void);			/* pasar a tick dinamico */
+static void sample_load(void);			/* medir el tiempo ocioso */
+
+static void giant_lock(void);			/* lock del kernel */
+static void giant_unlock(void);
+static bool allowed(Task_t *task, Cpu_t *cpu);
+static bool preempts(Task_t *task, Cpu_t *cpu);
+static Cpu_t *select_cpu(Task_t *task);	/* CPU para una tarea ready */
+static Task_t *migrate(Cpu_t *from, Cpu_t *to);
+static Cpu_t *busiest_cpu(Cpu_t *except);
+static bool steal(Cpu_t *cpu);			/* tomar una tarea de otra CPU */
+static void balance(void);				/* equilibrar la carga */
+static void resched(unsigned irq);		/* manejador IPI de replanificacion */
+static void idle_halt(void);			/* detener la CPU sin el lock */
+static void start_cpus(void);			/* arrancar los procesadores secundarios */
 
 // Stackframe inicial de una tarea
 typedef struct
@@ -42,7 +109,12 @@ InitialStack_t;
 
 /*
 --------------------------------------------------------------------------------
-Malloc, StrDup, Free - manejo de memoria dinamica
+Malloc, TryMalloc, StrDup, Free - manejo de memoria dinamica
+
+El heap tiene su propio lock (ver malloc.c), por lo que no hace falta tomar
+el del kernel. Si no hay memoria, se recupera la de las tareas terminadas y
+la de los pools antes de fallar. Malloc y StrDup fallan con Panic;
+TryMalloc retorna NULL, para pedidos cuyo tamaño decide el usuario.
 --------------------------------------------------------------------------------
 */
 
@@ -51,12 +123,23 @@ Malloc(unsigned size)
 {
 	void *p;
 
-	Atomic();
-	free_terminated();
-	if ( !(p = malloc(size)) )
+	if ( !(p = TryMalloc(size)) )
 		Panic("Error malloc");
+	return p;
+}
+
+void *
+TryMalloc(unsigned size)
+{
+	void *p;
+
+	if ( !(p = malloc(size)) )
+	{
+		mt_reclaim();
+		if ( !(p = malloc(size)) )
+			return NULL;
+	}
 	memset(p, 0, size);
-	Unatomic();
 	return p;
 }
 
@@ -67,406 +150,1418 @@ StrDup(char *str)
 
 	if ( !str )
 		return NULL;
-	Atomic();
-	free_terminated();
 	if ( !(p = malloc(strlen(str) + 1)) )
-		Panic("Error strdup");
+	{
+		mt_reclaim();
+		if ( !(p = malloc(strlen(str) + 1)) )
+			Panic("Error strdup");
+	}
 	strcpy(p, str);
-	Unatomic();
 	return p;
 }
 
 void
 Free(void *mem)
 {
-	if ( !mem )
-		return;
-	Atomic();
-	free(mem);
-	Unatomic();
+	if ( mem )
+		free(mem);
 }
 
 /*
 --------------------------------------------------------------------------------
-msecs_to_ticks, ticks_to_msecs - conversion de milisegundos a ticks y viceversa
+mt_timeout_ms, mt_timeout_us - conversion de los argumentos de las funciones
+							   con timeout a microsegundos
+
+Todos los timeouts se manejan internamente en microsegundos, en 64 bits para
+que cualquier valor en milisegundos se pueda representar sin perdida.
+FOREVER se convierte en FOREVER_US.
 --------------------------------------------------------------------------------
 */
 
-static unsigned 
-msecs_to_ticks(unsigned msecs)
+unsigned long long
+mt_timeout_ms(unsigned msecs)
 {
-	return (msecs + MSPERTICK - 1) / MSPERTICK;
+	return msecs == FOREVER ? FOREVER_US : msecs * 1000ULL;
 }
 
-static unsigned 
-ticks_to_msecs(unsigned ticks)
+unsigned long long
+mt_timeout_us(unsigned usecs)
 {
-	return ticks * MSPERTICK;
+	return usecs == FOREVER ? FOREVER_US : usecs;
 }
 
 /*
 --------------------------------------------------------------------------------
-block - bloquea una tarea
+usecs_to_ticks - conversion de microsegundos a ticks
 --------------------------------------------------------------------------------
 */
 
-static void
-block(Task_t *task, TaskState_t state)
+static unsigned 
+usecs_to_ticks(unsigned long long usecs)
 {
-	mt_dequeue(task);
-	mt_dequeue_time(task);
-	task->state = state;
+	return (usecs + USPERTICK - 1) / USPERTICK;
 }
 
 /*
 --------------------------------------------------------------------------------
-ready - desbloquea una tarea y la pone en la cola de ready
+set_timeout - pone una tarea en la cola de tiempo por una cantidad de 
+			  microsegundos
 
-Si la tarea estaba bloqueado en WaitQueue, Send o Receive, el argumento
-success determina el status de retorno de la funcion que la bloqueo.
+Sin timers de alta resolucion la espera se redondea a ticks. Con ellos, se
+calcula el valor del TSC en que vence y arm_timeout() la ubica en la cola
+que corresponda.
 --------------------------------------------------------------------------------
 */
 
 static void
-ready(Task_t *task, bool success)
+set_timeout(Task_t *task, unsigned long long usecs)
 {
-	if ( task->state == TaskReady )
+	if ( !hrtimers )
+	{
+		task->timeout = 0;
+		mt_enqueue_time(task, usecs_to_ticks(usecs));
 		return;
-
-	mt_dequeue(task);
-	mt_dequeue_time(task);
-	mt_enqueue(task, &ready_q);
-	task->success = success;
-	task->state = TaskReady;
+	}
+	task->timeout = mt_rdtsc() + usecs * mt_tsc_khz() / 1000;
+	arm_timeout(task);
 }
 
 /*
 --------------------------------------------------------------------------------
-CreateTask - crea una tarea.
+arm_timeout - ubica una espera de alta resolucion en la cola de tiempo
 
-Recibe un puntero a una funcion de tipo void f(void*), tamano del stack,
-un puntero para pasar como argumento, nombre, prioridad inicial.
-Toma memoria para crear el stack y lo inicializa para que retorne
-a Exit(). Una vez creada una tarea, hay que comenzar a ejecutarla llamando 
-a Ready().
+Si faltan dos ticks o mas, la tarea va a la rueda de tiempo por una cantidad
+de ticks que garantiza que venza antes del plazo; al vencer, expire() la
+vuelve a ubicar. Si faltan menos, va a la cola de alta resolucion y, si queda
+primera, se reprograma el timer del APIC local.
 --------------------------------------------------------------------------------
 */
 
-Task_t *
-CreateTask(TaskFunc_t func, unsigned stacksize, void *arg, char *name, unsigned priority)
+static void
+arm_timeout(Task_t *task)
 {
-	Task_t *task;
-	InitialStack_t *s;
-
-	/* alocar bloque de control */
-	task = Malloc(sizeof(Task_t));
-	task->name = task->send_queue.name = StrDup(name);
-	task->priority = priority;
-
-	/* alocar stack */
-	stacksize &= ~3;					// redondear a multiplos de 4
-	if ( stacksize < MIN_STACK )		// garantizar tamaño mínimo
-		stacksize = MIN_STACK;
-	task->stack = Malloc(stacksize);	// malloc alinea adecuadamente
-
-	/* inicializar stack */
-	s = (InitialStack_t *)(task->stack + stacksize) - 1;
-	s->arg = arg;
-	s->retaddr = Exit;				/* direccion de retorno de func() */
-	s->regs.eflags = INIFL;
-	s->regs.eip = (unsigned) func;
-	task->esp = (unsigned) s;
+	unsigned long long now = mt_rdtsc();
+	unsigned ticks;
 
-	return task;
+	if ( task->timeout > now && (ticks = (task->timeout - now) / tsc_per_tick) >= 2 )
+		mt_enqueue_time(task, ticks - 1);
+	else
+	{
+		mt_enqueue_hrtime(task);
+		if ( mt_peekfirst_hrtime() == task )
+			mt_lapic_timer_arm(task->timeout);
+	}
 }
 
 /*
 --------------------------------------------------------------------------------
-DeleteTask - elimina una tarea creada con CreateTask
+expire - vencimiento de una tarea en la rueda de tiempo
 
-Si es la actual, se bloquea en la cola de tareas terminadas.
+Despierta a la tarea, salvo que tenga un plazo de alta resolucion que todavia
+no se cumplio.
 --------------------------------------------------------------------------------
 */
 
 static void
-free_task(Task_t *task)
-{
-	if ( task->name )
-		free(task->name);
-	free(task->stack);
-	if ( task->math_data )
-		free(task->math_data);
-	free(task);
-}
-
-void
-DeleteTask(Task_t *task)
+expire(Task_t *task)
 {
-	if ( task == &main_task )
-		Panic("Imposible eliminar la tarea principal");
-
-	FlushQueue(&task->send_queue, false);
-	if ( mt_fpu_task == task )
-		mt_fpu_task = NULL;
-	DisableInts();
-	if ( task == mt_curr_task )
-	{
-		mt_curr_task->state = TaskTerminated;
-		mt_enqueue(mt_curr_task, &terminated_q);
-		scheduler();
-	}
+	if ( task->timeout && task->timeout > mt_rdtsc() )
+		arm_timeout(task);
 	else
 	{
-		block(task, TaskTerminated);
-		free_task(task);
+		mt_trace(TraceExpire, task, 0);
+		ready(task, false);
 	}
-	RestoreInts();
 }
 
 /*
 --------------------------------------------------------------------------------
-free_terminated - elimina las tareas terminadas.
+mt_update_stats - actualiza la contabilidad de una tarea
+
+Suma el tiempo transcurrido desde su ultimo cambio de estado al contador que
+corresponde al estado actual. Si estaba ejecutando y es SchedFair, suma el
+mismo tiempo a su vruntime, ponderado por su peso.
 --------------------------------------------------------------------------------
 */
 
 void
-free_terminated(void)
+mt_update_stats(Task_t *task)
 {
-	Task_t *task;
+	unsigned long long now = mt_rdtsc();
+	unsigned long long elapsed = now - task->stamp;
 
-	while ( (task = mt_getlast(&terminated_q)) )
-		free_task(task);
+	switch ( task->state )
+	{
+		case TaskCurrent:
+			task->run_cycles += elapsed;
+			if ( task->policy == SchedFair )
+			{
+				task->vruntime += elapsed * DEFAULT_WEIGHT / task->weight;
+				if ( task->cpu )
+					mt_fair_advance(task->cpu->id, task->vruntime);
+			}
+			break;
+		case TaskReady:
+			task->ready_cycles += elapsed;
+			break;
+		default:
+			task->blocked_cycles += elapsed;
+			break;
+	}
+	task->stamp = now;
 }
 
 /*
 --------------------------------------------------------------------------------
-CurrentTask - retorna un puntero a la tarea actual.
+set_state - cambia el estado de una tarea, actualizando su contabilidad
 --------------------------------------------------------------------------------
 */
 
-Task_t *
-CurrentTask(void)
+static void
+set_state(Task_t *task, TaskState_t state)
 {
-	return mt_curr_task;
+	mt_update_stats(task);
+	task->state = state;
 }
 
-
 /*
 --------------------------------------------------------------------------------
-Panic - error fatal del sistema
+density - fraccion de la CPU reservada por una tarea periodica, en milesimos
+
+Se calcula sobre el menor entre el plazo y el periodo, lo que hace que la
+suma sobre todas las tareas sea un criterio suficiente de planificabilidad
+para EDF. Se redondea hacia arriba.
 --------------------------------------------------------------------------------
 */
 
-void
-Panic(char *msg)
+static unsigned
+density(Task_t *task)
 {
-	DisableInts();
-	cprintk(RED, LIGHTGRAY, "\nPANIC [%s]: %s", mt_curr_task->name, msg);
-	while ( true )
-		;
+	unsigned window = min(task->rel_deadline, task->period);
+
+	return (task->runtime * 1000 + window - 1) / window;
 }
 
 /*
 --------------------------------------------------------------------------------
-Pause - suspende la tarea actual
+start_period, next_period - comienzo de un periodo de una tarea periodica
+
+start_period inicia un periodo en el tick indicado, renovando el plazo y el
+tiempo de CPU disponible. next_period inicia el periodo siguiente al actual,
+o uno a partir del tick actual si la tarea se atraso mas de un periodo;
+retorna true si el periodo todavia no comenzo.
 --------------------------------------------------------------------------------
 */
 
-void
-Pause(void)
+static void
+start_period(Task_t *task, unsigned long long release)
 {
-	Suspend(mt_curr_task);
+	task->release = release;
+	task->deadline = release + task->rel_deadline;
+	task->budget = task->runtime;
+}
+
+static bool
+next_period(Task_t *task)
+{
+	unsigned long long release = task->release + task->period;
+
+	start_period(task, release + task->period <= mt_ticks ? mt_ticks : release);
+	return task->release > mt_ticks;
 }
 
 /*
 --------------------------------------------------------------------------------
-Yield - cede voluntariamente la CPU
+wait_release - bloquea una tarea periodica hasta el comienzo de su periodo
 --------------------------------------------------------------------------------
 */
 
-void
-Yield(void)
+static void
+wait_release(Task_t *task)
 {
-	Ready(mt_curr_task);
+	block(task, TaskDelaying);
+	task->timeout = 0;
+	mt_enqueue_time(task, task->release - mt_ticks - 1);
 }
 
 /*
 --------------------------------------------------------------------------------
-Delay - pone a la tarea actual a dormir durante una cantidad de milisegundos
+charge_budget - descuenta un tick del tiempo de CPU de una tarea periodica
+
+Si lo agoto, la tarea se detiene hasta el comienzo de su proximo periodo,
+para que no afecte a las demas. Una tarea en modo atomico no puede
+bloquearse: se la detiene en el primer tick en que salga de el.
 --------------------------------------------------------------------------------
 */
 
-void
-Delay(unsigned msecs)
+static void
+charge_budget(Task_t *task)
 {
-	DisableInts();
-	if ( msecs )
-	{
-		block(mt_curr_task, TaskDelaying);
-		if ( msecs != FOREVER )
-			mt_enqueue_time(mt_curr_task, msecs_to_ticks(msecs));
-	}
-	else
-		ready(mt_curr_task, false);
-	scheduler();
-	RestoreInts();
+	if ( task->budget && --task->budget )
+		return;
+	if ( task->atomic_level )
+		return;
+	if ( next_period(task) )
+		wait_release(task);
 }
 
 /*
 --------------------------------------------------------------------------------
-Exit - finaliza la tarea actual
+compare_tasks - compara la precedencia de dos tareas para el scheduler
 
-Todas las tareas creadas con CreateTask retornan a esta funcion que las mata.
-Esta funcion nunca retorna.
+Retorna un valor positivo si a debe ejecutar antes que b, negativo si b debe
+ejecutar antes que a y cero si son equivalentes. Las tareas periodicas van
+antes que las demas y entre ellas se comparan los plazos. Las SchedFair
+forman una banda justo debajo del nivel FAIR_PRIO: van despues de las de
+prioridad fija FAIR_PRIO o mayor y antes que las de prioridad menor. Entre
+dos SchedFair, una va antes que la otra solamente si su vruntime es menor
+por mas de FAIR_WAKEUP_MS: asi una tarea que despierta desaloja a la actual
+solo si lo merece, y el resto lo deciden las ranuras de tiempo. Las demas se
+comparan por prioridad.
 --------------------------------------------------------------------------------
 */
 
-void
-Exit(void)
+static int
+compare_tasks(Task_t *a, Task_t *b)
 {
-	DeleteTask(mt_curr_task);
+	unsigned long long margin;
+
+	if ( a->period && b->period )
+		return a->deadline < b->deadline ? 1 : a->deadline > b->deadline ? -1 : 0;
+	if ( a->period || b->period )
+		return a->period ? 1 : -1;
+	if ( mt_fair(a) && mt_fair(b) )
+	{
+		margin = (unsigned long long) mt_tsc_khz() * FAIR_WAKEUP_MS;
+		return a->vruntime + margin < b->vruntime ? 1 : b->vruntime + margin < a->vruntime ? -1 : 0;
+	}
+	if ( mt_fair(a) )
+		return b->priority >= FAIR_PRIO ? -1 : 1;
+	if ( mt_fair(b) )
+		return a->priority >= FAIR_PRIO ? 1 : -1;
+	return (int) a->priority - (int) b->priority;
 }
 
 /*
 --------------------------------------------------------------------------------
-Suspend - suspende una tarea
+fair_slice - ranura de tiempo de una tarea SchedFair, en ticks
+
+Cada tarea recibe una parte de FAIR_LATENCY_MS proporcional a su peso
+respecto de las que esperan en la misma CPU, y al menos un tick.
 --------------------------------------------------------------------------------
 */
 
-void
-Suspend(Task_t *task)
+static unsigned
+fair_slice(Task_t *task, Cpu_t *cpu)
 {
-	DisableInts();
-	block(task, TaskSuspended);
-	if ( task == mt_curr_task )
-		scheduler();
-	RestoreInts();
+	unsigned total = mt_fair_weight(cpu->id) + task->weight;
+
+	return usecs_to_ticks(FAIR_LATENCY_MS * 1000ULL * task->weight / total);
 }
 
 /*
 --------------------------------------------------------------------------------
-Ready - pone una tarea en la cola ready
+update_priority - recalcula la prioridad efectiva de una tarea
+
+La prioridad efectiva es la mayor entre la base y la de la tarea mas
+prioritaria que espera en alguna de las colas con herencia que posee. Si
+cambia, se reubica a la tarea en su cola y, si esta esperando en una cola con
+herencia, se propaga el cambio al dueño de esa cola.
 --------------------------------------------------------------------------------
 */
 
-void
-Ready(Task_t *task)
+static void
+update_priority(Task_t *task)
 {
-	DisableInts();
-	ready(task, false);
-	scheduler();
-	RestoreInts();
+	unsigned priority, cpu;
+	TaskQueue_t *queue;
+
+	while ( task )
+	{
+		priority = task->base_priority;
+		for ( queue = task->owned ; queue ; queue = queue->owned_next )
+			if ( queue->tail && queue->tail->priority > priority )
+				priority = queue->tail->priority;
+		if ( priority == task->priority )
+			return;
+
+		task->priority = priority;
+		if ( task->state == TaskReady )
+		{
+			cpu = mt_ready_cpu(task);
+			mt_dequeue(task);
+			mt_enqueue_ready(task, cpu);
+			return;
+		}
+		if ( !(queue = task->queue) )
+			return;
+		mt_dequeue(task);
+		mt_enqueue(task, queue);
+		task = queue->owner;
+	}
 }
 
 /*
 --------------------------------------------------------------------------------
-GetPriority - retorna la prioridad de una tarea
+take_ready, put_ready - sacan una tarea de la cola de ready de su CPU y la
+						vuelven a poner
+
+Se usan cuando cambia algo que determina su lugar en la cola, como la
+politica o el peso: hay que sacarla con los valores anteriores y encolarla
+con los nuevos, para que las sumas de la cola (como el peso de las
+SchedFair) se mantengan consistentes. take_ready retorna la CPU de la cola,
+o -1 si la tarea no estaba en una cola de ready; en ese caso put_ready no
+hace nada.
 --------------------------------------------------------------------------------
 */
 
-unsigned
-GetPriority(Task_t *task)
+static int
+take_ready(Task_t *task)
 {
-	return task->priority;
+	unsigned cpu;
+
+	if ( task->state != TaskReady || !task->queue )
+		return -1;
+	cpu = mt_ready_cpu(task);
+	mt_dequeue(task);
+	return cpu;
+}
+
+static void
+put_ready(Task_t *task, int cpu)
+{
+	if ( cpu >= 0 )
+		mt_enqueue_ready(task, cpu);
 }
 
 /*
 --------------------------------------------------------------------------------
-SetPriority - establece la prioridad de una tarea
+mt_set_owner - cambia el dueño de una cola con herencia de prioridad
 
-Si la tarea estaba en una cola, la desencola y la vuelve a encolar para
-reflejar el cambio de prioridad en su posición en la cola.
-Si se le ha cambiado la prioridad a la tarea actual o a una que esta ready se
-llama al scheduler.
+El dueño anterior vuelve a la prioridad que le corresponda y el nuevo hereda
+la de las tareas que esperan en la cola. Debe llamarse con interrupciones
+deshabilitadas.
 --------------------------------------------------------------------------------
 */
 
-void		
-SetPriority(Task_t *task, unsigned priority)
+void
+mt_set_owner(TaskQueue_t *queue, Task_t *owner)
 {
-	TaskQueue_t *queue;
+	Task_t *old = queue->owner;
+	TaskQueue_t **p;
 
-	DisableInts();
-	task->priority = priority;
-	if ( (queue = task->queue) )
+	if ( owner == old )
+		return;
+	if ( old )
 	{
-		mt_dequeue(task);
-		mt_enqueue(task, queue);
+		for ( p = &old->owned ; *p != queue ; p = &(*p)->owned_next )
+			;
+		*p = queue->owned_next;
 	}
-	if ( task == mt_curr_task || task->state == TaskReady )
-		scheduler();
-	RestoreInts();
+	if ( (queue->owner = owner) )
+	{
+		queue->owned_next = owner->owned;
+		owner->owned = queue;
+		update_priority(owner);
+	}
+	if ( old )
+		update_priority(old);
 }
 
 /*
 --------------------------------------------------------------------------------
-SetData - establece un puntero a datos privados de una tarea
+unqueue - saca a una tarea de la cola en que esta
+
+Si era una cola con herencia, el dueño puede perder prioridad. Si estaba en
+WaitMultiple, la saca de todas las colas en que esperaba.
 --------------------------------------------------------------------------------
 */
 
-void		
-SetData(Task_t *task, void *data)
+static void
+unqueue(Task_t *task)
 {
-	DisableInts();
-	task->data = data;
-	RestoreInts();
+	TaskQueue_t *queue = task->queue;
+	unsigned i;
+
+	mt_dequeue(task);
+	if ( queue && queue->owner )
+		update_priority(queue->owner);
+	if ( task->waits )
+	{
+		for ( i = 0 ; i < task->nwaits ; i++ )
+			unlink_wait(&task->waits[i]);
+		task->waits = NULL;
+	}
 }
 
 /*
 --------------------------------------------------------------------------------
-SetSwitcher - establece un manejador global de cambio de contexto
+link_wait, unlink_wait - agregan y sacan una espera de WaitMultiple de la
+						 lista de su cola
 
-Si existe este manejador, esta funcion se llamara inmediatamente antes de cada
-cambio de contexto. Recibe un puntero a la tarea que deja la CPU y otro a la
-tarea que la recibe. Se ejecuta con interrupciones deshabilitadas y no debe
-habilitarlas.
+Las esperas se despiertan por orden de llegada. unlink_wait no hace nada si
+la espera no esta en la lista.
 --------------------------------------------------------------------------------
 */
 
-void		
-SetSwitcher(Switcher_t switcher)
+static void
+link_wait(WaitEntry_t *entry)
 {
-	DisableInts();
-	save_restore = switcher;
-	RestoreInts();
-}
+	TaskQueue_t *queue = entry->queue;
 
-/*
---------------------------------------------------------------------------------
-CreateQueue - crea una cola de tareas
---------------------------------------------------------------------------------
-*/
+	entry->next = NULL;
+	if ( (entry->prev = queue->waits_tail) )
+		queue->waits_tail->next = entry;
+	else
+		queue->waits_head = entry;
+	queue->waits_tail = entry;
+}
 
-TaskQueue_t *	
-CreateQueue(char *name)
+static void
+unlink_wait(WaitEntry_t *entry)
 {
-	TaskQueue_t *queue = Malloc(sizeof(TaskQueue_t));
+	TaskQueue_t *queue = entry->queue;
 
-	queue->name = StrDup(name);
-	return queue;
+	if ( !queue )
+		return;
+	if ( entry->prev )
+		entry->prev->next = entry->next;
+	else
+		queue->waits_head = entry->next;
+	if ( entry->next )
+		entry->next->prev = entry->prev;
+	else
+		queue->waits_tail = entry->prev;
+	entry->queue = NULL;
 }
 
 /*
 --------------------------------------------------------------------------------
-DeleteQueue - destruye una cola de tareas
+block - bloquea una tarea
 --------------------------------------------------------------------------------
 */
 
-void
-DeleteQueue(TaskQueue_t *queue)
+static void
+block(Task_t *task, TaskState_t state)
 {
-	FlushQueue(queue, false);
-	Free(queue->name);
-	Free(queue);
+	mt_trace(TraceBlock, task, state);
+	unqueue(task);
+	mt_dequeue_time(task);
+	set_state(task, state);
+
+	/* Si ejecuta en otra CPU, avisarle para que la deje */
+	if ( task->cpu && task->cpu != mt_this_cpu() )
+		mt_lapic_ipi(task->cpu->apic_id, LAPIC_RESCHED_IRQ);
 }
 
 /*
 --------------------------------------------------------------------------------
-WaitQueue, WaitQueueCond, WaitQueueTimed - esperar en una cola de tareas
+ready - desbloquea una tarea y la pone en la cola de ready
+
+Si la tarea estaba bloqueado en WaitQueue, Send o Receive, el argumento
+success determina el status de retorno de la funcion que la bloqueo.
+Si la tarea todavia esta ejecutando en otra CPU (se la bloqueo desde aqui y
+esa CPU aun no la dejo), no se la encola: sigue siendo la actual alli. Si no,
+se la pone en la cola de la CPU que elige select_cpu() y, si debe desalojar
+a la tarea que ejecuta esa CPU, se le avisa.
+--------------------------------------------------------------------------------
+*/
+
+static void
+ready(Task_t *task, bool success)
+{
+	Cpu_t *cpu;
+
+	if ( task->state == TaskReady )
+		return;
+
+	mt_trace(TraceWakeup, task, task->state);
+	if ( task->state != TaskCurrent )
+		task->wakeups++;
+	unqueue(task);
+	mt_dequeue_time(task);
+	task->success = success;
+	if ( task->cpu && task->cpu != mt_this_cpu() )
+	{
+		set_state(task, TaskCurrent);
+		return;
+	}
+	cpu = select_cpu(task);
+	mt_enqueue_ready(task, cpu->id);
+	set_state(task, TaskReady);
+	if ( cpu != mt_this_cpu() && preempts(task, cpu) )
+		mt_lapic_ipi(cpu->apic_id, LAPIC_RESCHED_IRQ);
+}
+
+/*
+--------------------------------------------------------------------------------
+handoff - desbloquea una tarea cediendole directamente la CPU
+
+Si se puede, despierta a la tarea con exito sin pasar por la cola de ready y
+la deja como proxima a ejecutar en esta CPU: el scheduler() siguiente cambia
+a ella, que usa el resto de la ranura de tiempo de la actual, y pone a la
+actual en la cola de ready. Solo se cede a una tarea de igual o mayor
+precedencia que no este en ninguna CPU, y si la actual puede dejar la CPU.
+Retorna false si no se pudo ceder; en ese caso no hace nada.
+--------------------------------------------------------------------------------
+*/
+
+static bool
+handoff(Task_t *task)
+{
+	Cpu_t *cpu = mt_this_cpu();
+	Task_t *curr = cpu->curr_task;
+
+	if ( !mt_ipc_handoff || mt_int_level || curr->atomic_level || curr == cpu->null_task ||
+			task->cpu || task->state == TaskReady || !allowed(task, cpu) ||
+			compare_tasks(task, curr) < 0 )
+		return false;
+
+	mt_trace(TraceWakeup, task, task->state);
+	task->wakeups++;
+	unqueue(task);
+	mt_dequeue_time(task);
+	task->success = true;
+	set_state(task, TaskReady);
+	cpu->handoff = task;
+	cpu->handoffs++;
+	return true;
+}
+
+/*
+--------------------------------------------------------------------------------
+allowed - indica si la afinidad de una tarea le permite ejecutar en una CPU
+--------------------------------------------------------------------------------
+*/
+
+static bool
+allowed(Task_t *task, Cpu_t *cpu)
+{
+	return (task->affinity & (1U << cpu->id)) != 0;
+}
+
+/*
+--------------------------------------------------------------------------------
+preempts - indica si una tarea debe desalojar a la que ejecuta una CPU
+--------------------------------------------------------------------------------
+*/
+
+static bool
+preempts(Task_t *task, Cpu_t *cpu)
+{
+	return cpu->curr_task == cpu->null_task || compare_tasks(task, cpu->curr_task) > 0;
+}
+
+/*
+--------------------------------------------------------------------------------
+select_cpu - elige la CPU en cuya cola de ready se pone una tarea
+
+Solo se consideran las CPUs que permite la afinidad de la tarea. Se prefiere
+la ultima CPU en que ejecuto, para aprovechar su cache, si la tarea puede
+ejecutar alli de inmediato. Si no, una CPU ociosa o, si no hay, la que
+ejecuta la tarea de menor precedencia, siempre que la nueva tarea deba
+desalojarla. Si ninguna sirve, la tarea espera en la cola de su ultima CPU o,
+si ya no le esta permitida, en la de la primera que lo este.
+--------------------------------------------------------------------------------
+*/
+
+static Cpu_t *
+select_cpu(Task_t *task)
+{
+	Cpu_t *prev = task->last_cpu && task->last_cpu->online ? task->last_cpu : mt_this_cpu();
+	Cpu_t *cpu, *best = NULL, *first = NULL;
+	unsigned i;
+
+	if ( allowed(task, prev) && preempts(task, prev) && !mt_count_ready(prev->id) )
+		return prev;
+	for ( i = 0 ; i < mt_ncpus ; i++ )
+	{
+		cpu = &mt_cpus[i];
+		if ( !cpu->online || !allowed(task, cpu) )
+			continue;
+		if ( !first )
+			first = cpu;
+		if ( cpu->curr_task == cpu->null_task && !mt_count_ready(i) )
+			return cpu;
+		if ( compare_tasks(task, cpu->curr_task) > 0 &&
+				(!best || compare_tasks(best->curr_task, cpu->curr_task) > 0) )
+			best = cpu;
+	}
+	if ( best )
+		return best;
+	return allowed(task, prev) || !first ? prev : first;
+}
+
+/*
+--------------------------------------------------------------------------------
+migrate - pasa la proxima tarea de la cola de una CPU a la de otra
+
+Se saltean las tareas cuya afinidad no permite la CPU destino.
+--------------------------------------------------------------------------------
+*/
+
+static Task_t *
+migrate(Cpu_t *from, Cpu_t *to)
+{
+	Task_t *task;
+
+	if ( (task = mt_getlast_ready_for(from->id, to->id)) )
+		mt_enqueue_ready(task, to->id);
+	return task;
+}
+
+/*
+--------------------------------------------------------------------------------
+busiest_cpu - CPU con mas tareas en su cola de ready, excluyendo a una
+
+Retorna NULL si ninguna otra tiene tareas esperando.
+--------------------------------------------------------------------------------
+*/
+
+static Cpu_t *
+busiest_cpu(Cpu_t *except)
+{
+	Cpu_t *cpu, *busiest = NULL;
+	unsigned i, max = 0;
+
+	for ( i = 0 ; i < mt_ncpus ; i++ )
+	{
+		cpu = &mt_cpus[i];
+		if ( cpu != except && cpu->online && mt_count_ready(i) > max )
+		{
+			max = mt_count_ready(i);
+			busiest = cpu;
+		}
+	}
+	return busiest;
+}
+
+/*
+--------------------------------------------------------------------------------
+steal - una CPU sin tareas en su cola toma una de la CPU mas cargada
+--------------------------------------------------------------------------------
+*/
+
+static bool
+steal(Cpu_t *cpu)
+{
+	Cpu_t *busiest;
+
+	if ( mt_ncpus == 1 || !(busiest = busiest_cpu(cpu)) )
+		return false;
+	return migrate(busiest, cpu) != NULL;
+}
+
+/*
+--------------------------------------------------------------------------------
+balance - equilibra la carga entre CPUs
+
+Llamada periodicamente desde tick(). La carga de una CPU es la cantidad de
+tareas en su cola de ready mas la que ejecuta, si no es la nula. Si la
+diferencia entre la CPU mas cargada y la menos cargada es de dos tareas o mas,
+pasa una de la primera a la segunda.
+--------------------------------------------------------------------------------
+*/
+
+static void
+balance(void)
+{
+	Cpu_t *cpu, *busiest = NULL, *idlest = NULL;
+	unsigned i, load, max = 0, min = ~0U;
+	Task_t *task;
+
+	for ( i = 0 ; i < mt_ncpus ; i++ )
+	{
+		cpu = &mt_cpus[i];
+		if ( !cpu->online )
+			continue;
+		load = mt_count_ready(i) + (cpu->curr_task != cpu->null_task);
+		if ( load > max && mt_count_ready(i) )
+		{
+			max = load;
+			busiest = cpu;
+		}
+		if ( load < min )
+		{
+			min = load;
+			idlest = cpu;
+		}
+	}
+	if ( !busiest || max < min + 2 || !(task = migrate(busiest, idlest)) )
+		return;
+	if ( idlest != mt_this_cpu() && preempts(task, idlest) )
+		mt_lapic_ipi(idlest->apic_id, LAPIC_RESCHED_IRQ);
+}
+
+/*
+--------------------------------------------------------------------------------
+CreateTask - crea una tarea.
+
+Recibe un puntero a una funcion de tipo void f(void*), tamano del stack,
+un puntero para pasar como argumento, nombre, prioridad inicial.
+Toma el bloque de control y el stack de los pools (ver pool.c) e inicializa
+el stack para que retorne a Exit(). El tamaño del stack se redondea a la
+clase del pool. Si se pide el tamaño minimo y hay un tamaño aprendido para
+el nombre (ver stack.c), se usa ese. El stack se llena con STACK_PAINT para
+poder medir cuanto usa la tarea. Una vez creada una tarea, hay que comenzar a ejecutarla
+llamando a Ready().
+--------------------------------------------------------------------------------
+*/
+
+Task_t *
+CreateTask(TaskFunc_t func, unsigned stacksize, void *arg, char *name, unsigned priority)
+{
+	Task_t *task;
+	InitialStack_t *s;
+	unsigned learned;
+
+	/* si el reaper no da abasto, liberar una tanda de tareas terminadas */
+	if ( terminated_count > REAP_HIGH )
+		reap(REAP_BATCH);
+
+	/* alocar bloque de control */
+	task = mt_pool_get_task();
+	if ( name && strlen(name) < sizeof task->name_buf )
+		task->name = strcpy(task->name_buf, name);
+	else
+		task->name = StrDup(name);
+	task->send_queue.name = task->name;
+	task->priority = task->base_priority = min(priority, MAX_PRIO);
+	task->slice = QUANTUM;
+	task->affinity = ALL_CPUS;
+	task->weight = DEFAULT_WEIGHT;
+
+	/* alocar stack */
+	stacksize &= ~3;					// redondear a multiplos de 4
+	if ( stacksize <= MIN_STACK && (learned = mt_stack_learned(name)) )
+		stacksize = learned;			// tamaño aprendido (ver stack.c)
+	else if ( stacksize < MIN_STACK )	// garantizar tamaño mínimo
+		stacksize = MIN_STACK;
+	task->stack = mt_pool_get_stack(&stacksize, false);	// alineado a 8
+	task->stack_size = stacksize;
+	mt_stack_paint(task);
+
+	/* inicializar stack */
+	s = (InitialStack_t *)(task->stack + stacksize) - 1;
+	s->arg = arg;
+	s->retaddr = Exit;				/* direccion de retorno de func() */
+	s->regs.eflags = INIFL;
+	s->regs.eip = (unsigned) func;
+	task->esp = (unsigned) s;
+
+	/* agregar a la lista de tareas */
+	DisableInts();
+	task->stamp = mt_rdtsc();
+	if ( (task->list_next = mt_task_list) )
+		mt_task_list->list_prev = task;
+	mt_task_list = task;
+	RestoreInts();
+
+	return task;
+}
+
+/*
+--------------------------------------------------------------------------------
+CreatePeriodicTask - crea una tarea periodica
+
+Los tiempos se expresan en milisegundos y se redondean a ticks: la tarea
+necesita runtime de CPU en cada periodo, y debe completarlo dentro de
+deadline desde el comienzo del periodo (si es cero, el plazo es el periodo).
+Las tareas periodicas se planifican antes que todas las demas, la de plazo
+mas cercano primero (EDF). Si consume todo su runtime antes de terminar el
+periodo, se la detiene hasta el siguiente.
+La tarea se crea suspendida, como con CreateTask; su primer periodo comienza
+cuando se la pone ready. Retorna NULL si los parametros son invalidos o si
+la tarea no puede admitirse sin superar la utilizacion maxima (EDF_BUDGET).
+--------------------------------------------------------------------------------
+*/
+
+Task_t *
+CreatePeriodicTask(TaskFunc_t func, unsigned stacksize, void *arg, char *name,
+	unsigned period, unsigned runtime, unsigned deadline)
+{
+	Task_t *task;
+	Task_t params;
+
+	params.period = usecs_to_ticks(period * 1000ULL);
+	params.runtime = usecs_to_ticks(runtime * 1000ULL);
+	params.rel_deadline = deadline ? usecs_to_ticks(deadline * 1000ULL) : params.period;
+	if ( !params.runtime || params.runtime > params.rel_deadline ||
+			params.rel_deadline > params.period )
+		return NULL;
+
+	/* control de admision */
+	DisableInts();
+	if ( edf_util + density(&params) > EDF_BUDGET )
+	{
+		RestoreInts();
+		return NULL;
+	}
+	edf_util += density(&params);
+	RestoreInts();
+
+	task = CreateTask(func, stacksize, arg, name, MAX_PRIO);
+	task->period = params.period;
+	task->runtime = params.runtime;
+	task->rel_deadline = params.rel_deadline;
+	return task;
+}
+
+/*
+--------------------------------------------------------------------------------
+DeleteTask - elimina una tarea creada con CreateTask
+
+La tarea se pone en la cola de tareas terminadas y su memoria la libera el
+reaper, una tarea de baja prioridad, cuando haya dejado la CPU. Asi, ni
+DeleteTask ni las funciones de memoria dinamica pagan el costo de liberarla.
+Las tareas que esperaban un mensaje de ella, como respuesta a Call() o en
+Receive() con remitente, fallan.
+--------------------------------------------------------------------------------
+*/
+
+static void
+free_task(Task_t *task)
+{
+	mt_stack_learn(task);
+	if ( task->name && task->name != task->name_buf )
+		free(task->name);
+	mt_pool_put_stack(task->stack, task->stack_size);
+	if ( task->math_data )
+		free(task->math_data);
+	mt_pool_put_task(task);
+}
+
+void
+DeleteTask(Task_t *task)
+{
+	Task_t *waiting;
+	unsigned i;
+
+	if ( task == &main_task )
+		Panic("Imposible eliminar la tarea principal");
+	if ( task == reaper_task )
+		Panic("Imposible eliminar el reaper");
+
+	FlushQueue(&task->send_queue, false);
+	DisableInts();
+	for ( i = 0 ; i < mt_ncpus ; i++ )
+		if ( mt_cpus[i].fpu_task == task )
+			mt_cpus[i].fpu_task = NULL;
+	while ( task->owned )
+		mt_set_owner(task->owned, NULL);
+	for ( waiting = mt_task_list ; waiting ; waiting = waiting->list_next )
+		if ( waiting->state == TaskReceiving && waiting->from == task )
+			ready(waiting, false);		/* esperaban su respuesta */
+	if ( task->period )
+		edf_util -= density(task);
+	block(task, TaskTerminated);
+	mt_enqueue(task, &terminated_q);
+	terminated_count++;
+	if ( (waiting = mt_getlast(&reaper_q)) )
+		ready(waiting, true);
+	if ( task == mt_curr_task )
+		scheduler();
+	RestoreInts();
+}
+
+/*
+--------------------------------------------------------------------------------
+reap - libera hasta max tareas terminadas que ya dejaron la CPU
+
+Las saca de la cola y de la lista de tareas con el lock del kernel, y libera
+su memoria despues, sin el lock. Retorna la cantidad liberada.
+--------------------------------------------------------------------------------
+*/
+
+static unsigned
+reap(unsigned max)
+{
+	Task_t *task, *next, *list = NULL;
+	unsigned n = 0;
+
+	DisableInts();
+	for ( task = terminated_q.head ; task && n < max ; task = next )
+	{
+		next = task->next;
+		if ( task->cpu )
+			continue;
+		mt_dequeue(task);
+		terminated_count--;
+		if ( task->list_prev )
+			task->list_prev->list_next = task->list_next;
+		else
+			mt_task_list = task->list_next;
+		if ( task->list_next )
+			task->list_next->list_prev = task->list_prev;
+		task->next = list;
+		list = task;
+		n++;
+	}
+	RestoreInts();
+
+	for ( task = list ; task ; task = next )
+	{
+		next = task->next;
+		free_task(task);
+	}
+	return n;
+}
+
+/*
+--------------------------------------------------------------------------------
+reaper - tarea que libera las tareas terminadas
+
+Libera las tareas de a tandas de REAP_BATCH, cediendo la CPU entre una y
+otra. Si las pendientes todavia no dejaron la CPU, vuelve a intentar en el
+proximo tick.
+--------------------------------------------------------------------------------
+*/
+
+static void
+reaper(void *arg)
+{
+	while ( true )
+	{
+		DisableInts();
+		if ( !terminated_q.head )
+			mt_wait_queue(&reaper_q, FOREVER_US);
+		RestoreInts();
+		if ( reap(REAP_BATCH) )
+			Yield();
+		else
+			DelayUs(USPERTICK);
+	}
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_reclaim - recupera memoria ante una falla de malloc
+
+Libera todas las tareas terminadas y devuelve al heap los objetos guardados en
+los pools.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_reclaim(void)
+{
+	while ( reap(REAP_BATCH) )
+		;
+	mt_pool_drain();
+}
+
+/*
+--------------------------------------------------------------------------------
+CurrentTask - retorna un puntero a la tarea actual.
+--------------------------------------------------------------------------------
+*/
+
+Task_t *
+CurrentTask(void)
+{
+	return mt_curr_task;
+}
+
+
+/*
+--------------------------------------------------------------------------------
+Panic - error fatal del sistema
+--------------------------------------------------------------------------------
+*/
+
+void
+Panic(char *msg)
+{
+	DisableInts();
+	cprintk(RED, LIGHTGRAY, "\nPANIC [%s]: %s", mt_curr_task->name, msg);
+	while ( true )
+		;
+}
+
+/*
+--------------------------------------------------------------------------------
+Pause - suspende la tarea actual
+--------------------------------------------------------------------------------
+*/
+
+void
+Pause(void)
+{
+	Suspend(mt_curr_task);
+}
+
+/*
+--------------------------------------------------------------------------------
+Yield - cede voluntariamente la CPU
+--------------------------------------------------------------------------------
+*/
+
+void
+Yield(void)
+{
+	Ready(mt_curr_task);
+}
+
+/*
+--------------------------------------------------------------------------------
+Delay, DelayUs - pone a la tarea actual a dormir durante una cantidad de
+				milisegundos o microsegundos
+--------------------------------------------------------------------------------
+*/
+
+void
+Delay(unsigned msecs)
+{
+	delay(mt_timeout_ms(msecs));
+}
+
+void
+DelayUs(unsigned usecs)
+{
+	delay(mt_timeout_us(usecs));
+}
+
+/*
+--------------------------------------------------------------------------------
+WaitNextPeriod - espera el comienzo del proximo periodo de la tarea actual
+
+Duerme hasta el instante absoluto en que comienza el siguiente periodo, por
+lo que los periodos no acumulan deriva. Si ese instante ya paso, retorna de
+inmediato; si la tarea se atraso mas de un periodo completo, los periodos
+perdidos se descartan. Retorna false si la tarea no cumplio el plazo del
+periodo que termina o si no es periodica.
+--------------------------------------------------------------------------------
+*/
+
+bool
+WaitNextPeriod(void)
+{
+	Task_t *task = mt_curr_task;
+	bool on_time;
+
+	if ( !task->period )
+		return false;
+
+	DisableInts();
+	if ( !(on_time = mt_ticks <= task->deadline) )
+		task->misses++;
+	if ( next_period(task) )
+		wait_release(task);
+	scheduler();
+	RestoreInts();
+
+	return on_time;
+}
+
+static void
+delay(unsigned long long usecs)
+{
+	DisableInts();
+	if ( usecs )
+	{
+		block(mt_curr_task, TaskDelaying);
+		if ( usecs != FOREVER_US )
+			set_timeout(mt_curr_task, usecs);
+	}
+	else
+		ready(mt_curr_task, false);
+	scheduler();
+	RestoreInts();
+}
+
+/*
+--------------------------------------------------------------------------------
+Exit - finaliza la tarea actual
+
+Todas las tareas creadas con CreateTask retornan a esta funcion que las mata.
+Esta funcion nunca retorna.
+--------------------------------------------------------------------------------
+*/
+
+void
+Exit(void)
+{
+	DeleteTask(mt_curr_task);
+}
+
+/*
+--------------------------------------------------------------------------------
+Suspend - suspende una tarea
+--------------------------------------------------------------------------------
+*/
+
+void
+Suspend(Task_t *task)
+{
+	DisableInts();
+	block(task, TaskSuspended);
+	if ( task == mt_curr_task )
+		scheduler();
+	RestoreInts();
+}
+
+/*
+--------------------------------------------------------------------------------
+Ready - pone una tarea en la cola ready
+--------------------------------------------------------------------------------
+*/
+
+void
+Ready(Task_t *task)
+{
+	DisableInts();
+	if ( task->period && task->state == TaskSuspended )
+		start_period(task, mt_ticks);
+	ready(task, false);
+	scheduler();
+	RestoreInts();
+}
+
+/*
+--------------------------------------------------------------------------------
+GetPriority - retorna la prioridad de una tarea
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+GetPriority(Task_t *task)
+{
+	return task->priority;
+}
+
+/*
+--------------------------------------------------------------------------------
+SetPriority - establece la prioridad de una tarea
+
+Las prioridades mayores que MAX_PRIO se truncan a MAX_PRIO.
+Se establece la prioridad base; la efectiva puede ser mayor mientras la
+tarea posea un mutex o monitor por el que esperan tareas mas prioritarias.
+Si se le ha cambiado la prioridad a la tarea actual o a una que esta ready se
+llama al scheduler.
+--------------------------------------------------------------------------------
+*/
+
+void		
+SetPriority(Task_t *task, unsigned priority)
+{
+	DisableInts();
+	task->base_priority = min(priority, MAX_PRIO);
+	update_priority(task);
+	if ( task == mt_curr_task || task->state == TaskReady )
+		scheduler();
+	RestoreInts();
+}
+
+/*
+--------------------------------------------------------------------------------
+GetSchedPolicy - retorna la politica de planificacion de una tarea
+--------------------------------------------------------------------------------
+*/
+
+SchedPolicy_t
+GetSchedPolicy(Task_t *task)
+{
+	return task->policy;
+}
+
+/*
+--------------------------------------------------------------------------------
+SetSchedPolicy - establece la politica de planificacion de una tarea
+
+La politica determina como comparte la CPU con las tareas de su misma
+prioridad:
+	SchedDefault: ranura de tiempo del sistema (QUANTUM).
+	SchedRR: ranura de tiempo de slice_us microsegundos, redondeada a ticks;
+			 si es cero se usa la del sistema.
+	SchedFifo: sin ranura de tiempo, conserva la CPU hasta que se bloquea o
+			   cede voluntariamente. Si la desaloja una tarea mas prioritaria,
+			   vuelve a ser la primera de su prioridad.
+	SchedFair: ejecuta despues de las tareas de prioridad fija FAIR_PRIO o
+			   mayor y antes que las de prioridad menor, y comparte la CPU con
+			   las demas SchedFair en proporcion a su peso (ver SetWeight),
+			   eligiendo siempre la de menor tiempo de CPU ponderado
+			   (vruntime). Las que estuvieron bloqueadas reciben un credito
+			   acotado. Si hereda prioridad de una tarea de prioridad fija, se
+			   planifica con esa prioridad mientras dure la herencia. slice_us
+			   no se usa.
+La nueva ranura de tiempo rige a partir de la proxima vez que la tarea obtenga
+la CPU.
+--------------------------------------------------------------------------------
+*/
+
+void
+SetSchedPolicy(Task_t *task, SchedPolicy_t policy, unsigned slice_us)
+{
+	int cpu;
+
+	DisableInts();
+	cpu = take_ready(task);
+	task->policy = policy;
+	task->slice = policy == SchedRR && slice_us ? usecs_to_ticks(slice_us) : QUANTUM;
+	put_ready(task, cpu);
+	scheduler();
+	RestoreInts();
+}
+
+/*
+--------------------------------------------------------------------------------
+GetWeight, SetWeight - peso de una tarea SchedFair
+
+El peso determina la parte de la CPU que recibe una tarea SchedFair respecto
+de las demas: una tarea de peso 2 * DEFAULT_WEIGHT recibe el doble que una
+de peso normal. Un peso nulo se toma como 1.
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+GetWeight(Task_t *task)
+{
+	return task->weight;
+}
+
+void
+SetWeight(Task_t *task, unsigned weight)
+{
+	int cpu;
+
+	DisableInts();
+	if ( task->state == TaskCurrent )
+		mt_update_stats(task);		// cargar lo ejecutado con el peso anterior
+	cpu = take_ready(task);
+	task->weight = weight ? weight : 1;
+	put_ready(task, cpu);
+	RestoreInts();
+}
+
+/*
+--------------------------------------------------------------------------------
+GetAffinity, SetAffinity - CPUs en que puede ejecutar una tarea
+
+La afinidad es una mascara de bits, uno por CPU (el bit n corresponde a la
+CPU n); ALL_CPUS permite cualquiera. Se respeta al elegir la cola de ready de
+la tarea, al migrarla y al equilibrar la carga. Si la tarea esta en la cola de
+una CPU que ya no le esta permitida, se la pasa a otra; si esta ejecutando en
+ella, la deja en cuanto sale de una seccion atomica. SetAffinity retorna false
+si la mascara no incluye ninguna CPU activa o si la tarea es una tarea nula,
+que no puede cambiar de CPU.
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+GetAffinity(Task_t *task)
+{
+	return task->affinity;
+}
+
+bool
+SetAffinity(Task_t *task, unsigned cpumask)
+{
+	Cpu_t *cpu;
+	unsigned i, online = 0;
+	bool null_task = false;
+
+	DisableInts();
+	for ( i = 0 ; i < mt_ncpus ; i++ )
+	{
+		if ( mt_cpus[i].online )
+			online |= 1U << i;
+		if ( mt_cpus[i].null_task == task )
+			null_task = true;
+	}
+	if ( null_task || !(cpumask & online) )
+	{
+		RestoreInts();
+		return false;
+	}
+
+	task->affinity = cpumask;
+	if ( task->state == TaskReady && task->queue &&
+			!allowed(task, &mt_cpus[mt_ready_cpu(task)]) )
+	{
+		mt_dequeue(task);
+		cpu = select_cpu(task);
+		mt_enqueue_ready(task, cpu->id);
+		if ( cpu != mt_this_cpu() && preempts(task, cpu) )
+			mt_lapic_ipi(cpu->apic_id, LAPIC_RESCHED_IRQ);
+	}
+	else if ( task->state == TaskCurrent && task->cpu && task->cpu != mt_this_cpu() &&
+			!allowed(task, task->cpu) )
+		mt_lapic_ipi(task->cpu->apic_id, LAPIC_RESCHED_IRQ);
+	scheduler();
+	RestoreInts();
+	return true;
+}
+
+/*
+--------------------------------------------------------------------------------
+SetData - establece un puntero a datos privados de una tarea
+--------------------------------------------------------------------------------
+*/
+
+void		
+SetData(Task_t *task, void *data)
+{
+	DisableInts();
+	task->data = data;
+	RestoreInts();
+}
+
+/*
+--------------------------------------------------------------------------------
+SetSwitcher - establece un manejador global de cambio de contexto
+
+Si existe este manejador, esta funcion se llamara inmediatamente antes de cada
+cambio de contexto. Recibe un puntero a la tarea que deja la CPU y otro a la
+tarea que la recibe. Se ejecuta con interrupciones deshabilitadas y no debe
+habilitarlas.
+--------------------------------------------------------------------------------
+*/
+
+void		
+SetSwitcher(Switcher_t switcher)
+{
+	DisableInts();
+	save_restore = switcher;
+	RestoreInts();
+}
+
+/*
+--------------------------------------------------------------------------------
+CreateQueue - crea una cola de tareas
+--------------------------------------------------------------------------------
+*/
+
+TaskQueue_t *	
+CreateQueue(char *name)
+{
+	TaskQueue_t *queue = Malloc(sizeof(TaskQueue_t));
+
+	queue->name = StrDup(name);
+	return queue;
+}
+
+/*
+--------------------------------------------------------------------------------
+DeleteQueue - destruye una cola de tareas
+--------------------------------------------------------------------------------
+*/
+
+void
+DeleteQueue(TaskQueue_t *queue)
+{
+	FlushQueue(queue, false);
+	Free(queue->name);
+	Free(queue);
+}
+
+/*
+--------------------------------------------------------------------------------
+WaitQueue, WaitQueueTimed, WaitQueueTimedUs - esperar en una cola de tareas
 
 El valor de retorno es true si la tarea fue despertada por SignalQueue
 o el valor pasado a FlushQueue.
-Si msecs es FOREVER, espera indefinidamente. Si msecs es cero, retorna false.
+Si el timeout es FOREVER, espera indefinidamente. Si es cero, retorna false.
+WaitQueueTimedUs recibe el timeout en microsegundos.
 --------------------------------------------------------------------------------
 */
 
@@ -479,20 +1574,182 @@ WaitQueue(TaskQueue_t *queue)
 bool			
 WaitQueueTimed(TaskQueue_t *queue, unsigned msecs)
 {
+	return mt_wait_queue(queue, mt_timeout_ms(msecs));
+}
+
+bool			
+WaitQueueTimedUs(TaskQueue_t *queue, unsigned usecs)
+{
+	return mt_wait_queue(queue, mt_timeout_us(usecs));
+}
+
+bool
+mt_wait_queue(TaskQueue_t *queue, unsigned long long usecs)
+{
+	return mt_wait_queue_unlock(queue, usecs, NULL);
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_wait_queue_unlock - esperar en una cola liberando un spinlock
+
+Como mt_wait_queue, pero se llama con interrupciones deshabilitadas y con el
+spinlock tomado, y lo libera recien cuando la tarea ya esta en la cola. Asi,
+quien tome el spinlock para despertarla la encuentra esperando.
+--------------------------------------------------------------------------------
+*/
+
+bool
+mt_wait_queue_unlock(TaskQueue_t *queue, unsigned long long usecs, Spinlock_t *lock)
+{
+	bool success = false;
+
+	DisableInts();
+	if ( usecs )
+	{
+		block(mt_curr_task, TaskWaiting);
+		mt_enqueue(mt_curr_task, queue);
+		if ( queue->owner )
+			update_priority(queue->owner);
+		if ( usecs != FOREVER_US )
+			set_timeout(mt_curr_task, usecs);
+	}
+	if ( lock )
+		mt_spin_unlock(lock);
+	if ( usecs )
+	{
+		scheduler();
+		success = mt_curr_task->success;
+	}
+	RestoreInts();
+
+	return success;
+}
+
+/*
+--------------------------------------------------------------------------------
+WaitMultiple - esperar en varios objetos a la vez
+
+Espera hasta que se complete una espera en cualquiera de los n objetos (a lo
+sumo MAX_WAIT_OBJECTS), o hasta que venza el timeout, y deja en *index la
+posicion del objeto. Si hay varios disponibles al llamarla, elige el primero.
+Segun el tipo de objeto, completar la espera significa:
+	WaitForQueue	 ser despertada por SignalQueue o FlushQueue.
+	WaitForSem		 obtener un evento, como WaitSem.
+	WaitForMsgQueue	 leer un mensaje en msg, como GetMsgQueue.
+	WaitForPipe		 que haya datos para leer; no los lee: despues hay que
+					 llamar a GetPipeCond, que puede no encontrar nada si otra
+					 tarea lee del mismo pipe.
+La tarea se pone a esperar en la cola de cada objeto, a continuacion de las
+tareas que esperan normalmente en ella, y al despertarse sale de todas. Los
+semaforos y colas con herencia de prioridad (mutexes y monitores) no se
+pueden esperar de esta manera. El valor de retorno es false si vencio el
+timeout, y entonces *index es n, o si la espera termino con
+FlushQueue(queue, false), por ejemplo al destruirse el objeto, y entonces
+*index indica el objeto. Un timeout cero solamente prueba si hay algun objeto
+disponible.
+--------------------------------------------------------------------------------
+*/
+
+/*
+	Completar la espera en un objeto si esta disponible, o poner la espera en
+	la lista de su cola. Los semaforos se prueban y se anotan con su lock
+	tomado, para que un SignalSem concurrente vea la espera o deje el evento.
+*/
+static bool
+try_wait(WaitObject_t *obj, WaitEntry_t *entry)
+{
+	Semaphore_t *sem = NULL;
+	Pipe_t *pipe;
+	bool avail = false;
+
+	switch ( obj->type )
+	{
+		case WaitForQueue:
+			entry->queue = obj->object;
+			break;
+		case WaitForSem:
+			sem = obj->object;
+			break;
+		case WaitForMsgQueue:
+			sem = ((MsgQueue_t *) obj->object)->sem_get;
+			break;
+		case WaitForPipe:
+			pipe = obj->object;
+			entry->queue = pipe->cond_get->queue;
+			avail = pipe->avail > 0;
+			break;
+	}
+	if ( sem )
+	{
+		entry->queue = sem->queue;
+		mt_spin_lock(&sem->lock);
+		if ( (avail = sem->value > 0) )
+			sem->value--;
+	}
+	if ( entry->queue->inherit )
+		Panic("WaitMultiple: cola con herencia de prioridad");
+	if ( !avail )
+		link_wait(entry);
+	else
+		entry->queue = NULL;
+	if ( sem )
+		mt_spin_unlock(&sem->lock);
+	return avail;
+}
+
+bool
+WaitMultiple(WaitObject_t objects[], unsigned n, unsigned msecs, unsigned *index)
+{
+	WaitEntry_t entries[MAX_WAIT_OBJECTS];
+	Task_t *task;
+	MsgQueue_t *mq;
+	unsigned i;
 	bool success;
 
-	if ( !msecs )
-		return false;
+	if ( !n || n > MAX_WAIT_OBJECTS )
+		Panic("WaitMultiple: cantidad de objetos invalida");
 
 	DisableInts();
-	block(mt_curr_task, TaskWaiting);
-	mt_enqueue(mt_curr_task, queue);
-	if ( msecs != FOREVER )
-		mt_enqueue_time(mt_curr_task, msecs_to_ticks(msecs));
-	scheduler();
-	success = mt_curr_task->success;
+	task = mt_curr_task;
+	for ( i = 0 ; i < n ; i++ )
+	{
+		entries[i].task = task;
+		entries[i].index = i;
+		if ( try_wait(&objects[i], &entries[i]) )
+			break;
+	}
+	if ( i < n || !msecs )
+	{
+		success = i < n;
+		*index = i;
+		while ( i-- )
+			unlink_wait(&entries[i]);
+	}
+	else
+	{
+		block(task, TaskWaiting);
+		task->waits = entries;
+		task->nwaits = n;
+		task->wait_index = n;
+		if ( msecs != FOREVER )
+			set_timeout(task, mt_timeout_ms(msecs));
+		scheduler();
+		success = task->success;
+		*index = task->wait_index;
+	}
 	RestoreInts();
 
+	/* Leer el mensaje cuyo evento se obtuvo */
+	if ( success && objects[*index].type == WaitForMsgQueue )
+	{
+		mq = objects[*index].object;
+		if ( mq->mutex_get )
+			EnterMutex(mq->mutex_get);
+		mt_msgqueue_get(mq, objects[*index].msg);
+		if ( mq->mutex_get )
+			LeaveMutex(mq->mutex_get);
+	}
 	return success;
 }
 
@@ -503,7 +1760,10 @@ SignalQueue, FlushQueue - funciones para despertar tareas en una cola
 SignalQueue despierta la última tarea de la cola (lal de mayor prioridad o
 la que llego primero entre dos de la misma prioridad), el valor de retorno 
 es true si desperto a una tarea. Esta tarea completa su WaitQueue() 
-exitosamente.
+exitosamente. Si no hay ninguna, despierta a la primera que espera la cola
+en WaitMultiple().
+En una cola con herencia de prioridad, la tarea despertada pasa a ser la
+duena de la cola.
 FlushQueue despierta a todas las tareas de la cola, que completan su
 WaitQueue() con el resultado que se pasa como argumento.
 --------------------------------------------------------------------------------
@@ -515,7 +1775,15 @@ SignalQueue(TaskQueue_t *queue)
 	Task_t *task;
 
 	DisableInts();
-	if ( (task = mt_getlast(queue)) )
+	task = mt_getlast(queue);
+	if ( queue->inherit )
+		mt_set_owner(queue, task);
+	if ( !task && queue->waits_head )
+	{
+		task = queue->waits_head->task;
+		task->wait_index = queue->waits_head->index;
+	}
+	if ( task )
 	{
 		ready(task, true);
 		scheduler();
@@ -531,10 +1799,18 @@ FlushQueue(TaskQueue_t *queue, bool success)
 	Task_t *task;
 
 	DisableInts();
-	if ( mt_peeklast(queue) )
+	if ( queue->inherit )
+		mt_set_owner(queue, NULL);
+	if ( mt_waiting(queue) )
 	{
 		while ( (task = mt_getlast(queue)) )
 			ready(task, success);
+		while ( queue->waits_head )
+		{
+			task = queue->waits_head->task;
+			task->wait_index = queue->waits_head->index;
+			ready(task, success);		/* la saca de la lista */
+		}
 		scheduler();
 	}
 	RestoreInts();
@@ -567,17 +1843,9 @@ SendTimed(Task_t *to, void *msg, unsigned size, unsigned msecs)
 
 	if ( to->state == TaskReceiving && (!to->from || to->from == mt_curr_task) )
 	{
-		to->from = mt_curr_task;
-		if ( to->msg && msg )
-		{
-			if ( size > to->size )
-				Panic("Buffer insuficiente para transmitir mensaje");
-			to->size = size;
-			memcpy(to->msg, msg, size);
-		}
-		else
-			to->size = 0;
-		ready(to, true);
+		deliver(to, msg, size);
+		if ( !handoff(to) )
+			ready(to, true);
 		scheduler();
 		RestoreInts();
 		return true;
@@ -591,10 +1859,10 @@ SendTimed(Task_t *to, void *msg, unsigned size, unsigned msecs)
 
 	mt_curr_task->msg = msg;
 	mt_curr_task->size = size;
-	mt_curr_task->state = TaskSending;
+	set_state(mt_curr_task, TaskSending);
 	mt_enqueue(mt_curr_task, &to->send_queue);
 	if ( msecs != FOREVER )
-		mt_enqueue_time(mt_curr_task, msecs_to_ticks(msecs));
+		set_timeout(mt_curr_task, mt_timeout_ms(msecs));
 	scheduler();
 	success = mt_curr_task->success;
 
@@ -638,18 +1906,7 @@ ReceiveTimed(Task_t **from, void *msg, unsigned *size, unsigned msecs)
 	{
 		if ( from ) 
 			*from = sender;
-		if ( sender->msg && msg )
-		{
-			if ( size )
-			{
-				if ( sender->size > *size )
-					Panic("Buffer insuficiente para recibir mensaje");
-				memcpy(msg, sender->msg, *size = sender->size);
-			}
-		}
-		else if ( size )
-			*size = 0;
-		ready(sender, true);
+		accept(sender, msg, size);
 		scheduler();
 		RestoreInts();
 		return true;
@@ -664,16 +1921,176 @@ ReceiveTimed(Task_t **from, void *msg, unsigned *size, unsigned msecs)
 	mt_curr_task->from = from ? *from : NULL;
 	mt_curr_task->msg = msg;
 	mt_curr_task->size = size ? *size : 0;
-	mt_curr_task->state = TaskReceiving;
+	set_state(mt_curr_task, TaskReceiving);
 	if ( msecs != FOREVER )
-		mt_enqueue_time(mt_curr_task, msecs_to_ticks(msecs));
+		set_timeout(mt_curr_task, mt_timeout_ms(msecs));
 	scheduler();
 	if ( (success = mt_curr_task->success) )
 	{
 		if ( size )
 			*size = mt_curr_task->size;
 		if ( from )
-			*from = mt_curr_task->from;
+			*from = mt_curr_task->from;
+	}
+
+	RestoreInts();
+	return success;
+}
+
+/*
+--------------------------------------------------------------------------------
+deliver, accept - copia de mensajes entre tareas
+
+deliver copia un mensaje de la tarea actual al buffer de una tarea que espera
+en Receive. accept copia el mensaje de una tarea que espera en Send al buffer
+indicado y la despierta; si la tarea hizo Call(), en cambio, pasa a esperar
+la respuesta de la tarea actual.
+--------------------------------------------------------------------------------
+*/
+
+static void
+deliver(Task_t *to, void *msg, unsigned size)
+{
+	to->from = mt_curr_task;
+	if ( to->msg && msg )
+	{
+		if ( size > to->size )
+			Panic("Buffer insuficiente para transmitir mensaje");
+		to->size = size;
+		memcpy(to->msg, msg, size);
+	}
+	else
+		to->size = 0;
+}
+
+static void
+accept(Task_t *sender, void *msg, unsigned *size)
+{
+	if ( sender->msg && msg )
+	{
+		if ( size )
+		{
+			if ( sender->size > *size )
+				Panic("Buffer insuficiente para recibir mensaje");
+			memcpy(msg, sender->msg, *size = sender->size);
+		}
+	}
+	else if ( size )
+		*size = 0;
+
+	if ( !sender->calling )
+	{
+		ready(sender, true);
+		return;
+	}
+	unqueue(sender);
+	sender->from = mt_curr_task;
+	sender->msg = sender->reply;
+	sender->size = sender->reply_size;
+	set_state(sender, TaskReceiving);
+}
+
+/*
+--------------------------------------------------------------------------------
+Call - enviar un pedido y esperar la respuesta
+
+Equivale a Send() seguido de Receive() de la misma tarea, pero en una sola
+operacion: la tarea pasa directamente de enviar a esperar la respuesta, sin
+volver a ejecutar en el medio. Si el servidor esta esperando en Receive o
+ReplyWait, se le cede la CPU. En reply_size se pasa el tamaño del buffer de
+respuesta y se retorna el de la respuesta recibida.
+--------------------------------------------------------------------------------
+*/
+
+bool
+Call(Task_t *to, void *req, unsigned req_size, void *reply, unsigned *reply_size)
+{
+	Task_t *curr;
+	bool success;
+
+	DisableInts();
+	curr = mt_curr_task;
+
+	if ( to->state == TaskReceiving && (!to->from || to->from == curr) )
+	{
+		deliver(to, req, req_size);
+		curr->from = to;
+		curr->msg = reply;
+		curr->size = reply_size ? *reply_size : 0;
+		set_state(curr, TaskReceiving);
+		if ( !handoff(to) )
+			ready(to, true);
+	}
+	else
+	{
+		curr->msg = req;
+		curr->size = req_size;
+		curr->calling = true;
+		curr->reply = reply;
+		curr->reply_size = reply_size ? *reply_size : 0;
+		set_state(curr, TaskSending);
+		mt_enqueue(curr, &to->send_queue);
+	}
+	scheduler();
+	curr->calling = false;
+	if ( (success = curr->success) && reply_size )
+		*reply_size = curr->size;
+
+	RestoreInts();
+	return success;
+}
+
+/*
+--------------------------------------------------------------------------------
+ReplyWait - responder a un cliente y esperar el proximo pedido
+
+Envia la respuesta a la tarea to, si esta esperandola en Call() (o en
+Receive() de la tarea actual), y espera un mensaje de cualquier tarea como
+Receive(). Si to es NULL, solamente espera. Si el cliente ya no espera la
+respuesta, se descarta. Si hay un pedido pendiente se lo toma sin bloquearse;
+si no, se le cede la CPU al cliente.
+--------------------------------------------------------------------------------
+*/
+
+bool
+ReplyWait(Task_t *to, void *reply, unsigned size, Task_t **from, void *req, unsigned *req_size)
+{
+	Task_t *curr, *sender;
+	bool success;
+
+	DisableInts();
+	curr = mt_curr_task;
+
+	if ( to && !(to->state == TaskReceiving && to->from == curr) )
+		to = NULL;
+	if ( to )
+		deliver(to, reply, size);
+
+	if ( (sender = mt_peeklast(&curr->send_queue)) )
+	{
+		if ( from )
+			*from = sender;
+		accept(sender, req, req_size);
+		if ( to )
+			ready(to, true);
+		scheduler();
+		RestoreInts();
+		return true;
+	}
+
+	curr->from = NULL;
+	curr->msg = req;
+	curr->size = req_size ? *req_size : 0;
+	set_state(curr, TaskReceiving);
+	if ( to && !handoff(to) )
+		ready(to, true);
+	scheduler();
+	if ( (success = curr->success) )
+	{
+		if ( req_size )
+			*req_size = curr->size;
+		if ( from )
+			*from = curr->from;
 	}
 
 	RestoreInts();
@@ -685,10 +2102,20 @@ ReceiveTimed(Task_t **from, void *msg, unsigned *size, unsigned msecs)
 mt_select_task - determina la próxima tarea a ejecutar.
 
 Retorna true si ha cambiado la tarea en ejecucion.
-Llamada desde scheduler() y cuanto retorna una interrupcion de primer nivel.
+Llamada desde scheduler() y cuanto retorna una interrupcion de primer nivel,
+siempre con el lock del kernel tomado.
+Cada CPU elige de su propia cola de ready; si esta vacia, toma una tarea de
+la cola de la CPU mas cargada.
+Cada CPU tiene su propia tarea nula, que no esta en la cola de ready: se la
+elige cuando no hay otra tarea para ejecutar y cualquier tarea ready la
+desaloja. La tarea que deja la CPU queda asociada a ella hasta que
+mt_switch_done() confirme que ya no se usa su stack.
+Si se cedio la CPU a una tarea (ver handoff()), se cambia a ella sin
+consultar la cola de ready, y hereda lo que queda de la ranura de tiempo.
 Si la tarea actual no es dueña del coprocesador, levanta el bit TS en CR0 para que 
 se genere la excepción 7 la próxima vez que se ejecute una instrucción de 
-coprocesador.
+coprocesador. Con varias CPUs el estado del coprocesador se guarda al dejar la
+CPU, porque la tarea puede continuar en otra.
 Guarda y restaura el contexto propio del usuario, si existe. 
 --------------------------------------------------------------------------------
 */
@@ -696,50 +2123,205 @@ Guarda y restaura el contexto propio del usuario, si existe.
 bool 
 mt_select_task(void)
 {
-	Task_t *ready_task;
+	Cpu_t *cpu = mt_this_cpu();
+	Task_t *curr = cpu->curr_task, *next, *handed = cpu->handoff;
+	bool preempted = false;
+	int cmp;
+
+	/* Cesion directa: la tarea actual cede voluntariamente la CPU */
+	if ( handed )
+	{
+		cpu->handoff = NULL;
+		if ( curr->state == TaskCurrent )
+			ready(curr, false);
+	}
 
 	/* Ver si la tarea actual puede conservar la CPU */
-	if ( mt_curr_task->state == TaskCurrent )
+	else if ( curr->state == TaskCurrent )
 	{
-		if ( mt_curr_task->atomic_level )		/* No molestar */
+		if ( curr->atomic_level )		/* No molestar */
 			return false;
 
-		/* Analizar prioridades y ranura de tiempo */
-		ready_task = mt_peeklast(&ready_q);
-		if ( !ready_task || ready_task->priority < mt_curr_task->priority ||
-			(ticks_to_run && ready_task->priority == mt_curr_task->priority) )
-			return false; 
+		/* Analizar prioridades y ranura de tiempo; una tarea FIFO solo
+		   cede la CPU a otra mas prioritaria. Si su afinidad ya no permite
+		   esta CPU, la deja de todos modos */
+		if ( allowed(curr, cpu) )
+		{
+			if ( !(next = mt_peeklast_ready(cpu->id)) )
+				return false;
+			if ( curr != cpu->null_task && ((cmp = compare_tasks(next, curr)) < 0 ||
+					(cmp == 0 && (cpu->ticks_to_run || curr->policy == SchedFifo))) )
+				return false; 
+		}
 
-		/* La tarea actual pierde la CPU */
-		ready(mt_curr_task, false);
+		/* La tarea actual pierde la CPU. Si es FIFO, conserva su lugar al
+		   frente de las de su prioridad. La tarea nula no se encola */
+		if ( curr == cpu->null_task )
+			set_state(curr, TaskReady);
+		else
+		{
+			ready(curr, false);
+			if ( curr->policy == SchedFifo && curr->state == TaskReady )
+			{
+				unsigned id = mt_ready_cpu(curr);
+
+				mt_dequeue(curr);
+				mt_enqueue_ready_first(curr, id);
+			}
+		}
+		preempted = true;
 	}
 
-	/* Obtener la próxima tarea */
-	mt_last_task = mt_curr_task;
-	mt_curr_task = mt_getlast(&ready_q);
-	mt_curr_task->state = TaskCurrent;
+	/* Obtener la próxima tarea; si la cola de esta CPU esta vacia, tratar
+	   de tomar una de otra */
+	if ( !(next = handed) && !(next = mt_getlast_ready(cpu->id)) && steal(cpu) )
+		next = mt_getlast_ready(cpu->id);
+	if ( !next )
+		next = cpu->null_task;
+	cpu->last_task = curr;
+	cpu->curr_task = next;
+	set_state(next, TaskCurrent);
 
 	/* Si es la misma de antes, no hay nada mas que hacer */
-	if ( mt_curr_task == mt_last_task )
+	if ( next == curr )
 		return false;
+	next->cpu = cpu;
+	cpu->prev_task = curr;
+	if ( next->last_cpu && next->last_cpu != cpu )
+	{
+		next->migrations++;
+		cpu->migrations++;
+	}
+	next->last_cpu = cpu;
+
+	/* Registrar y contabilizar el cambio de contexto */
+	mt_trace(TraceSwitch, next, (unsigned) curr);
+	if ( preempted )
+		curr->invol_switches++;
+	else
+		curr->vol_switches++;
+
+	/* Con varias CPUs, guardar el coprocesador de la tarea que sale */
+	if ( mt_ncpus > 1 && cpu->fpu_task == curr )
+	{
+		mt_clts();
+		mt_fsave(curr->math_data);
+		cpu->fpu_task = NULL;
+	}
 
 	/* Si la tarea actual es dueña del coprocesador aritmético,
 	   bajar el bit TS en CR0. En caso contrario, levantarlo para que
 	   la próxima instrucción de coprocesador genere una excepción 7 */
-	if ( mt_curr_task == mt_fpu_task )
+	if ( next == cpu->fpu_task )
 		mt_clts();
 	else
 		mt_stts();
 
 	/* Guardar/reponer contexto propio del usuario */
 	if ( save_restore )
-		save_restore(mt_last_task, mt_curr_task);
+		save_restore(curr, next);
 
-	/* Inicializar ranura de tiempo */
-	ticks_to_run = QUANTUM;
+	/* Inicializar ranura de tiempo, salvo que la herede de la que cedio la CPU */
+	if ( !handed || !cpu->ticks_to_run )
+		cpu->ticks_to_run = mt_fair(next) ? fair_slice(next, cpu) : next->slice;
 	return true;
 }
 
+/*
+--------------------------------------------------------------------------------
+mt_switch_done - fin de un cambio de contexto
+
+Llamada ya en el stack de la nueva tarea, desde mt_context_switch() o al
+retornar de una interrupcion. Desasocia de la CPU a la tarea que la dejo, que
+a partir de ahora puede ejecutar en otra, y libera el lock del kernel si la
+nueva tarea no esta en una seccion critica: el lock pasa de una tarea a otra
+a traves del cambio de contexto.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_switch_done(void)
+{
+	Cpu_t *cpu = mt_this_cpu();
+
+	if ( cpu->prev_task )
+	{
+		cpu->prev_task->cpu = NULL;
+		cpu->prev_task = NULL;
+	}
+	if ( !cpu->curr_task->disint_level )
+		giant_unlock();
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_int_enter, mt_int_exit - entrada y salida de una interrupcion de primer nivel
+
+Llamadas desde interrupts.asm con interrupciones deshabilitadas, en el stack
+de interrupciones de la CPU. mt_int_enter toma el lock del kernel, salvo que
+la tarea interrumpida ya lo tuviera (una excepcion dentro de una seccion
+critica). mt_int_exit selecciona la proxima tarea a ejecutar si la
+interrumpida no estaba en una seccion critica; el lock se libera despues, en
+mt_switch_done().
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_int_enter(void)
+{
+	Task_t *task = mt_curr_task;
+
+	if ( !task->disint_level++ )
+		giant_lock();
+}
+
+void
+mt_int_exit(void)
+{
+	Task_t *task = mt_curr_task;
+
+	if ( task->disint_level == 1 )
+		mt_select_task();
+	task->disint_level--;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_int_unlock, mt_int_relock - liberan el lock del kernel durante un manejador
+
+Llamadas por mt_int_handler() con interrupciones deshabilitadas alrededor de
+un manejador de interrupcion de hardware de primer nivel. mt_int_unlock
+libera el lock que tomo mt_int_enter y deja el nivel en cero, como
+idle_halt(), para que las secciones DisableInts()/RestoreInts() del manejador
+lo tomen solo mientras lo necesitan y las demas CPUs no esperen por el
+manejador entero. Retorna el nivel que hay que reponer, o cero si no libero
+el lock: en una interrupcion anidada sobre las softirqs, o en una excepcion
+dentro de una seccion critica, el lock protege al codigo interrumpido.
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+mt_int_unlock(void)
+{
+	Task_t *task = mt_curr_task;
+	unsigned level = task->disint_level;
+
+	if ( mt_int_level != 1 || level != 1 )
+		return 0;
+	task->disint_level = 0;
+	giant_unlock();
+	return level;
+}
+
+void
+mt_int_relock(unsigned level)
+{
+	if ( !level )
+		return;
+	giant_lock();
+	mt_curr_task->disint_level = level;
+}
+
 /*
 --------------------------------------------------------------------------------
 scheduler - selecciona la próxima tarea a ejecutar.
@@ -758,37 +2340,255 @@ scheduler(void)
 		mt_context_switch();
 }
 
+/*
+--------------------------------------------------------------------------------
+tick - procesamiento de un tick de tiempo real
+
+Avanza la rueda de tiempo un tick y procesa las tareas que hayan vencido;
+los timers de software se procesan despues, en su softirq.
+Decrementa la ranura de tiempo de la tarea actual de cada CPU; a las otras
+CPUs se les avisa cuando se agota, si hay tareas esperando en su cola.
+Periodicamente equilibra la carga entre CPUs.
+--------------------------------------------------------------------------------
+*/
+
+static void
+tick(void)
+{
+	Task_t *task;
+	Cpu_t *cpu;
+	unsigned i;
+
+	++mt_ticks;
+
+	for ( i = 0 ; i < mt_ncpus ; i++ )
+	{
+		cpu = &mt_cpus[i];
+		if ( cpu->ticks_to_run && !--cpu->ticks_to_run && cpu != mt_this_cpu() &&
+				cpu->curr_task != cpu->null_task && mt_count_ready(i) )
+			mt_lapic_ipi(cpu->apic_id, LAPIC_RESCHED_IRQ);
+	}
+	mt_tick_time();
+	while ( (task = mt_getfirst_time()) )
+		expire(task);
+	mt_raise_softirq(SoftirqTimer);
+	for ( i = 0 ; i < mt_ncpus ; i++ )
+		if ( (task = mt_cpus[i].curr_task) && task->period )
+			charge_budget(task);
+		else if ( task && task->policy == SchedFair )
+			mt_update_stats(task);		// actualizar vruntime
+	if ( mt_ncpus > 1 && !(mt_ticks % BALANCETICKS) )
+		balance();
+	sample_load();
+}
+
+/*
+--------------------------------------------------------------------------------
+sample_load - medicion del tiempo ocioso
+
+Cada LOADTICKS ticks calcula en mt_idle_pct el porcentaje del tiempo
+transcurrido desde la medicion anterior que las CPUs estuvieron en sus tareas
+nulas, promediado sobre todas las CPUs.
+--------------------------------------------------------------------------------
+*/
+
+static void
+sample_load(void)
+{
+	static unsigned count;
+	static unsigned long long last_tsc, last_idle;
+	unsigned long long now, idle = 0;
+	unsigned i;
+
+	if ( ++count < LOADTICKS )
+		return;
+	count = 0;
+
+	for ( i = 0 ; i < mt_ncpus ; i++ )
+	{
+		mt_update_stats(mt_cpus[i].null_task);
+		idle += mt_cpus[i].null_task->run_cycles;
+	}
+	now = mt_rdtsc();
+	if ( last_tsc )
+		mt_idle_pct = (idle - last_idle) * 100 / ((now - last_tsc) * mt_ncpus);
+	last_tsc = now;
+	last_idle = idle;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_last_timer_tsc - TSC de la ultima interrupcion de timer de la CPU actual
+
+Cada CPU registra el valor al entrar a sus interrupciones de timer; se lee
+con las interrupciones deshabilitadas para que no cambie entre las dos
+mitades del valor.
+--------------------------------------------------------------------------------
+*/
+
+unsigned long long
+mt_last_timer_tsc(void)
+{
+	unsigned flags = mt_irqsave();
+	unsigned long long tsc = mt_this_cpu()->timer_tsc;
+
+	mt_irqrestore(flags);
+	return tsc;
+}
+
 /*
 --------------------------------------------------------------------------------
 clockint - interrupcion de tiempo real
 
-Despierta a las tareas de la cola de tiempo que tengan su cuenta de ticks
-agotada, y decrementa la cuenta de la primera que quede en la cola.
-Decrementa la ranura de tiempo de la tarea actual.
+En modo periodico procesa un tick. Si el timer estaba en modo one-shot, 
+primero acredita los ticks que se saltearon mientras la CPU estaba detenida
+y vuelve a programarlo en modo periodico. Como modifica las colas del
+scheduler directamente, todo su trabajo va dentro de DisableInts().
 --------------------------------------------------------------------------------
 */
 
 static void 
 clockint(unsigned irq)
+{
+	DisableInts();
+	mt_this_cpu()->timer_tsc = mt_rdtsc();
+	if ( tick_mode != TickPeriodic )
+	{
+		if ( tick_mode == TickIdle )
+			while ( --idle_ticks )
+				tick();
+		mt_timer_periodic();
+		tick_mode = TickPeriodic;
+	}
+	tick();
+	RestoreInts();
+}
+
+/*
+--------------------------------------------------------------------------------
+hrtimerint - interrupcion del timer del APIC local
+
+Despierta a las tareas de la cola de alta resolucion cuyo plazo se cumplio y
+reprograma el timer para la siguiente, sin admitir interrupciones anidadas.
+--------------------------------------------------------------------------------
+*/
+
+static void
+hrtimerint(unsigned irq)
 {
 	Task_t *task;
+	unsigned long long now;
 
-	++mt_ticks;
+	DisableInts();
+	now = mt_this_cpu()->timer_tsc = mt_rdtsc();
 
-	if ( ticks_to_run )
-		ticks_to_run--;
-	while ( (task = mt_peekfirst_time()) && !task->ticks )
+	while ( (task = mt_peekfirst_hrtime()) && task->timeout <= now )
 	{
-		mt_getfirst_time();
+		mt_getfirst_hrtime();
+		mt_trace(TraceExpire, task, 1);
 		ready(task, false);
 	}
 	if ( task )
-		task->ticks--;
+		mt_lapic_timer_arm(task->timeout);
+	RestoreInts();
+}
+
+/*
+--------------------------------------------------------------------------------
+resched - interrupcion de replanificacion enviada por otra CPU
+
+No hace nada: la tarea a ejecutar se elige al retornar de la interrupcion.
+--------------------------------------------------------------------------------
+*/
+
+static void
+resched(unsigned irq)
+{
+}
+
+/*
+--------------------------------------------------------------------------------
+idle_enter - programar el timer para el proximo vencimiento (tick dinamico)
+
+Llamada por la tarea nula con interrupciones deshabilitadas cuando no hay 
+ninguna otra tarea para ejecutar. Si el proximo evento de la cola de tiempo
+o de los timers de software esta a mas de un tick, programa el PIT en modo
+one-shot para que interrumpa recien en ese tick, o en el mas lejano que
+permita su contador de 16 bits.
+Los ticks se acreditan al despertar, en clockint() o en mt_idle_wakeup().
+Solo la usa la CPU 0, que recibe las interrupciones del PIT, y no detiene el
+tick mientras otra CPU este ejecutando alguna tarea.
+--------------------------------------------------------------------------------
+*/
+
+static void
+idle_enter(void)
+{
+	unsigned period = mt_timer_period();
+	unsigned count, next, i;
+
+	if ( tick_mode != TickPeriodic || mt_irq_pending(CLOCKIRQ) )
+		return;
+	for ( i = 1 ; i < mt_ncpus ; i++ )
+		if ( mt_cpus[i].curr_task != mt_cpus[i].null_task )
+			return;
+
+	/* Cuentas hasta el proximo tick y ticks a saltear despues de ese */
+	count = mt_timer_count();
+	next = min(min(mt_next_time(), mt_next_timer()), (MAX_PIT_COUNT - count) / period);
+	if ( !next )
+		return;
+
+	mt_timer_oneshot(count + next * period);
+	idle_ticks = next + 1;
+	tick_mode = TickIdle;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_idle_wakeup - corregir la cuenta de ticks al despertar del modo idle
+
+Llamada al comienzo de cada interrupcion de hardware. Si otra interrupcion
+desperto a la CPU antes del vencimiento del one-shot, acredita los ticks 
+completos transcurridos y reprograma el PIT para que interrumpa exactamente 
+en el proximo limite de tick, donde clockint() retoma el modo periodico.
+Si el one-shot ya habia vencido, la interrupcion de reloj esta pendiente y
+ella acreditara el ultimo tick.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_idle_wakeup(unsigned irq)
+{
+	unsigned period, count, programmed, elapsed;
+
+	if ( tick_mode != TickIdle || irq == CLOCKIRQ )
+		return;
+
+	period = mt_timer_period();
+	programmed = idle_ticks * period;
+	count = mt_timer_count();
+	if ( mt_irq_pending(CLOCKIRQ) || !count || count > programmed )	/* vencio */
+	{
+		while ( --idle_ticks )
+			tick();
+	}
+	else
+	{
+		elapsed = programmed - count;
+		for ( idle_ticks = elapsed / period ; idle_ticks ; idle_ticks-- )
+			tick();
+		mt_timer_oneshot(period - elapsed % period);
+	}
+	tick_mode = TickRealign;
 }
 
 /*
 --------------------------------------------------------------------------------
 Atomic - deshabilita el modo preemptivo para la tarea actual (anidable)
+
+Solo impide que la tarea pierda su CPU: no excluye a las tareas que ejecutan
+en otras CPUs. Para eso hay que usar DisableInts() o los semaforos.
 --------------------------------------------------------------------------------
 */
 
@@ -815,37 +2615,117 @@ Unatomic(void)
 	}
 }
 
+/*
+--------------------------------------------------------------------------------
+giant_lock, giant_unlock - lock del kernel
+
+Un spinlock protege las estructuras del scheduler entre CPUs; el heap y los
+semaforos tienen sus propios locks. Se toma junto con la deshabilitacion de
+interrupciones en DisableInts() y al entrar a una interrupcion de primer
+nivel, siempre con interrupciones deshabilitadas, y pertenece a la tarea: si
+esta cambia de contexto dentro de una seccion critica, lo libera la tarea que
+recibe la CPU.
+--------------------------------------------------------------------------------
+*/
+
+static void
+giant_lock(void)
+{
+	mt_spin_lock(&kernel_lock);
+}
+
+static void
+giant_unlock(void)
+{
+	mt_spin_unlock(&kernel_lock);
+}
+
 /*
 --------------------------------------------------------------------------------
 DisableInts - deshabilita interrupciones para la tarea actual (anidable)
+
+En el primer nivel toma ademas el lock del kernel, de modo que la seccion
+critica excluye tambien a las demas CPUs. Dentro de un manejador de
+interrupcion el nivel ya es al menos uno pero las interrupciones pueden estar
+habilitadas; en ese caso se recuerda el nivel de la seccion en la CPU, para
+que RestoreInts() vuelva a habilitarlas al salir de ella. Mientras la seccion
+esta abierta no puede anidarse otra interrupcion, asi que alcanza con un
+solo nivel por CPU.
 --------------------------------------------------------------------------------
 */
 
 void
 DisableInts(void)
 {
-	if ( !mt_curr_task->disint_level++ )
-		mt_cli();
+	unsigned flags = mt_irqsave();
+	Task_t *task = mt_curr_task;
+
+	if ( !task->disint_level++ )
+		giant_lock();
+	else if ( flags & EFLAGS_IF )
+		mt_this_cpu()->sti_level = task->disint_level;
 }
 
 /*
 --------------------------------------------------------------------------------
 RestoreInts - habilita interrupciones para la tarea actual (anidable)
+
+Las habilita al volver al nivel cero, liberando el lock del kernel, o al
+salir de una seccion que DisableInts() abrio con interrupciones habilitadas.
 --------------------------------------------------------------------------------
 */
 
 void
 RestoreInts(void)
 {
-	if ( mt_curr_task->disint_level && !--mt_curr_task->disint_level )
+	Task_t *task = mt_curr_task;
+	Cpu_t *cpu;
+
+	if ( !task->disint_level )
+		return;
+	if ( !--task->disint_level )
+	{
+		giant_unlock();
+		mt_sti();
+	}
+	else if ( (cpu = mt_this_cpu())->sti_level == task->disint_level + 1 )
+	{
+		cpu->sti_level = 0;
 		mt_sti();
+	}
+}
+
+/*
+--------------------------------------------------------------------------------
+idle_halt - detiene la CPU hasta la proxima interrupcion
+
+Llamada por la tarea nula dentro de DisableInts(). Libera el lock del kernel
+mientras la CPU esta detenida, para que las demas puedan usarlo y para que la
+interrupcion que la despierte pueda tomarlo.
+--------------------------------------------------------------------------------
+*/
+
+static void
+idle_halt(void)
+{
+	Task_t *task = mt_curr_task;
+	unsigned level = task->disint_level;
+
+	task->disint_level = 0;
+	giant_unlock();
+	mt_halt();
+	giant_lock();
+	task->disint_level = level;
 }
 
 /*
 --------------------------------------------------------------------------------
 do_nothing - Tarea nula
 
-Corre con prioridad 0 y toma la CPU cuando ninguna otra tarea pueda ejecutar.
+Cada CPU tiene una, con prioridad 0, y la ejecuta cuando no hay ninguna otra
+tarea para ejecutar, ni en su cola ni para tomar de otra CPU. Detiene la CPU
+con hlt hasta la proxima interrupcion; la CPU 0 programa antes el timer para
+no despertar en cada tick.
 --------------------------------------------------------------------------------
 */
 
@@ -853,7 +2733,18 @@ static void
 do_nothing(void *arg)
 {
 	while ( true )
-		;
+	{
+		DisableInts();
+		if ( mt_count_ready(mt_this_cpu()->id) || steal(mt_this_cpu()) )
+			scheduler();
+		else
+		{
+			if ( DYNTICK && mt_this_cpu() == mt_cpus )
+				idle_enter();
+			idle_halt();
+		}
+		RestoreInts();
+	}
 }
 
 /*
@@ -872,9 +2763,38 @@ do_nothing(void *arg)
 void
 mt_main(void)
 {
+	Cpu_t *cpu = &mt_cpus[0];
+
 	// Inicializar GDT e IDT
 	mt_setup_gdt_idt();
 
+	// Inicializar los datos de la CPU 0 y la tarea principal, que empieza
+	// con interrupciones deshabilitadas y el lock del kernel tomado
+	mt_load_fs(mt_cpu_segment(0, cpu));
+	cpu->self = cpu;
+	cpu->int_stack = (unsigned)(bsp_int_stack + INT_STACK);
+	cpu->curr_task = &main_task;
+	cpu->ticks_to_run = QUANTUM;
+	cpu->online = true;
+	main_task.name = "Main Task";
+	main_task.state = TaskCurrent;
+	main_task.priority = main_task.base_priority = DEFAULT_PRIO;
+	main_task.slice = QUANTUM;
+	main_task.affinity = ALL_CPUS;
+	main_task.weight = DEFAULT_WEIGHT;
+	main_task.send_queue.name = main_task.name;
+	main_task.stamp = mt_rdtsc();
+	main_task.cpu = cpu;
+	main_task.disint_level = 1;
+	mt_task_list = &main_task;
+	mt_spin_init(&kernel_lock, "kernel");
+	mt_spin_register(&kernel_lock);
+	mt_heap_init();
+	mt_cons_init();
+	mt_pool_init();
+	mt_stack_init();
+	giant_lock();
+
 	// Inicializar sistema de interrupciones
 	mt_setup_interrupts();
 
@@ -882,24 +2802,36 @@ mt_main(void)
 	// correspondiente y habilitar la interrupción
 	mt_setup_timer(MSPERTICK);
 	mt_set_int_handler(CLOCKIRQ, clockint);
+	mt_set_softirq(SoftirqTimer, "Timers", mt_run_timers);
 	mt_enable_irq(CLOCKIRQ);
 
+	// Inicializar el APIC local para los timers de alta resolución
+	if ( (hrtimers = mt_setup_apic()) )
+	{
+		tsc_per_tick = mt_tsc_khz() * MSPERTICK;
+		mt_set_int_handler(LAPIC_TIMER_IRQ, hrtimerint);
+		mt_set_int_handler(LAPIC_RESCHED_IRQ, resched);
+		cpu->apic_id = mt_lapic_id();
+	}
+
 	// Inicializar el sistema de manejo del coprocesador aritmético
 	mt_setup_math();
 
-	// Inicializar tarea principal
-	main_task.name = "Main Task";
-	main_task.state = TaskCurrent;
-	main_task.priority = DEFAULT_PRIO;
-	main_task.send_queue.name = main_task.name;
-	mt_curr_task = &main_task;
-	ticks_to_run = QUANTUM;
+	// Crear tarea nula de la CPU 0; no va en la cola de ready
+	cpu->null_task = CreateTask(do_nothing, 0, NULL, "Null Task", MIN_PRIO);
+	cpu->null_task->affinity = 1U << cpu->id;
+	set_state(cpu->null_task, TaskReady);
 
-	// Crear tarea nula y ponerla ready 
-	ready(CreateTask(do_nothing, 0, NULL, "Null Task", MIN_PRIO), false);
+	// Crear el reaper, que libera las tareas terminadas
+	reaper_task = CreateTask(reaper, 0, NULL, "Reaper", REAPER_PRIO);
+	reaper_q.name = "Reaper";
+	Ready(reaper_task);
 
 	// Habilitar interrupciones
-	mt_sti();
+	RestoreInts();
+
+	// Arrancar los demás procesadores
+	start_cpus();
 
 	// Borrar la pantalla
 	mt_cons_clear();
@@ -916,3 +2848,76 @@ mt_main(void)
 		shell_main(1, arg);
 	}
 }
+
+/*
+--------------------------------------------------------------------------------
+start_cpus - arranca los procesadores secundarios
+
+Requiere el APIC local. Cada procesador recibe un stack de interrupciones y
+una tarea nula, en cuyo stack arranca. Si alguno no responde, no se intenta
+con los siguientes.
+--------------------------------------------------------------------------------
+*/
+
+static void
+start_cpus(void)
+{
+	unsigned apic_ids[MAX_CPUS];
+	unsigned i, n;
+	char name[16];
+	Cpu_t *cpu;
+
+	if ( !hrtimers || (n = mt_smp_discover(apic_ids, MAX_CPUS)) < 2 )
+		return;
+
+	for ( i = 0 ; i < n && mt_ncpus < MAX_CPUS ; i++ )
+	{
+		if ( apic_ids[i] == mt_cpus[0].apic_id )
+			continue;
+		cpu = &mt_cpus[mt_ncpus];
+		cpu->self = cpu;
+		cpu->id = mt_ncpus;
+		cpu->apic_id = apic_ids[i];
+		cpu->int_stack = (unsigned) Malloc(INT_STACK) + INT_STACK;
+		sprintf(name, "Null Task %u", cpu->id);
+		cpu->null_task = CreateTask(do_nothing, 0, NULL, name, MIN_PRIO);
+		cpu->null_task->affinity = 1U << cpu->id;
+
+		DisableInts();
+		set_state(cpu->null_task, TaskReady);
+		mt_ncpus++;
+		RestoreInts();
+
+		if ( !mt_start_ap(cpu) )
+		{
+			DisableInts();
+			mt_ncpus--;
+			RestoreInts();
+			printk("CPU %u (APIC %u) no responde\n", cpu->id, cpu->apic_id);
+			break;
+		}
+	}
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_ap_start - comienza la ejecucion de un procesador secundario
+
+Llamada por mt_ap_main() con interrupciones deshabilitadas, en el stack de la
+tarea nula de la CPU, que pasa a ser la tarea actual. No retorna.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_ap_start(Cpu_t *cpu)
+{
+	Task_t *task = cpu->null_task;
+
+	cpu->curr_task = task;
+	DisableInts();
+	task->cpu = cpu;
+	set_state(task, TaskCurrent);
+	cpu->online = true;
+	RestoreInts();
+	do_nothing(NULL);
+}
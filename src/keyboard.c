@@ -216,11 +216,21 @@ static char numpad_map[] = { 'H', 'Y', 'A', 'B', 'D', 'C', 'V', 'U', 'G', 'S', '
 #define KBDOBF		2
 #define KBDINT		1
 #define KBDBUFSIZE	32
-
-// Proceso de entrada de teclas
-#define INPUTPRIO	10000		// Alta prioridad, para que funcione como "bottom half"
-
-static MsgQueue_t *scan_mq, *key_mq;
+#define SCANBUFSIZE	32			// potencia de 2
+#define MAX_KEYS	3			// caracteres de la traduccion mas larga
+
+static MsgQueue_t *key_mq;
+
+// Buffer circular de scan codes entre la interrupción y la softirq. Solo
+// lo escribe kbdint() y solo lo lee input_softirq(), que ejecuta con el lock
+// del kernel tomado, así que alcanza con los índices.
+// Si la cola de teclas no tiene lugar para la traducción más larga
+// (MAX_KEYS), input_softirq() deja los scan codes en el buffer y los lectores
+// de teclas la vuelven a marcar al sacar una. Solo se pierden teclas si se
+// llena también este buffer, y entonces se descartan los scan codes nuevos,
+// nunca parte de una secuencia de escape.
+static unsigned char scan_buf[SCANBUFSIZE];
+static volatile unsigned scan_head, scan_tail;
 
 static void 
 kbdint(unsigned irq)
@@ -230,8 +240,11 @@ kbdint(unsigned irq)
 	// para prender y apagar los LEDs), habrá que impedir que entren aquí las respuestas
 	// o procesarlas por separado.
 
-	unsigned c = inb(KBD);
-	PutMsgQueueCond(scan_mq, &c);
+	unsigned char c = inb(KBD);
+
+	if ( scan_tail - scan_head < SCANBUFSIZE )
+		scan_buf[scan_tail++ % SCANBUFSIZE] = c;
+	mt_raise_softirq(SoftirqKbd);
 }
 
 #if 0
@@ -365,15 +378,21 @@ make_break(unsigned scode)
 }
 
 static void
-input_task(void *arg)
+put_key(unsigned c)
+{
+	PutMsgQueueCond(key_mq, &c);
+}
+
+// Procesamiento diferido de la interrupción de teclado (softirq.c)
+static void
+input_softirq(void)
 {
 	unsigned char scode;
 	unsigned ch;
 
-	while (true)
+	while ( scan_head != scan_tail && KBDBUFSIZE - AvailMsgQueue(key_mq) >= MAX_KEYS )
 	{
-		if ( !GetMsgQueue(scan_mq, &scode) )
-			continue;
+		scode = scan_buf[scan_head++ % SCANBUFSIZE];
 
 		/* Perform make/break processing. */
 		if ( (ch = make_break(scode)) == NONE )
@@ -381,16 +400,13 @@ input_task(void *arg)
 
 		if (1 <= ch && ch <= 0xFF)
 			/* A normal character. */
-			PutMsgQueue(key_mq, &ch);
+			put_key(ch);
 		else if (HOME <= ch && ch <= INSRT)
 		{
 			/* An ASCII escape sequence generated by the numeric pad. */
-			unsigned c = ESC;
-			PutMsgQueue(key_mq, &c);
-			c = '[';
-			PutMsgQueue(key_mq, &c);
-			c = numpad_map[ch - HOME];
-			PutMsgQueue(key_mq, &c);
+			put_key(ESC);
+			put_key('[');
+			put_key(numpad_map[ch - HOME]);
 		}
 		else
 		{
@@ -402,18 +418,36 @@ input_task(void *arg)
 
 // Interfaz
 
+// Retomar los scan codes que input_softirq() dejó por falta de lugar
+static bool
+got_key(bool ok)
+{
+	if ( ok && scan_head != scan_tail )
+		mt_raise_softirq(SoftirqKbd);
+	return ok;
+}
+
 bool 
 mt_kbd_getch_timed(unsigned *c, unsigned timeout)
 {
 	*c = 0;
-	return GetMsgQueueTimed(key_mq, c, timeout);
+	return got_key(GetMsgQueueTimed(key_mq, c, timeout));
 }
 
 bool 
 mt_kbd_getch(unsigned *c)
 {
 	*c = 0;
-	return GetMsgQueue(key_mq, c);
+	return got_key(GetMsgQueue(key_mq, c));
+}
+
+/* Cola de teclas, para esperarla con WaitMultiple(). Quien saque teclas
+   directamente de la cola no retoma los scan codes pendientes: quedan para
+   la proxima interrupcion de teclado. */
+MsgQueue_t *
+mt_kbd_queue(void)
+{
+	return key_mq;
 }
 
 void
@@ -421,9 +455,8 @@ mt_kbd_init(void)
 {
 	keymap = keymaps[0];
 	kbd_name = names[0];
-	scan_mq = CreateMsgQueue("Scan code", KBDBUFSIZE, 1, false, false);
 	key_mq = CreateMsgQueue("Input key", KBDBUFSIZE, 1, true, false);
-	Ready(CreateTask(input_task, 0, NULL, "Input task", INPUTPRIO));
+	mt_set_softirq(SoftirqKbd, "Keyboard", input_softirq);
 	mt_set_int_handler(KBDINT, kbdint);
 	mt_enable_irq(KBDINT);
 }
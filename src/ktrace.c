@@ -0,0 +1,100 @@
+#include "kernel.h"
+
+/*
+	trace: control y volcado del registro de eventos del scheduler.
+
+	El volcado es de texto, una línea por evento en orden de TSC, combinando
+	los registros de todas las CPUs, pensado para procesarse fuera de línea:
+
+		# mtask trace khz=<frecuencia TSC> events=<cantidad>
+		# task <dirección> <nombre>		(tareas existentes al momento del volcado)
+		<tsc> <cpu> <evento> <tarea> <arg>
+
+	Todos los números van en hexadecimal. Los eventos son S (cambio de
+	contexto), W (ready), B (bloqueo), E (vencimiento de timeout), I y i
+	(entrada y salida de interrupción). La lista de tareas se copia con las
+	interrupciones deshabilitadas y se escribe después, como en top, con a
+	lo sumo MAX_TASKS tareas y sus nombres truncados a NAME_SIZE - 1.
+*/
+
+#define MAX_TASKS		256
+#define NAME_SIZE		64
+#define LINE_FG			LIGHTGRAY
+
+typedef struct
+{
+	Task_t *		task;
+	char			name[NAME_SIZE];
+}
+TaskName_t;
+
+static const char event_names[] = "SWBEIi";
+
+static unsigned where;					// destino del volcado (outk)
+
+static void
+dump(unsigned last)
+{
+	unsigned skip, n, i, ntasks = 0;
+	bool prev;
+	Task_t *task;
+	TaskName_t *names = Malloc(MAX_TASKS * sizeof(TaskName_t));
+	TraceEntry_t e;
+	TraceCursor_t cur;
+
+	prev = mt_trace_enable(false);
+	n = mt_trace_count();
+	skip = last && last < n ? n - last : 0;
+	outk(where, LINE_FG, "# mtask trace khz=%u events=%u\n", mt_tsc_khz(), n - skip);
+
+	/* Copiar la lista de tareas con las interrupciones deshabilitadas */
+	DisableInts();
+	for ( task = mt_task_list ; task && ntasks < MAX_TASKS ; task = task->list_next )
+	{
+		names[ntasks].task = task;
+		strncpy(names[ntasks++].name, task->name ? task->name : "", NAME_SIZE - 1);
+	}
+	RestoreInts();
+
+	for ( i = 0 ; i < ntasks ; i++ )
+		outk(where, LINE_FG, "# task %08x %s\n", (unsigned) names[i].task, names[i].name);
+	Free(names);
+
+	for ( mt_trace_start(&cur, skip) ; mt_trace_next(&cur, &e) ; )
+		outk(where, LINE_FG, "%08x%08x %x %c %08x %x\n", (unsigned)(e.tsc >> 32), (unsigned) e.tsc,
+			e.cpu, event_names[e.event], (unsigned) e.task, e.arg);
+	mt_trace_enable(prev);
+}
+
+int
+ktrace_main(int argc, char **argv)
+{
+	if ( argc == 1 )
+	{
+		printk("Uso: trace on|off|clear|dump [n]|serial [n]\n");
+		printk("Eventos registrados: %u\n", mt_trace_count());
+		return 0;
+	}
+	if ( strcmp(argv[1], "on") == 0 )
+		mt_trace_enable(true);
+	else if ( strcmp(argv[1], "off") == 0 )
+		mt_trace_enable(false);
+	else if ( strcmp(argv[1], "clear") == 0 )
+		mt_trace_clear();
+	else if ( strcmp(argv[1], "dump") == 0 || strcmp(argv[1], "serial") == 0 )
+	{
+		where = argv[1][0] == 's' ? OUT_SERIAL : OUT_CONSOLE;
+		if ( where == OUT_SERIAL && !mt_serial_init(SERIAL_BAUD) )
+		{
+			cprintk(LIGHTRED, BLACK, "No hay puerto serie\n");
+			return 2;
+		}
+		dump(argc > 2 ? atoi(argv[2]) : 0);
+	}
+	else
+	{
+		cprintk(LIGHTRED, BLACK, "Opción %s desconocida\n", argv[1]);
+		return 1;
+	}
+	return 0;
+}
@@ -3,6 +3,11 @@ bits 32
 ; Mantener sincronizado con la definición de la estructura Task_t en mtask.h
 Task_t.esp equ 20
 
+; Mantener sincronizado con la definición de la estructura Cpu_t en kernel.h
+Cpu_t.self equ 0
+Cpu_t.curr_task equ 4
+Cpu_t.last_task equ 8
+
 BIT_TS equ 8
 
 global mt_load_gdt
@@ -10,14 +15,24 @@ global mt_load_idt
 global mt_context_switch
 global mt_sti
 global mt_cli
+global mt_irqsave
+global mt_irqrestore
 global mt_finit
 global mt_fsave
 global mt_frstor
 global mt_stts
 global mt_clts
-
-extern mt_curr_task
-extern mt_last_task
+global mt_halt
+global mt_cpuid
+global mt_rdtsc
+global mt_rdmsr
+global mt_wrmsr
+global mt_load_fs
+global mt_pause
+global mt_this_cpu
+global mt_current_task
+
+extern mt_switch_done
 
 section .text
 
@@ -50,6 +65,8 @@ mt_load_idt:
 ; Cambio de contexto fuera de una interrupción.
 ; Mantener el stack frame sincronizado con el manejador de interrupciones
 ; en interrupts.asm y con la estructura mt_regs_t en kernel.h
+; Se llama con el lock del kernel tomado; una vez en el stack de la nueva
+; tarea, mt_switch_done() lo libera si corresponde.
 mt_context_switch:
 	pushfd
 	push eax
@@ -60,10 +77,11 @@ mt_context_switch:
 	push edi
 	push ebp
 
-	mov eax, [mt_last_task]
+	mov eax, [fs:Cpu_t.last_task]
 	mov [eax + Task_t.esp], esp
-	mov eax, [mt_curr_task]
+	mov eax, [fs:Cpu_t.curr_task]
 	mov esp, [eax + Task_t.esp]
+	call mt_switch_done
 
 	pop ebp
 	pop edi
@@ -87,6 +105,21 @@ mt_cli:
 	cli
 	ret
 
+; unsigned mt_irqsave(void);
+; Deshabilitar interrupciones, retornando los flags anteriores
+mt_irqsave:
+	pushfd
+	pop eax
+	cli
+	ret
+
+; void mt_irqrestore(unsigned flags);
+; Reponer los flags guardados por mt_irqsave
+mt_irqrestore:
+	push dword [esp + 4]
+	popfd
+	ret
+
 ; void mt_finit(void);
 ; Resetear el coprocesador aritmético
 mt_finit:
@@ -120,6 +153,83 @@ mt_clts:
 	clts
 	ret
 
+; void mt_halt(void);
+; Habilitar interrupciones y detener la CPU hasta la próxima interrupción.
+; La instrucción que sigue a sti se ejecuta antes de atender interrupciones,
+; por lo que no se pierde ninguna entre sti y hlt. Retorna con interrupciones
+; deshabilitadas.
+mt_halt:
+	sti
+	hlt
+	cli
+	ret
+
+; void mt_cpuid(unsigned leaf, unsigned regs[4]);
+; Ejecutar cpuid y guardar eax, ebx, ecx, edx en regs
+mt_cpuid:
+	push ebx
+	push esi
+	mov eax, [esp + 12]
+	xor ecx, ecx
+	cpuid
+	mov esi, [esp + 16]
+	mov [esi], eax
+	mov [esi + 4], ebx
+	mov [esi + 8], ecx
+	mov [esi + 12], edx
+	pop esi
+	pop ebx
+	ret
+
+; unsigned long long mt_rdtsc(void);
+; Leer el contador de ciclos (time stamp counter), retorna en edx:eax
+mt_rdtsc:
+	rdtsc
+	ret
+
+; unsigned long long mt_rdmsr(unsigned msr);
+; Leer un registro específico del modelo, retorna en edx:eax
+mt_rdmsr:
+	mov ecx, [esp + 4]
+	rdmsr
+	ret
+
+; void mt_wrmsr(unsigned msr, unsigned long long value);
+; Escribir un registro específico del modelo
+mt_wrmsr:
+	mov ecx, [esp + 4]
+	mov eax, [esp + 8]
+	mov edx, [esp + 12]
+	wrmsr
+	ret
+
+; void mt_load_fs(unsigned selector);
+; Cargar el segmento FS, que apunta a los datos propios de la CPU
+mt_load_fs:
+	mov eax, [esp + 4]
+	mov fs, ax
+	ret
+
+; void mt_pause(void);
+; Pausa dentro de un ciclo de espera activa
+mt_pause:
+	pause
+	ret
+
+; Cpu_t *mt_this_cpu(void);
+; Retorna los datos de la CPU en que se ejecuta
+mt_this_cpu:
+	mov eax, [fs:Cpu_t.self]
+	ret
+
+; Task_t *mt_current_task(void);
+; Retorna la tarea actual de esta CPU. Se lee en una sola instrucción, de modo
+; que el resultado es correcto aunque la tarea cambie de CPU en cualquier
+; momento.
+mt_current_task:
+	mov eax, [fs:Cpu_t.curr_task]
+	ret
+
 section .bss
 
 longptr:
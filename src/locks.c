@@ -0,0 +1,64 @@
+#include "kernel.h"
+
+/*
+	locks: estadisticas de los spinlocks registrados.
+
+	Para cada lock muestra cuantas veces se tomo, el porcentaje de esas veces
+	en que hubo que esperar, el tiempo medio de espera y el tiempo medio y
+	maximo que estuvo tomado. Los tiempos se muestran en microsegundos si el
+	TSC fue calibrado, o en ciclos si no. "locks reset" pone las estadisticas
+	en cero.
+*/
+
+#define MAX_LOCKS		64
+
+#define HEAD_FMT		"%-16s %9s %6s %9s %9s %9s"
+#define LINE_FMT		"%-16.16s %9u %4u.%u %9u %9u %9u"
+
+#define HEAD_FG			YELLOW
+#define LINE_FG			LIGHTGRAY
+
+static unsigned
+to_us(unsigned long long cycles)
+{
+	unsigned khz = mt_tsc_khz();
+
+	return khz ? cycles * 1000 / khz : cycles;
+}
+
+int
+locks_main(int argc, char *argv[])
+{
+	LockStats_t *stats, *l;
+	unsigned i, n, permil;
+
+	if ( argc > 1 )
+	{
+		if ( strcmp(argv[1], "reset") )
+		{
+			cprintk(LIGHTRED, BLACK, "Uso: locks [reset]\n");
+			return 1;
+		}
+		mt_spin_reset_stats();
+		return 0;
+	}
+
+	stats = Malloc(MAX_LOCKS * sizeof(LockStats_t));
+	n = mt_spin_stats(stats, MAX_LOCKS);
+	cprintk(HEAD_FG, BLACK, HEAD_FMT, "Lock", "Veces", "%Esp",
+		mt_tsc_khz() ? "Esp(us)" : "Esp(cic)", "Tomado", "Maximo");
+	printk("\n");
+	for ( i = 0 ; i < n ; i++ )
+	{
+		l = &stats[i];
+		permil = l->count ? l->contended * 1000ULL / l->count : 0;
+		cprintk(LINE_FG, BLACK, LINE_FMT, l->name,
+			l->count, permil / 10, permil % 10,
+			l->contended ? to_us(l->spin_cycles / l->contended) : 0,
+			l->count ? to_us(l->hold_cycles / l->count) : 0,
+			to_us(l->max_hold));
+		printk("\n");
+	}
+	Free(stats);
+	return 0;
+}
@@ -20,9 +20,21 @@ static Header heap[HEAPSIZE / sizeof(Header)];
 static Header base;
 static Header *freep;
 
-/* free: put block ap in free list */
+/* El heap es compartido por todas las CPUs y se usa también desde
+   interrupciones: malloc y free lo protegen con su propio lock */
+static Spinlock_t heap_lock;
+
+/* mt_heap_init: inicializa el lock del heap, desde mt_main() */
 void
-free(void *ap)
+mt_heap_init(void)
+{
+	mt_spin_init(&heap_lock, "heap");
+	mt_spin_register(&heap_lock);
+}
+
+/* free_block: put block ap in free list */
+static void
+free_block(void *ap)
 {
 	Header *bp, *p;
 
@@ -59,12 +71,21 @@ morecore(unsigned nu)
 		return 0;
 	up = heap;
 	up->size = HEAPSIZE / sizeof(Header);
-	free(up + 1);
+	free_block(up + 1);
 	return freep;
 }
 
-void *
-malloc(unsigned nbytes)
+void
+free(void *ap)
+{
+	unsigned flags = mt_spin_lock_irqsave(&heap_lock);
+
+	free_block(ap);
+	mt_spin_unlock_irqrestore(&heap_lock, flags);
+}
+
+static void *
+alloc_block(unsigned nbytes)
 {
 	Header *p, *prevp;
 	unsigned nunits = (nbytes + sizeof(Header) - 1) / sizeof(Header) + 1;
@@ -95,3 +116,12 @@ malloc(unsigned nbytes)
 	}
 }
 
+void *
+malloc(unsigned nbytes)
+{
+	unsigned flags = mt_spin_lock_irqsave(&heap_lock);
+	void *p = alloc_block(nbytes);
+
+	mt_spin_unlock_irqrestore(&heap_lock, flags);
+	return p;
+}
@@ -13,20 +13,20 @@ math_handler(unsigned except_num, unsigned error, mt_regs_t *regs)
 	// Bajar el bit
 	mt_clts();
 
-	// Si alguien usó el coprocesador antes, guardar el estado. 
+	// Si alguien usó el coprocesador antes en esta CPU, guardar el estado.
 	// Si no, resetearlo.
 	if ( mt_fpu_task )
-	{
-		if ( !mt_fpu_task->math_data )
-			mt_fpu_task->math_data = Malloc(CP_SIZE);
 		mt_fsave(mt_fpu_task->math_data);
-	}
 	else
 		mt_finit();
 	
-	// Si tenemos un estado guardado, reponerlo
+	// Si tenemos un estado guardado, reponerlo. Si no, reservar lugar para
+	// guardarlo: el dueño del coprocesador siempre tiene dónde hacerlo, porque
+	// con varias CPUs se guarda al cambiar de contexto.
 	if ( mt_curr_task->math_data )
 		mt_frstor(mt_curr_task->math_data);
+	else
+		mt_curr_task->math_data = Malloc(CP_SIZE);
 
 	// Ahora esta tarea es la dueña del coprocesador
 	mt_fpu_task = mt_curr_task;
@@ -12,6 +12,7 @@ CreateMonitor(char *name)
 	Monitor_t *mon = Malloc(sizeof(Monitor_t));
 
 	mon->sem = CreateSem(name, 1);
+	mon->sem->queue->inherit = true;
 	return mon;
 }
 
@@ -34,6 +35,8 @@ EnterMonitor, EnterMonitorCond, EnterMonitorTimed - ocupar un monitor.
 
 El valor de retorno indica si la operacion fue exitosa, en cuyo caso el
 proceso es dueno del monitor.
+Como en los mutex, el dueno hereda la prioridad de los procesos que esperan
+el monitor.
 --------------------------------------------------------------------------------
 */
 
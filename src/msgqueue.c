@@ -1,29 +1,52 @@
 #include "kernel.h"
 
+static bool get_timed(MsgQueue_t *mq, void *msg, unsigned long long usecs);
+static bool put_timed(MsgQueue_t *mq, void *msg, unsigned long long usecs);
+
+static bool
+get_msg(MsgQueue_t *mq, void *msg, unsigned long long usecs)
+{
+	if ( !mt_wait_sem(mq->sem_get, usecs) )
+		return false;
+	mt_msgqueue_get(mq, msg);
+	return true;
+}
+
 static bool
-get_msg(MsgQueue_t *mq, void *msg, unsigned msecs)
+put_msg(MsgQueue_t *mq, void *msg, unsigned long long usecs)
 {
-	if ( !WaitSemTimed(mq->sem_get, msecs) )
+	if ( !mt_wait_sem(mq->sem_put, usecs) )
 		return false;
+	mt_msgqueue_put(mq, msg);
+	return true;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_msgqueue_get, mt_msgqueue_put - lectura y escritura de un mensaje despues
+								   de haber obtenido un evento de sem_get o
+								   sem_put respectivamente
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_msgqueue_get(MsgQueue_t *mq, void *msg)
+{
 	memcpy(msg, mq->head, mq->msg_size);
 	mq->head += mq->msg_size;
 	if ( mq->head == mq->end )
 		mq->head = mq->buf;
 	SignalSem(mq->sem_put);
-	return true;
 }
 
-static bool
-put_msg(MsgQueue_t *mq, void *msg, unsigned msecs)
+void
+mt_msgqueue_put(MsgQueue_t *mq, void *msg)
 {
-	if ( !WaitSemTimed(mq->sem_put, msecs) )
-		return false;
 	memcpy(mq->tail, msg, mq->msg_size);
 	mq->tail += mq->msg_size;
 	if ( mq->tail == mq->end )
 		mq->tail = mq->buf;
 	SignalSem(mq->sem_get);
-	return true;
 }
 
 /*
@@ -78,7 +101,8 @@ DeleteMsgQueue(MsgQueue_t *mq)
 
 /*
 --------------------------------------------------------------------------------
-GetMsgQueue, GetMsgQueueCond, GetMsgQueueTimed - lectura de un mensaje
+GetMsgQueue, GetMsgQueueCond, GetMsgQueueTimed, GetMsgQueueTimedUs - lectura
+de un mensaje
 --------------------------------------------------------------------------------
 */
 
@@ -96,12 +120,24 @@ GetMsgQueueCond(MsgQueue_t *mq, void *msg)
 
 bool
 GetMsgQueueTimed(MsgQueue_t *mq, void *msg, unsigned msecs)
+{
+	return get_timed(mq, msg, mt_timeout_ms(msecs));
+}
+
+bool
+GetMsgQueueTimedUs(MsgQueue_t *mq, void *msg, unsigned usecs)
+{
+	return get_timed(mq, msg, mt_timeout_us(usecs));
+}
+
+static bool
+get_timed(MsgQueue_t *mq, void *msg, unsigned long long usecs)
 {
 	bool result;
 
-	if ( mq->mutex_get && !EnterMutexTimed(mq->mutex_get, msecs) )
+	if ( mq->mutex_get && !mt_enter_mutex(mq->mutex_get, usecs) )
 		return false;
-	result = get_msg(mq, msg, msecs);
+	result = get_msg(mq, msg, usecs);
 	if ( mq->mutex_get )
 		LeaveMutex(mq->mutex_get);
 
@@ -110,7 +146,8 @@ GetMsgQueueTimed(MsgQueue_t *mq, void *msg, unsigned msecs)
 
 /*
 --------------------------------------------------------------------------------
-PutMsgQueue, PutMsgQueueCond, PutMsgQueueTimed - escritura de un mensaje
+PutMsgQueue, PutMsgQueueCond, PutMsgQueueTimed, PutMsgQueueTimedUs - escritura
+de un mensaje
 --------------------------------------------------------------------------------
 */
 
@@ -128,12 +165,24 @@ PutMsgQueueCond(MsgQueue_t *mq, void *msg)
 
 bool
 PutMsgQueueTimed(MsgQueue_t *mq, void *msg, unsigned msecs)
+{
+	return put_timed(mq, msg, mt_timeout_ms(msecs));
+}
+
+bool
+PutMsgQueueTimedUs(MsgQueue_t *mq, void *msg, unsigned usecs)
+{
+	return put_timed(mq, msg, mt_timeout_us(usecs));
+}
+
+static bool
+put_timed(MsgQueue_t *mq, void *msg, unsigned long long usecs)
 {
 	bool result;
 
-	if ( mq->mutex_put && !EnterMutexTimed(mq->mutex_put, msecs) )
+	if ( mq->mutex_put && !mt_enter_mutex(mq->mutex_put, usecs) )
 		return false;
-	result = put_msg(mq, msg, msecs);
+	result = put_msg(mq, msg, usecs);
 	if ( mq->mutex_put )
 		LeaveMutex(mq->mutex_put);
 
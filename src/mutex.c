@@ -12,6 +12,7 @@ CreateMutex(char *name)
 	Mutex_t *mut = Malloc(sizeof(Mutex_t));
 
 	mut->sem = CreateSem(name, 1);
+	mut->sem->queue->inherit = true;
 	return mut;
 }
 
@@ -30,12 +31,14 @@ DeleteMutex(Mutex_t *mut)
 
 /*
 --------------------------------------------------------------------------------
-EnterMutex, EnterMutexCond, EnterMutexTimed - ocupar un mutex.
+EnterMutex, EnterMutexCond, EnterMutexTimed, EnterMutexTimedUs - ocupar un mutex.
 
 El valor de retorno indica si la operacion fue exitosa, en cuyo caso el
 proceso es dueno del mutex.
 El mutex puede tomarse anidadamente, para liberarlo debe llamarse tantas
 veces a LeaveMutex como las que se lo ocupo exitosamente.
+Mientras haya procesos esperando el mutex, el dueno hereda la prioridad del
+mas prioritario de ellos, en forma transitiva si a su vez espera otro mutex.
 --------------------------------------------------------------------------------
 */
 
@@ -53,13 +56,25 @@ EnterMutexCond(Mutex_t *mut)
 
 bool			
 EnterMutexTimed(Mutex_t *mut, unsigned msecs)
+{
+	return mt_enter_mutex(mut, mt_timeout_ms(msecs));
+}
+
+bool			
+EnterMutexTimedUs(Mutex_t *mut, unsigned usecs)
+{
+	return mt_enter_mutex(mut, mt_timeout_us(usecs));
+}
+
+bool
+mt_enter_mutex(Mutex_t *mut, unsigned long long usecs)
 {
 	if ( mut->owner == mt_curr_task )
 	{
 		mut->use_count++;
 		return true;
 	}
-	if ( WaitSemTimed(mut->sem, msecs) )
+	if ( mt_wait_sem(mut->sem, usecs) )
 	{
 		mut->owner = mt_curr_task;
 		mut->use_count = 1;
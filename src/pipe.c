@@ -122,6 +122,7 @@ PutPipeTimed(Pipe_t *p, void *data, unsigned size, unsigned msecs)
 {
 	unsigned i, nbytes;
 	char *d;
+	bool empty;
 
 	if ( !size )
 		return 0;
@@ -141,9 +142,12 @@ PutPipeTimed(Pipe_t *p, void *data, unsigned size, unsigned msecs)
 		if ( p->tail == p->end )
 			p->tail = p->buf;
 	}
-	if ( !p->avail )		// despertar un eventual lector bloqueado
-		SignalCondition(p->cond_get);
+	// Despertar un eventual lector bloqueado, despues de actualizar avail
+	// para que lo vea WaitMultiple()
+	empty = !p->avail;
 	p->avail += nbytes;
+	if ( empty )
+		SignalCondition(p->cond_get);
 	LeaveMonitor(p->monitor);
 	return nbytes;
 }
@@ -0,0 +1,233 @@
+#include "kernel.h"
+
+/*
+	Pools de bloques de control y stacks de tareas.
+
+	Las tareas que terminan devuelven su bloque de control y su stack a listas
+	de objetos libres, de donde los toma la próxima tarea que se crea, sin
+	pasar por el heap. Los stacks se agrupan en clases de tamaño, potencias de
+	2 entre 1 KB y 64 KB; los mayores se toman y devuelven directamente al
+	heap, y se cuentan como fallas de la ultima clase. Cada lista guarda a
+	lo sumo POOL_MAX objetos: el resto vuelve al heap.
+	Los bloques de control se entregan en cero. Los stacks no se borran,
+	salvo que se pida: la tarea solamente usa lo que escribe.
+*/
+
+#define POOL_MAX		32				// objetos libres por lista
+#define STACK_SHIFT		10				// clase 0: 1 KB (stacks aprendidos)
+#define STACK_CLASSES	(POOL_CLASSES - 1)
+
+typedef struct PoolItem_t				// objeto libre
+{
+	struct PoolItem_t *	next;
+}
+PoolItem_t;
+
+typedef struct
+{
+	PoolItem_t *	free;				// objetos libres
+	PoolStats_t		stats;
+}
+Pool_t;
+
+static Pool_t tcb_pool = { .stats.size = sizeof(Task_t) };
+static Pool_t stack_pool[STACK_CLASSES];
+static Spinlock_t pool_lock;
+
+/* Clase de un tamaño de stack, redondeándolo a la potencia de 2 siguiente */
+static unsigned
+stack_class(unsigned *size)
+{
+	unsigned cls = 0;
+
+	while ( (1U << (cls + STACK_SHIFT)) < *size )
+		cls++;
+	if ( cls < STACK_CLASSES )
+		*size = 1U << (cls + STACK_SHIFT);
+	return cls;
+}
+
+static void *
+pool_get(Pool_t *pool)
+{
+	PoolItem_t *item;
+
+	if ( !(item = pool->free) )
+	{
+		pool->stats.misses++;
+		return NULL;
+	}
+	pool->free = item->next;
+	pool->stats.hits++;
+	pool->stats.cached--;
+	return item;
+}
+
+static bool
+pool_put(Pool_t *pool, void *obj)
+{
+	PoolItem_t *item = obj;
+
+	if ( pool->stats.cached >= POOL_MAX )
+		return false;
+	item->next = pool->free;
+	pool->free = item;
+	pool->stats.cached++;
+	return true;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_pool_init - inicializa el lock de los pools
+
+Se llama desde mt_main() antes de crear la primera tarea.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_pool_init(void)
+{
+	mt_spin_init(&pool_lock, "pool");
+	mt_spin_register(&pool_lock);
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_pool_get_task, mt_pool_put_task - bloques de control de tareas
+
+mt_pool_get_task retorna un bloque de control en cero.
+--------------------------------------------------------------------------------
+*/
+
+Task_t *
+mt_pool_get_task(void)
+{
+	unsigned flags = mt_spin_lock_irqsave(&pool_lock);
+	Task_t *task = pool_get(&tcb_pool);
+
+	mt_spin_unlock_irqrestore(&pool_lock, flags);
+	if ( !task )
+		return Malloc(sizeof(Task_t));
+	memset(task, 0, sizeof(Task_t));
+	return task;
+}
+
+void
+mt_pool_put_task(Task_t *task)
+{
+	unsigned flags = mt_spin_lock_irqsave(&pool_lock);
+	bool cached = pool_put(&tcb_pool, task);
+
+	mt_spin_unlock_irqrestore(&pool_lock, flags);
+	if ( !cached )
+		free(task);
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_pool_get_stack, mt_pool_put_stack - stacks de tareas
+
+mt_pool_get_stack redondea el tamaño pedido a su clase y lo actualiza. Si
+clear es false, el contenido del stack es indefinido.
+--------------------------------------------------------------------------------
+*/
+
+char *
+mt_pool_get_stack(unsigned *size, bool clear)
+{
+	unsigned cls = stack_class(size), flags;
+	char *stack = NULL;
+
+	flags = mt_spin_lock_irqsave(&pool_lock);
+	if ( cls < STACK_CLASSES )
+		stack = pool_get(&stack_pool[cls]);
+	else								// los mayores cuentan en la ultima clase
+		stack_pool[STACK_CLASSES - 1].stats.misses++;
+	mt_spin_unlock_irqrestore(&pool_lock, flags);
+	if ( !stack && !(stack = malloc(*size)) )
+	{
+		mt_reclaim();
+		if ( !(stack = malloc(*size)) )
+			Panic("Error malloc");
+	}
+	if ( clear )
+		memset(stack, 0, *size);
+	return stack;
+}
+
+void
+mt_pool_put_stack(char *stack, unsigned size)
+{
+	unsigned cls = stack_class(&size), flags;
+	bool cached = false;
+
+	if ( cls < STACK_CLASSES )
+	{
+		flags = mt_spin_lock_irqsave(&pool_lock);
+		cached = pool_put(&stack_pool[cls], stack);
+		mt_spin_unlock_irqrestore(&pool_lock, flags);
+	}
+	if ( !cached )
+		free(stack);
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_pool_drain - devuelve al heap todos los objetos libres de los pools
+
+Se usa cuando falta memoria. Los objetos se liberan fuera del lock de los
+pools.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_pool_drain(void)
+{
+	PoolItem_t *lists[POOL_CLASSES], *item, *next;
+	unsigned i, flags = mt_spin_lock_irqsave(&pool_lock);
+
+	lists[0] = tcb_pool.free;
+	tcb_pool.free = NULL;
+	tcb_pool.stats.cached = 0;
+	for ( i = 0 ; i < STACK_CLASSES ; i++ )
+	{
+		lists[i + 1] = stack_pool[i].free;
+		stack_pool[i].free = NULL;
+		stack_pool[i].stats.cached = 0;
+	}
+	mt_spin_unlock_irqrestore(&pool_lock, flags);
+
+	for ( i = 0 ; i < POOL_CLASSES ; i++ )
+		for ( item = lists[i] ; item ; item = next )
+		{
+			next = item->next;
+			free(item);
+		}
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_pool_stats - estadisticas de los pools
+
+Copia hasta max entradas: la primera corresponde a los bloques de control y
+las siguientes a las clases de stacks, de menor a mayor. Retorna la cantidad
+copiada.
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+mt_pool_stats(PoolStats_t stats[], unsigned max)
+{
+	unsigned flags = mt_spin_lock_irqsave(&pool_lock);
+	unsigned i, n = 0;
+
+	if ( n < max )
+		stats[n++] = tcb_pool.stats;
+	for ( i = 0 ; i < STACK_CLASSES && n < max ; i++ )
+	{
+		stats[n] = stack_pool[i].stats;
+		stats[n++].size = 1U << (i + STACK_SHIFT);
+	}
+	mt_spin_unlock_irqrestore(&pool_lock, flags);
+	return n;
+}
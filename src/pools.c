@@ -0,0 +1,38 @@
+#include "kernel.h"
+
+/*
+	pools: estadisticas de los pools de bloques de control y stacks.
+
+	Para cada pool muestra el tamaño de sus objetos, los pedidos atendidos
+	desde el pool y los que fueron al heap, el porcentaje de aciertos y la
+	cantidad de objetos libres guardados. La ultima clase de stacks cuenta
+	tambien los pedidos mayores, que siempre van al heap.
+*/
+
+#define HEAD_FMT		"%-8s %9s %9s %9s %6s %7s"
+#define LINE_FMT		"%-8s %9u %9u %9u %4u.%u %7u"
+
+#define HEAD_FG			YELLOW
+#define LINE_FG			LIGHTGRAY
+
+int
+pools_main(int argc, char *argv[])
+{
+	PoolStats_t stats[POOL_CLASSES], *p;
+	unsigned i, n, total, permil;
+
+	n = mt_pool_stats(stats, POOL_CLASSES);
+	cprintk(HEAD_FG, BLACK, HEAD_FMT, "Pool", "Bytes", "Aciertos", "Fallas",
+		"%Acie", "Libres");
+	printk("\n");
+	for ( i = 0 ; i < n ; i++ )
+	{
+		p = &stats[i];
+		total = p->hits + p->misses;
+		permil = total ? p->hits * 1000ULL / total : 0;
+		cprintk(LINE_FG, BLACK, LINE_FMT, i ? "stack" : "tcb", p->size,
+			p->hits, p->misses, permil / 10, permil % 10, p->cached);
+		printk("\n");
+	}
+	return 0;
+}
@@ -5,9 +5,11 @@ vprintk(const char *fmt, va_list args)
 {
 	int i, n;
 	char c;
-	char buf[200];
+	char buf[PRINTK_LINE];
+	unsigned flags;
 
 	n = vsprintf(buf, fmt, args);
+	flags = mt_cons_lock();
 	if ( n > 0 )
 		for ( i = 0 ; i < n ; i++ )
 		{
@@ -15,6 +17,7 @@ vprintk(const char *fmt, va_list args)
 				mt_cons_putc('\r');
 			mt_cons_putc(c);
 		}
+	mt_cons_unlock(flags);
 
 	return n;
 }
@@ -36,15 +39,35 @@ void
 cprintk(unsigned fg, unsigned bg, char *fmt, ...)
 {
 	va_list args;
-	unsigned fgi, bgi;
+	unsigned fgi, bgi, flags;
 
-	DisableInts();
+	flags = mt_cons_lock();
 	mt_cons_getattr(&fgi, &bgi);
 	mt_cons_setattr(fg, bg);
 	va_start(args, fmt);
 	vprintk(fmt, args);
 	va_end(args);
 	mt_cons_setattr(fgi, bgi);
-	RestoreInts();
+	mt_cons_unlock(flags);
 }
 
+
+/*
+	Escribe una linea en la consola, con el color fg, en el puerto serie, o
+	en ambos, segun los destinos indicados en where. Se usa para exportar
+	datos de diagnostico. El texto formateado no debe pasar de PRINTK_LINE.
+*/
+void
+outk(unsigned where, unsigned fg, const char *fmt, ...)
+{
+	char buf[PRINTK_LINE];
+	va_list args;
+
+	va_start(args, fmt);
+	vsprintf(buf, fmt, args);
+	va_end(args);
+	if ( where & OUT_CONSOLE )
+		cprintk(fg, BLACK, "%s", buf);
+	if ( where & OUT_SERIAL )
+		mt_serial_puts(buf);
+}
@@ -6,6 +6,8 @@
 
 #define TPROD			200
 #define TMON			40
+#define TCLK			1000
+#define CLK_RUNTIME		100
 
 #define MSG_COL			21
 #define MSG_LIN			17
@@ -44,24 +46,28 @@ static char *head = buffer;
 static char *tail = buffer;
 static Semaphore_t *buf_used, *buf_free;
 
-static Task_t *prod, *cons, *clk, *mon;
+static Task_t *prod, *cons, *clk;
+static Timer_t *mon;
 
 /* funciones de entrada-salida */
 
+/* Tambien la usa el monitor, desde la interrupcion de tiempo real */
+
 static int 
 mprint(int fg, int x, int y, char *format, ...)
 {
 	int n;
 	va_list args;
+	unsigned flags;
 
-	Atomic();
+	flags = mt_cons_lock();
 	mt_cons_gotoxy(x, y);
 	mt_cons_setattr(fg, BLACK);
 	va_start(args, format);
 	n = vprintk(format, args);
 	va_end(args);
 	mt_cons_clreol();
-	Unatomic();
+	mt_cons_unlock(flags);
 	return n;
 }
 
@@ -112,7 +118,7 @@ clock(void *arg)
 	forever
 	{
 		mprint(CLK_FG, TIME_COL, TIME_LIN, TIME_FMT, seconds);
-		Delay(1000);
+		WaitNextPeriod();
 		++seconds;
 	}
 }
@@ -148,15 +154,13 @@ consumer(void *arg)
 	end_consumer = true;
 }
 
+/* timer periodico */
+
 static void
 monitor(void *args)
 {
-	forever
-	{
-		mprint(MON_FG, PRODSTAT_COL, PRODSTAT_LIN, PRODSTAT_FMT, task_status(prod->state));
-		mprint(MON_FG, CONSSTAT_COL, CONSSTAT_LIN, CONSSTAT_FMT, task_status(cons->state));
-		Delay(TMON);
-	}
+	mprint(MON_FG, PRODSTAT_COL, PRODSTAT_LIN, PRODSTAT_FMT, task_status(prod->state));
+	mprint(MON_FG, CONSSTAT_COL, CONSSTAT_LIN, CONSSTAT_FMT, task_status(cons->state));
 }
 
 int
@@ -176,8 +180,11 @@ prodcons_main(int argc, char **argv)
 
 	Ready(prod = CreateTask(producer, 0, NULL, "Producer", DEFAULT_PRIO));
 	Ready(cons = CreateTask(consumer, 0, NULL, "Consumer", DEFAULT_PRIO));
-	Ready(clk = CreateTask(clock, 0, NULL, "Clock", DEFAULT_PRIO));
-	Ready(mon = CreateTask(monitor, 0, NULL, "Monitor", DEFAULT_PRIO + 1));
+	if ( (clk = CreatePeriodicTask(clock, 0, NULL, "Clock", TCLK, CLK_RUNTIME, 0)) )
+		Ready(clk);
+	else		// rechazada por el control de admision
+		mprint(CLK_FG, TIME_COL, TIME_LIN, MSG_FMT, "Reloj no admitido");
+	StartTimer(mon = CreateTimer(monitor, NULL), TMON, true);
 
 	mprint(MAIN_FG, MSG_COL, MSG_LIN, MSG_FMT, "Oprima S para salir\n");
 	mprint(MAIN_FG, MSG_COL, MSG_LIN+1, MSG_FMT, "Cualquier otra tecla para activar el consumidor");
@@ -186,8 +193,9 @@ prodcons_main(int argc, char **argv)
 		Yield();
 
 	DeleteTask(prod);
-	DeleteTask(clk);
-	DeleteTask(mon);
+	if ( clk )
+		DeleteTask(clk);
+	DeleteTimer(mon);
 	
 	DeleteSem(buf_free);
 	DeleteSem(buf_used);
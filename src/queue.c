@@ -1,6 +1,63 @@
 #include "kernel.h"
 
-static TaskQueue_t time_q;
+#define NUM_PRIOS		(MAX_PRIO + 1)	/* niveles de prioridad */
+#define WORD_BITS		32				/* bits por palabra del mapa */
+#define NUM_WORDS		((NUM_PRIOS + WORD_BITS - 1) / WORD_BITS)
+
+#define TVR_BITS		8				/* bits del primer nivel de la rueda */
+#define TVN_BITS		6				/* bits de los niveles superiores */
+#define TVR_SIZE		(1U << TVR_BITS)
+#define TVN_SIZE		(1U << TVN_BITS)
+#define TVR_MASK		(TVR_SIZE - 1)
+#define TVN_MASK		(TVN_SIZE - 1)
+#define NUM_TVN			4				/* niveles superiores, 8 + 4 * 6 = 32 bits */
+
+/*
+	Las colas de este modulo no tienen locks propios: todas sus funciones se
+	llaman con el lock del kernel tomado (DisableInts() o una interrupcion),
+	porque cambian junto con el estado de las tareas.
+*/
+
+typedef struct							/* cola de ready de una CPU */
+{
+	TaskQueue_t		ready_q[NUM_PRIOS];	/* una cola FIFO por nivel de prioridad */
+	unsigned		ready_map[NUM_WORDS];	/* bit n: cola de prioridad n no vacia */
+	unsigned		ready_summary;		/* bit n: ready_map[n] no nulo */
+	TaskQueue_t		edf_q;				/* tareas periodicas, por plazo */
+	RbTree_t		fair_tree;			/* tareas SchedFair, por vruntime */
+	TaskQueue_t		fair_q;				/* cola de las tareas en fair_tree */
+	unsigned long long	min_vruntime;	/* referencia de la clase SchedFair */
+	unsigned		fair_weight;		/* suma de los pesos en fair_tree */
+	unsigned		count;				/* procesos en la cola */
+}
+RunQueue_t;
+
+#define FAIR_TASK(node)	((Task_t *)((char *)(node) - __builtin_offsetof(Task_t, fair_node)))
+
+static RunQueue_t run_q[MAX_CPUS];
+
+static unsigned wheel_time;				/* proximo tick a procesar en la rueda */
+static unsigned time_count;				/* procesos en la cola de tiempo */
+static TaskQueue_t tv1[TVR_SIZE];		/* primer nivel de la rueda */
+static TaskQueue_t tvn[NUM_TVN][TVN_SIZE];	/* niveles superiores */
+static TaskQueue_t expired_q;			/* procesos vencidos */
+static TaskQueue_t hr_q;				/* procesos por vencer, por TSC */
+
+/* Indice del bit mas significativo de una palabra no nula */
+static inline unsigned
+fls(unsigned x)
+{
+	return WORD_BITS - 1 - __builtin_clz(x);
+}
+
+/* Cola de ready que contiene a una cola, o NULL si no es parte de ninguna */
+static inline RunQueue_t *
+run_q_of(TaskQueue_t *queue)
+{
+	if ( (void *) queue < (void *) run_q || (void *) queue >= (void *)(run_q + MAX_CPUS) )
+		return NULL;
+	return &run_q[((char *) queue - (char *) run_q) / sizeof(RunQueue_t)];
+}
 
 /*
 --------------------------------------------------------------------------------
@@ -55,9 +112,18 @@ void
 mt_dequeue(Task_t *task)
 {
 	TaskQueue_t *queue;
+	RunQueue_t *rq;
 
 	if ( !(queue = task->queue) )
 		return;
+	if ( (rq = run_q_of(queue)) && queue == &rq->fair_q )
+	{
+		mt_rb_erase(&rq->fair_tree, &task->fair_node);
+		rq->fair_weight -= task->weight;
+		rq->count--;
+		task->queue = NULL;
+		return;
+	}
 	if ( task->prev )
 		task->prev->next = task->next;
 	else
@@ -68,6 +134,19 @@ mt_dequeue(Task_t *task)
 		queue->tail = task->prev;
 	task->next = task->prev = NULL;
 	task->queue = NULL;
+
+	/* Si se vacio un nivel de una cola de ready, actualizar el mapa */
+	if ( (rq = run_q_of(queue)) )
+	{
+		rq->count--;
+		if ( !queue->head && queue != &rq->edf_q )
+		{
+			unsigned prio = queue - rq->ready_q;
+
+			if ( !(rq->ready_map[prio / WORD_BITS] &= ~(1U << (prio % WORD_BITS))) )
+				rq->ready_summary &= ~(1U << (prio / WORD_BITS));
+		}
+	}
 }
 
 /*
@@ -104,107 +183,601 @@ mt_getlast(TaskQueue_t *queue)
 
 /*
 --------------------------------------------------------------------------------
-mt_enqueue_time - pone un proceso en la cola de tiempo.
+enqueue_edf - pone una tarea periodica en la cola de ready ordenada por plazo
 
-Los procesos estan ordenados por el tiempo de despertarse, en forma diferencial.
-El campo ticks de cada proceso se usa para almacenar los ticks de tiempo real 
-que transcurren entre que tiempo de despertarse de este proceso y del
-anterior en la cola. El primer proceso a despertar es el primero de la cola, y
-su campo de ticks en un momento determinado indica cuantos ticks le faltan para
-despertarse. La interrupcion de tiempo real decrementa el campo de ticks del
-primer proceso de esta cola. Si el campo llega a cero, despierta a este proceso
-y a todos los que le sigan que tambien tengan el campo de ticks en cero.
+El plazo mas cercano queda al final; entre plazos iguales, la que llego
+antes.
 --------------------------------------------------------------------------------
 */
 
-void 
-mt_enqueue_time(Task_t *task, unsigned ticks)
+static void
+enqueue_edf(Task_t *task, TaskQueue_t *edf_q)
 {
 	Task_t *ta;
 
-	/* Buscar donde insertar */
-	for ( ta = time_q.head ; ta && ticks > ta->ticks ;
-			ticks -= ta->ticks, ta = ta->time_next )
+	for ( ta = edf_q->head ; ta && ta->deadline > task->deadline ; ta = ta->next )
 		;
 	if ( ta )		/* insertar antes de ta */
 	{
-		if ( (task->time_prev = ta->time_prev) )
-			ta->time_prev->time_next = task;
+		if ( (task->prev = ta->prev) )
+			ta->prev->next = task;
 		else
-			time_q.head = task;
-		ta->time_prev = task;
-		task->time_next = ta;
-		ta->ticks -= ticks;
+			edf_q->head = task;
+		ta->prev = task;
+		task->next = ta;
 	}
-	else if ( (ta = time_q.tail) )	/* insertar al final de la cola */
+	else if ( (ta = edf_q->tail) )	/* insertar al final de la cola */
 	{
-		ta->time_next = time_q.tail = task;
-		task->time_prev = ta;
-		task->time_next = NULL;
+		ta->next = edf_q->tail = task;
+		task->prev = ta;
+		task->next = NULL;
 	}
 	else						/* la cola esta vacia */
 	{
-		time_q.head = time_q.tail = task;
-		task->time_next = task->time_prev = NULL;
+		edf_q->head = edf_q->tail = task;
+		task->next = task->prev = NULL;
+	}
+	task->queue = edf_q;
+}
+
+/*
+--------------------------------------------------------------------------------
+enqueue_fair - pone una tarea SchedFair en el arbol de una CPU
+
+El arbol esta ordenado por vruntime; entre iguales, la que llego antes queda
+a la izquierda. El vruntime de la tarea se acota respecto de min_vruntime de
+la CPU: por abajo, para que una tarea que estuvo bloqueada mucho tiempo
+obtenga a lo sumo FAIR_CREDIT_MS de ventaja, y por arriba, para que una que
+viene de otra CPU no espere mas de FAIR_LATENCY_MS.
+--------------------------------------------------------------------------------
+*/
+
+static void
+enqueue_fair(Task_t *task, RunQueue_t *rq)
+{
+	unsigned long long khz = mt_tsc_khz();
+	RbNode_t **link = &rq->fair_tree.root, *parent = NULL;
+
+	if ( task->vruntime + khz * FAIR_CREDIT_MS < rq->min_vruntime )
+		task->vruntime = rq->min_vruntime - khz * FAIR_CREDIT_MS;
+	else if ( task->vruntime > rq->min_vruntime + khz * FAIR_LATENCY_MS )
+		task->vruntime = rq->min_vruntime + khz * FAIR_LATENCY_MS;
+
+	while ( *link )
+	{
+		parent = *link;
+		link = task->vruntime < FAIR_TASK(parent)->vruntime ? &parent->left : &parent->right;
+	}
+	mt_rb_insert(&rq->fair_tree, &task->fair_node, parent, link);
+	rq->fair_weight += task->weight;
+	task->queue = &rq->fair_q;
+}
+
+/*
+--------------------------------------------------------------------------------
+enqueue_ready - pone un proceso en un nivel de la cola de ready de una CPU
+
+Si first es true lo pone al frente del nivel, para que sea el proximo en
+extraerse entre los de su prioridad.
+--------------------------------------------------------------------------------
+*/
+
+static void
+enqueue_ready(Task_t *task, unsigned cpu, bool first)
+{
+	RunQueue_t *rq = &run_q[cpu];
+	unsigned prio = min(task->priority, MAX_PRIO);
+	TaskQueue_t *queue = &rq->ready_q[prio];
+
+	rq->count++;
+	if ( task->period )
+	{
+		enqueue_edf(task, &rq->edf_q);
+		return;
+	}
+	if ( mt_fair(task) )
+	{
+		enqueue_fair(task, rq);
+		return;
+	}
+	if ( first )
+	{
+		if ( (task->prev = queue->tail) )
+			queue->tail->next = task;
+		else
+			queue->head = task;
+		queue->tail = task;
+		task->next = NULL;
+	}
+	else
+	{
+		if ( (task->next = queue->head) )
+			queue->head->prev = task;
+		else
+			queue->tail = task;
+		queue->head = task;
+		task->prev = NULL;
+	}
+	task->queue = queue;
+
+	rq->ready_map[prio / WORD_BITS] |= 1U << (prio % WORD_BITS);
+	rq->ready_summary |= 1U << (prio / WORD_BITS);
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_enqueue_ready - pone un proceso en la cola de ready de una CPU
+
+Cada CPU tiene su propia cola de ready. No es una lista ordenada sino un
+arreglo de colas, una por cada nivel de prioridad, y un mapa de bits que
+indica cuales niveles tienen procesos. Dentro de cada nivel se respeta el
+mismo orden que en mt_enqueue: el proceso se inserta a la cabeza y se extrae
+del final, de modo que entre procesos de la misma prioridad se obtiene primero
+el que llego antes. Insercion y extraccion son de tiempo constante.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_enqueue_ready(Task_t *task, unsigned cpu)
+{
+	enqueue_ready(task, cpu, false);
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_enqueue_ready_first - pone un proceso al frente de su nivel en la cola de
+						 ready de una CPU
+
+Se usa para que un proceso desalojado conserve su turno: es el proximo en
+extraerse entre los de su prioridad.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_enqueue_ready_first(Task_t *task, unsigned cpu)
+{
+	enqueue_ready(task, cpu, true);
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_ready_cpu - CPU en cuya cola de ready esta un proceso
+
+El proceso debe estar en alguna cola de ready.
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+mt_ready_cpu(Task_t *task)
+{
+	return run_q_of(task->queue) - run_q;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_count_ready - cantidad de procesos en la cola de ready de una CPU
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+mt_count_ready(unsigned cpu)
+{
+	return run_q[cpu].count;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_peeklast_ready, mt_getlast_ready - acceso al proximo proceso de la cola
+									  de ready de una CPU
+
+Las tareas periodicas van antes que todas las demas, la de plazo mas
+cercano primero. Si no hay ninguna, corresponde al proceso mas prioritario, o
+al mas viejo entre los de maxima prioridad. Se ubica el nivel mas alto no
+vacio buscando el bit mas significativo del resumen y luego el de la palabra
+correspondiente del mapa. Las tareas SchedFair, la de menor vruntime primero,
+van despues de las de prioridad fija FAIR_PRIO o mayor y antes que las de
+prioridad menor.
+--------------------------------------------------------------------------------
+*/
+
+Task_t *
+mt_peeklast_ready(unsigned cpu)
+{
+	RunQueue_t *rq = &run_q[cpu];
+	unsigned word, prio;
+
+	if ( rq->edf_q.tail )
+		return rq->edf_q.tail;
+	if ( rq->ready_summary )
+	{
+		word = fls(rq->ready_summary);
+		prio = word * WORD_BITS + fls(rq->ready_map[word]);
+		if ( prio >= FAIR_PRIO || !rq->fair_tree.leftmost )
+			return rq->ready_q[prio].tail;
+	}
+	if ( rq->fair_tree.leftmost )
+		return FAIR_TASK(rq->fair_tree.leftmost);
+	return NULL;
+}
+
+Task_t *
+mt_getlast_ready(unsigned cpu)
+{
+	Task_t *task;
+
+	if ( (task = mt_peeklast_ready(cpu)) )
+	{
+		if ( task->queue == &run_q[cpu].fair_q )
+			mt_fair_advance(cpu, task->vruntime);
+		mt_dequeue(task);
+	}
+	return task;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_fair_advance - avanza min_vruntime de una CPU
+
+Se llama con el vruntime de la tarea SchedFair que ejecuta en la CPU o que
+va a ejecutar. min_vruntime nunca retrocede y sigue al menor entre ese
+vruntime y el de la primera tarea del arbol.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_fair_advance(unsigned cpu, unsigned long long vruntime)
+{
+	RunQueue_t *rq = &run_q[cpu];
+	RbNode_t *first;
+
+	if ( (first = rq->fair_tree.leftmost) && FAIR_TASK(first)->vruntime < vruntime )
+		vruntime = FAIR_TASK(first)->vruntime;
+	if ( vruntime > rq->min_vruntime )
+		rq->min_vruntime = vruntime;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_fair_weight - suma de los pesos de las tareas SchedFair en la cola de una
+				 CPU
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+mt_fair_weight(unsigned cpu)
+{
+	return run_q[cpu].fair_weight;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_getlast_ready_for - extrae de la cola de ready de una CPU el proximo
+					   proceso que puede ejecutar en otra
+
+Como mt_getlast_ready, pero saltea los procesos cuya afinidad no incluye a la
+CPU destino. Recorre los niveles no vacios de mayor a menor prioridad,
+pasando por el arbol de las tareas SchedFair, en orden, al llegar debajo de
+FAIR_PRIO.
+--------------------------------------------------------------------------------
+*/
+
+/* Ultimo proceso de una cola que puede ejecutar en las CPUs de mask */
+static Task_t *
+last_allowed(TaskQueue_t *queue, unsigned mask)
+{
+	Task_t *task;
+
+	for ( task = queue->tail ; task && !(task->affinity & mask) ; task = task->prev )
+		;
+	return task;
+}
+
+/* Primera tarea SchedFair de una CPU que puede ejecutar en las CPUs de mask */
+static Task_t *
+fair_allowed(RunQueue_t *rq, unsigned mask)
+{
+	RbNode_t *node;
+
+	for ( node = mt_rb_first(&rq->fair_tree) ; node ; node = mt_rb_next(node) )
+		if ( FAIR_TASK(node)->affinity & mask )
+			return FAIR_TASK(node);
+	return NULL;
+}
+
+Task_t *
+mt_getlast_ready_for(unsigned cpu, unsigned to)
+{
+	RunQueue_t *rq = &run_q[cpu];
+	unsigned mask = 1U << to, word, bits, prio;
+	Task_t *task = last_allowed(&rq->edf_q, mask);
+	bool fair_done = false;
+
+	for ( word = NUM_WORDS ; !task && word-- ; )
+		for ( bits = rq->ready_map[word] ; !task && bits ; bits &= ~(1U << (prio % WORD_BITS)) )
+		{
+			prio = word * WORD_BITS + fls(bits);
+			if ( prio < FAIR_PRIO && !fair_done )
+			{
+				fair_done = true;
+				if ( (task = fair_allowed(rq, mask)) )
+					break;
+			}
+			task = last_allowed(&rq->ready_q[prio], mask);
+		}
+	if ( !task && !fair_done )
+		task = fair_allowed(rq, mask);
+	if ( task )
+		mt_dequeue(task);
+	return task;
+}
+
+/*
+--------------------------------------------------------------------------------
+wheel_add - coloca un proceso en la ranura de la rueda de tiempo que le
+			corresponde segun su tick de vencimiento.
+
+La cola de tiempo es una rueda jerarquica. El primer nivel (tv1) tiene una
+ranura por tick para los vencimientos de los proximos TVR_SIZE ticks; cada
+uno de los niveles siguientes (tvn) cubre un rango TVN_SIZE veces mayor que el
+anterior, con una ranura para cada vuelta completa del nivel inferior.
+Cuando el primer nivel da una vuelta completa, la ranura actual del nivel
+siguiente se redistribuye (cascada) en los niveles inferiores.
+--------------------------------------------------------------------------------
+*/
+
+static void
+wheel_add(Task_t *task)
+{
+	unsigned expires = task->ticks;
+	unsigned delta = expires - wheel_time;
+	unsigned level, shift;
+	TaskQueue_t *slot;
+
+	if ( delta < TVR_SIZE )
+		slot = &tv1[expires & TVR_MASK];
+	else
+	{
+		for ( level = 0, shift = TVR_BITS ; level < NUM_TVN - 1 &&
+				delta >= 1U << (shift + TVN_BITS) ; level++, shift += TVN_BITS )
+			;
+		slot = &tvn[level][(expires >> shift) & TVN_MASK];
+	}
+
+	/* Insertar al final de la ranura */
+	if ( (task->time_prev = slot->tail) )
+		slot->tail->time_next = task;
+	else
+		slot->head = task;
+	slot->tail = task;
+	task->time_next = NULL;
+	task->time_slot = slot;
+}
+
+/*
+--------------------------------------------------------------------------------
+cascade - redistribuye los procesos de una ranura de un nivel superior
+--------------------------------------------------------------------------------
+*/
+
+static void
+cascade(TaskQueue_t *slot)
+{
+	Task_t *task, *next;
+
+	task = slot->head;
+	slot->head = slot->tail = NULL;
+	for ( ; task ; task = next )
+	{
+		next = task->time_next;
+		wheel_add(task);
 	}
-	task->ticks = ticks;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_enqueue_time - pone un proceso en la cola de tiempo.
+
+El campo ticks del proceso almacena el tick absoluto de la rueda en el que
+vence, y el proceso queda en la ranura que corresponde a ese tick. Un proceso 
+encolado con n ticks se despierta en la interrupcion de tiempo real numero 
+n+1 a partir de este momento, lo que garantiza que duerma al menos n ticks 
+completos. La insercion es de tiempo constante.
+--------------------------------------------------------------------------------
+*/
+
+void 
+mt_enqueue_time(Task_t *task, unsigned ticks)
+{
+	task->ticks = wheel_time + ticks;
+	wheel_add(task);
 	task->in_time_q = true;
+	time_count++;
 }
 
 /*
 --------------------------------------------------------------------------------
 mt_dequeue_time - quita un proceso de la cola de tiempo si esta en ella.
+
+El proceso puede estar en una ranura de la rueda, en la lista de vencidos o
+en la cola de alta resolucion; en todos los casos basta desenlazarlo, en 
+tiempo constante.
 --------------------------------------------------------------------------------
 */
 
 void 
 mt_dequeue_time(Task_t *task)
 {
+	TaskQueue_t *slot;
+
 	if ( !task->in_time_q )
 		return;
+	slot = task->time_slot;
 	if ( task->time_prev )
 		task->time_prev->time_next = task->time_next;
 	else
-		time_q.head = task->time_next;
+		slot->head = task->time_next;
 	if ( task->time_next )
-	{
-		task->time_next->ticks += task->ticks;
 		task->time_next->time_prev = task->time_prev;
-	}
 	else
-		time_q.tail = task->time_prev;
+		slot->tail = task->time_prev;
 	task->time_next = task->time_prev = NULL;
+	task->time_slot = NULL;
 	task->in_time_q = false;
+	if ( slot != &hr_q )
+		time_count--;
 }
 
 /*
 --------------------------------------------------------------------------------
-mt_peekfirst_time, mt_getfirst_time - acceso al primer proceso de la cola
-									  de tiempo
+mt_tick_time - avanza la rueda de tiempo un tick
 
-Corresponde al primer proceso a despertar. Mt_peekfirst_time devuelve el
-proceso sin desencolarlo, mt_getfirst_time lo desencola.
+Llamada desde la interrupcion de tiempo real. Si el primer nivel completo una
+vuelta, hace la cascada de los niveles superiores. Luego pasa los procesos de
+la ranura actual a la lista de vencidos, de donde se extraen con
+mt_getfirst_time. El costo amortizado por tick es constante.
 --------------------------------------------------------------------------------
 */
 
-Task_t *
-mt_peekfirst_time(void)
+void
+mt_tick_time(void)
 {
-	return time_q.head;
+	unsigned index = wheel_time & TVR_MASK;
+	unsigned level, shift, n;
+	TaskQueue_t *slot;
+	Task_t *task;
+
+	if ( !index )
+		for ( level = 0, shift = TVR_BITS ; level < NUM_TVN ; level++, shift += TVN_BITS )
+		{
+			cascade(&tvn[level][n = (wheel_time >> shift) & TVN_MASK]);
+			if ( n )
+				break;
+		}
+	wheel_time++;
+
+	/* Pasar la ranura actual al final de la lista de vencidos */
+	slot = &tv1[index];
+	if ( !slot->head )
+		return;
+	if ( (slot->head->time_prev = expired_q.tail) )
+		expired_q.tail->time_next = slot->head;
+	else
+		expired_q.head = slot->head;
+	expired_q.tail = slot->tail;
+	for ( task = slot->head ; task ; task = task->time_next )
+		task->time_slot = &expired_q;
+	slot->head = slot->tail = NULL;
 }
 
+/*
+--------------------------------------------------------------------------------
+mt_getfirst_time - extrae el proximo proceso vencido de la cola de tiempo
+
+Los procesos vencidos se devuelven en el orden en que vencieron. Retorna NULL
+si no queda ninguno.
+--------------------------------------------------------------------------------
+*/
+
 Task_t *
 mt_getfirst_time(void)
 {
 	Task_t *task;
 
-	if ( !(task = time_q.head) )
-		return NULL;
-	if ( (time_q.head = task->time_next) )
-		time_q.head->time_prev = NULL;
-	else
-		time_q.tail = NULL;
-	task->time_prev = task->time_next = NULL;
-	task->in_time_q = false;
+	if ( (task = expired_q.head) )
+		mt_dequeue_time(task);
+	return task;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_next_time - cantidad de ticks hasta el proximo evento de la cola de tiempo
+
+Retorna cero si hay procesos vencidos y FOREVER si la cola esta vacia. El 
+valor es una cota inferior: si el proximo vencimiento esta en un nivel
+superior de la rueda, se retorna la distancia hasta la proxima cascada.
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+mt_next_time(void)
+{
+	unsigned index, n;
+
+	if ( expired_q.head )
+		return 0;
+	if ( !time_count )
+		return FOREVER;
+	if ( !(index = wheel_time & TVR_MASK) )		/* cascada en el proximo tick */
+		return 0;
+	for ( n = 0 ; index + n < TVR_SIZE ; n++ )
+		if ( tv1[index + n].head )
+			return n;
+	return TVR_SIZE - index;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_enqueue_hrtime - pone un proceso en la cola de tiempo de alta resolucion
+
+La cola esta ordenada por el valor del TSC en que vence cada proceso (campo
+timeout), el primero de la cola es el proximo a vencer. Se usa solamente para
+esperas que vencen dentro de los proximos dos ticks; las mas largas pasan
+primero por la rueda de tiempo, asi que esta cola se mantiene corta y la
+insercion ordenada es barata. Para mt_dequeue_time forma parte de la cola de
+tiempo.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_enqueue_hrtime(Task_t *task)
+{
+	Task_t *ta;
+
+	/* Buscar donde insertar, a igual vencimiento queda despues */
+	for ( ta = hr_q.tail ; ta && ta->timeout > task->timeout ; ta = ta->time_prev )
+		;
+	if ( (task->time_prev = ta) )	/* insertar despues de ta */
+	{
+		if ( (task->time_next = ta->time_next) )
+			ta->time_next->time_prev = task;
+		else
+			hr_q.tail = task;
+		ta->time_next = task;
+	}
+	else							/* insertar al principio */
+	{
+		if ( (task->time_next = hr_q.head) )
+			hr_q.head->time_prev = task;
+		else
+			hr_q.tail = task;
+		hr_q.head = task;
+	}
+	task->time_slot = &hr_q;
+	task->in_time_q = true;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_peekfirst_hrtime, mt_getfirst_hrtime - acceso al primer proceso de la cola
+										  de alta resolucion
+
+Corresponde al proximo proceso a vencer. Mt_peekfirst_hrtime devuelve el
+proceso sin desencolarlo, mt_getfirst_hrtime lo desencola.
+--------------------------------------------------------------------------------
+*/
+
+Task_t *
+mt_peekfirst_hrtime(void)
+{
+	return hr_q.head;
+}
+
+Task_t *
+mt_getfirst_hrtime(void)
+{
+	Task_t *task;
+
+	if ( (task = hr_q.head) )
+		mt_dequeue_time(task);
 	return task;
 }
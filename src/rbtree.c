@@ -0,0 +1,280 @@
+#include "kernel.h"
+
+/*
+	Arboles rojo-negro.
+
+	Los nodos se embeben en las estructuras que se ordenan; quien inserta
+	recorre el arbol con su propio criterio de orden y llama a mt_rb_insert
+	con el lugar donde debe quedar el nodo, que luego se rebalancea. El arbol
+	mantiene un puntero al nodo mas a la izquierda (el menor), de modo que
+	obtenerlo es de tiempo constante. Insercion y borrado son O(log n).
+*/
+
+static void
+rotate_left(RbTree_t *tree, RbNode_t *x)
+{
+	RbNode_t *y = x->right;
+
+	if ( (x->right = y->left) )
+		y->left->parent = x;
+	y->parent = x->parent;
+	if ( !x->parent )
+		tree->root = y;
+	else if ( x == x->parent->left )
+		x->parent->left = y;
+	else
+		x->parent->right = y;
+	y->left = x;
+	x->parent = y;
+}
+
+static void
+rotate_right(RbTree_t *tree, RbNode_t *x)
+{
+	RbNode_t *y = x->left;
+
+	if ( (x->left = y->right) )
+		y->right->parent = x;
+	y->parent = x->parent;
+	if ( !x->parent )
+		tree->root = y;
+	else if ( x == x->parent->right )
+		x->parent->right = y;
+	else
+		x->parent->left = y;
+	y->right = x;
+	x->parent = y;
+}
+
+/* Reemplaza el subarbol de u por el de v */
+static void
+transplant(RbTree_t *tree, RbNode_t *u, RbNode_t *v)
+{
+	if ( !u->parent )
+		tree->root = v;
+	else if ( u == u->parent->left )
+		u->parent->left = v;
+	else
+		u->parent->right = v;
+	if ( v )
+		v->parent = u->parent;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_rb_insert - inserta un nodo en un arbol rojo-negro
+
+parent es el nodo del que debe colgar y link el puntero de parent (o la raiz
+del arbol) donde va, obtenidos al recorrer el arbol.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_rb_insert(RbTree_t *tree, RbNode_t *node, RbNode_t *parent, RbNode_t **link)
+{
+	RbNode_t *p, *g, *u;
+
+	node->parent = parent;
+	node->left = node->right = NULL;
+	node->red = true;
+	*link = node;
+	if ( !tree->leftmost || link == &tree->leftmost->left )
+		tree->leftmost = node;
+
+	while ( (p = node->parent) && p->red )
+	{
+		g = p->parent;
+		if ( p == g->left )
+		{
+			if ( (u = g->right) && u->red )
+			{
+				p->red = u->red = false;
+				g->red = true;
+				node = g;
+				continue;
+			}
+			if ( node == p->right )
+			{
+				rotate_left(tree, p);
+				node = p;
+				p = node->parent;
+			}
+			p->red = false;
+			g->red = true;
+			rotate_right(tree, g);
+		}
+		else
+		{
+			if ( (u = g->left) && u->red )
+			{
+				p->red = u->red = false;
+				g->red = true;
+				node = g;
+				continue;
+			}
+			if ( node == p->left )
+			{
+				rotate_right(tree, p);
+				node = p;
+				p = node->parent;
+			}
+			p->red = false;
+			g->red = true;
+			rotate_left(tree, g);
+		}
+	}
+	tree->root->red = false;
+}
+
+/* Rebalanceo despues de quitar un nodo negro; x ocupa su lugar, bajo xp */
+static void
+erase_fixup(RbTree_t *tree, RbNode_t *x, RbNode_t *xp)
+{
+	RbNode_t *w;
+
+	while ( x != tree->root && (!x || !x->red) )
+	{
+		if ( x == xp->left )
+		{
+			w = xp->right;
+			if ( w->red )
+			{
+				w->red = false;
+				xp->red = true;
+				rotate_left(tree, xp);
+				w = xp->right;
+			}
+			if ( (!w->left || !w->left->red) && (!w->right || !w->right->red) )
+			{
+				w->red = true;
+				x = xp;
+				xp = x->parent;
+				continue;
+			}
+			if ( !w->right || !w->right->red )
+			{
+				w->left->red = false;
+				w->red = true;
+				rotate_right(tree, w);
+				w = xp->right;
+			}
+			w->red = xp->red;
+			xp->red = false;
+			w->right->red = false;
+			rotate_left(tree, xp);
+		}
+		else
+		{
+			w = xp->left;
+			if ( w->red )
+			{
+				w->red = false;
+				xp->red = true;
+				rotate_right(tree, xp);
+				w = xp->left;
+			}
+			if ( (!w->left || !w->left->red) && (!w->right || !w->right->red) )
+			{
+				w->red = true;
+				x = xp;
+				xp = x->parent;
+				continue;
+			}
+			if ( !w->left || !w->left->red )
+			{
+				w->right->red = false;
+				w->red = true;
+				rotate_left(tree, w);
+				w = xp->left;
+			}
+			w->red = xp->red;
+			xp->red = false;
+			w->left->red = false;
+			rotate_right(tree, xp);
+		}
+		x = tree->root;
+	}
+	if ( x )
+		x->red = false;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_rb_erase - quita un nodo de un arbol rojo-negro
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_rb_erase(RbTree_t *tree, RbNode_t *node)
+{
+	RbNode_t *y, *x, *xp;
+	bool red = node->red;
+
+	if ( tree->leftmost == node )
+		tree->leftmost = mt_rb_next(node);
+
+	if ( !node->left )
+	{
+		x = node->right;
+		xp = node->parent;
+		transplant(tree, node, x);
+	}
+	else if ( !node->right )
+	{
+		x = node->left;
+		xp = node->parent;
+		transplant(tree, node, x);
+	}
+	else
+	{
+		for ( y = node->right ; y->left ; y = y->left )
+			;
+		red = y->red;
+		x = y->right;
+		if ( y->parent == node )
+			xp = y;
+		else
+		{
+			xp = y->parent;
+			transplant(tree, y, x);
+			y->right = node->right;
+			y->right->parent = y;
+		}
+		transplant(tree, node, y);
+		y->left = node->left;
+		y->left->parent = y;
+		y->red = node->red;
+	}
+	node->parent = node->left = node->right = NULL;
+
+	if ( !red )
+		erase_fixup(tree, x, xp);
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_rb_first, mt_rb_next - recorrido en orden
+--------------------------------------------------------------------------------
+*/
+
+RbNode_t *
+mt_rb_first(RbTree_t *tree)
+{
+	return tree->leftmost;
+}
+
+RbNode_t *
+mt_rb_next(RbNode_t *node)
+{
+	RbNode_t *p;
+
+	if ( node->right )
+	{
+		for ( node = node->right ; node->left ; node = node->left )
+			;
+		return node;
+	}
+	while ( (p = node->parent) && node == p->right )
+		node = p;
+	return p;
+}
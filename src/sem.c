@@ -1,5 +1,16 @@
 #include "kernel.h"
 
+/*
+	La cuenta de cada semaforo esta protegida por un spinlock propio, de modo
+	que WaitSem y SignalSem no toman el lock del kernel cuando no hace falta
+	bloquear ni despertar a nadie. Si hay que hacerlo, se toma primero el lock
+	del kernel y despues el del semaforo. Los semaforos con herencia de
+	prioridad (mutexes y monitores) usan siempre el lock del kernel, porque
+	registran al dueño.
+	Ademas de tareas, en un semaforo pueden esperar fibers (ver fiber.c), en
+	una lista propia. SignalSem despierta primero a las tareas.
+*/
+
 /*
 --------------------------------------------------------------------------------
 CreateSem - aloca un semaforo y establece su cuenta inicial
@@ -12,6 +23,8 @@ Semaphore_t *CreateSem(char *name, unsigned value)
 
 	sem->queue = CreateQueue(name);
 	sem->value = value;
+	mt_spin_init(&sem->lock, sem->queue->name);
+	mt_spin_register(&sem->lock);
 	return sem;
 }
 
@@ -24,17 +37,19 @@ DeleteSem - da de baja un semaforo
 void
 DeleteSem(Semaphore_t *sem)
 {
+	FlushSem(sem, false);
+	mt_spin_unregister(&sem->lock);
 	DeleteQueue(sem->queue);
 	Free(sem);
 }
 
 /*
 --------------------------------------------------------------------------------
-WaitSem, WaitSemCond, WaitSemTimed - esperar en un semaforo
+WaitSem, WaitSemCond, WaitSemTimed, WaitSemTimedUs - esperar en un semaforo
 
 WaitSem espera indefinidamente, WaitSemCond retorna inmediatamente y
-WaitSemTimed espera con timeout. El valor de retorno indica si se consumio
-un evento del semaforo.
+WaitSemTimed espera con timeout (WaitSemTimedUs en microsegundos). El valor
+de retorno indica si se consumio un evento del semaforo.
 --------------------------------------------------------------------------------
 */
 
@@ -53,13 +68,45 @@ WaitSemCond(Semaphore_t *sem)
 bool
 WaitSemTimed(Semaphore_t *sem, unsigned msecs)
 {
+	return mt_wait_sem(sem, mt_timeout_ms(msecs));
+}
+
+bool
+WaitSemTimedUs(Semaphore_t *sem, unsigned usecs)
+{
+	return mt_wait_sem(sem, mt_timeout_us(usecs));
+}
+
+bool
+mt_wait_sem(Semaphore_t *sem, unsigned long long usecs)
+{
+	unsigned flags;
 	bool success;
 
+	/* Camino rapido: hay eventos y no hay que registrar al dueño */
+	if ( !sem->queue->inherit )
+	{
+		flags = mt_spin_lock_irqsave(&sem->lock);
+		if ( sem->value > 0 )
+		{
+			sem->value--;
+			mt_spin_unlock_irqrestore(&sem->lock, flags);
+			return true;
+		}
+		mt_spin_unlock_irqrestore(&sem->lock, flags);
+	}
+
 	DisableInts();
+	mt_spin_lock(&sem->lock);
 	if ( (success = (sem->value > 0)) )
+	{
 		sem->value--;
+		mt_spin_unlock(&sem->lock);
+		if ( sem->queue->inherit )
+			mt_set_owner(sem->queue, mt_curr_task);
+	}
 	else
-		success = WaitQueueTimed(sem->queue, msecs);
+		success = mt_wait_queue_unlock(sem->queue, usecs, &sem->lock);
 	RestoreInts();
 
 	return success;
@@ -69,17 +116,43 @@ WaitSemTimed(Semaphore_t *sem, unsigned msecs)
 --------------------------------------------------------------------------------
 SignalSem - senaliza un semaforo
 
-Despierta al primer proceso de la cola o incrementa la cuenta si la cola
-esta vacia.
+Despierta al primer proceso de la cola (o que la espera en WaitMultiple), o a
+la primera fiber que espera si no hay procesos, o incrementa la cuenta si no
+espera nadie. Las tareas solo entran y salen de la cola con el lock del kernel
+tomado, asi que si hay alguna esperando sigue ahi al llamar a SignalQueue, que
+se hace sin el lock del semaforo porque puede cambiar de contexto.
 --------------------------------------------------------------------------------
 */
 
 void
 SignalSem(Semaphore_t *sem)
 {
+	unsigned flags;
+	bool waiting;
+	Fiber_t *fiber = NULL;
+
+	/* Camino rapido: nadie espera */
+	if ( !sem->queue->inherit )
+	{
+		flags = mt_spin_lock_irqsave(&sem->lock);
+		if ( !mt_waiting(sem->queue) && !sem->fiber_head )
+		{
+			sem->value++;
+			mt_spin_unlock_irqrestore(&sem->lock, flags);
+			return;
+		}
+		mt_spin_unlock_irqrestore(&sem->lock, flags);
+	}
+
 	DisableInts();
-	if ( !SignalQueue(sem->queue) )
+	mt_spin_lock(&sem->lock);
+	if ( !(waiting = mt_waiting(sem->queue)) && !(fiber = mt_fiber_dequeue(sem)) )
 		sem->value++;
+	mt_spin_unlock(&sem->lock);
+	if ( waiting )
+		SignalQueue(sem->queue);
+	else if ( fiber )
+		mt_fiber_wakeup(fiber, true);
 	RestoreInts();
 }
 
@@ -99,16 +172,29 @@ ValueSem(Semaphore_t *sem)
 --------------------------------------------------------------------------------
 FlushSem - despierta todos los procesos que esperan en un semaforo
 
-Los procesos completan su WaitSem() con el status que se pasa como argumento.
-Deja la cuenta en cero.
+Los procesos completan su WaitSem() con el status que se pasa como argumento,
+y las fibers que esperan su FiberWaitSem(). Deja la cuenta en cero.
 --------------------------------------------------------------------------------
 */
 
 void
 FlushSem(Semaphore_t *sem, bool wait_ok)
 {
+	Fiber_t *fiber;
+
 	DisableInts();
+	mt_spin_lock(&sem->lock);
 	sem->value = 0;
+	mt_spin_unlock(&sem->lock);
 	FlushQueue(sem->queue, wait_ok);
+	do
+	{
+		mt_spin_lock(&sem->lock);
+		fiber = mt_fiber_dequeue(sem);
+		mt_spin_unlock(&sem->lock);
+		if ( fiber )
+			mt_fiber_wakeup(fiber, wait_ok);
+	}
+	while ( fiber );
 	RestoreInts();
 }
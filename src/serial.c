@@ -0,0 +1,86 @@
+#include "kernel.h"
+
+/*
+	Puerto serie COM1 en modo encuesta, solo salida.
+
+	Se usa para exportar datos de diagnóstico a otra máquina (o al emulador)
+	sin depender de la consola. No usa interrupciones.
+*/
+
+#define COM1			0x3F8
+#define DATA(p)			(p)				// datos / divisor LSB
+#define IER(p)			((p) + 1)		// habilitación de interrupciones / divisor MSB
+#define FCR(p)			((p) + 2)		// control de FIFO
+#define LCR(p)			((p) + 3)		// control de línea
+#define MCR(p)			((p) + 4)		// control de modem
+#define LSR(p)			((p) + 5)		// estado de línea
+#define SCRATCH(p)		((p) + 7)
+
+#define LCR_8N1			0x03
+#define LCR_DLAB		0x80			// acceso al divisor
+#define FCR_ENABLE		0xC7			// habilitar y limpiar FIFOs
+#define MCR_DTR_RTS		0x03
+#define LSR_THRE		0x20			// registro de transmisión vacío
+
+#define BASE_BAUD		115200
+
+static bool present;
+
+/*
+--------------------------------------------------------------------------------
+mt_serial_init - inicializa COM1 a la velocidad indicada, 8N1
+
+Retorna false si no hay UART.
+--------------------------------------------------------------------------------
+*/
+
+bool
+mt_serial_init(unsigned baud)
+{
+	unsigned divisor = BASE_BAUD / baud;
+
+	/* verificar que haya una UART */
+	outb(SCRATCH(COM1), 0x5A);
+	if ( inb(SCRATCH(COM1)) != 0x5A )
+		return present = false;
+
+	outb(IER(COM1), 0);
+	outb(LCR(COM1), LCR_DLAB);
+	outb(DATA(COM1), divisor & 0xFF);
+	outb(IER(COM1), divisor >> 8);
+	outb(LCR(COM1), LCR_8N1);
+	outb(FCR(COM1), FCR_ENABLE);
+	outb(MCR(COM1), MCR_DTR_RTS);
+	return present = true;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_serial_putc - envía un caracter, esperando que el transmisor esté libre
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_serial_putc(char ch)
+{
+	if ( !present )
+		return;
+	if ( ch == '\n' )
+		mt_serial_putc('\r');
+	while ( !(inb(LSR(COM1)) & LSR_THRE) )
+		;
+	outb(DATA(COM1), ch);
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_serial_puts - envía una cadena
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_serial_puts(const char *str)
+{
+	while ( *str )
+		mt_serial_putc(*str++);
+}
@@ -22,6 +22,18 @@ cmdtab[] =
 	{	"camino_ns",	camino_ns_main },
 	{	"prodcons",		prodcons_main },
 	{	"divz",			divz_main },
+	{	"top",			top_main },
+	{	"ps",			ps_main },
+	{	"trace",		ktrace_main },
+	{	"locks",		locks_main },
+	{	"pools",		pools_main },
+	{	"ipcbench",	ipcbench_main },
+	{	"affinity",	affinity_main },
+	{	"bench",		bench_main },
+	{	"fibers",		fibers_main },
+	{	"stacks",		stacks_main },
+	{	"waitmulti",	waitmulti_main },
+	{	"irqstat",		irqstat_main },
 	{ }
 };
 
@@ -0,0 +1,261 @@
+#include "kernel.h"
+
+/*
+	Multiprocesamiento: descubrimiento y arranque de los procesadores.
+
+	Los procesadores se obtienen de la tabla MADT de ACPI o, si no existe, de
+	las tablas MP de Intel. Los secundarios (APs) se arrancan de a uno con la
+	secuencia INIT-SIPI-SIPI: empiezan en modo real en el código de
+	smpboot.asm, copiado a AP_TRAMPOLINE, que pasa a modo protegido y salta a
+	mt_ap_main() con el stack que se le indica en mt_ap_stack.
+*/
+
+#define EBDA_SEG		0x40E			// segmento del EBDA, en el área del BIOS
+#define BASE_MEM_END	0xA0000
+#define BIOS_START		0xE0000
+#define BIOS_END		0x100000
+
+#define MADT_CPU		0				// entrada MADT: APIC local
+#define MP_CPU			0				// entrada MP: procesador
+#define MP_CPU_SIZE		20
+#define MP_ENTRY_SIZE	8				// resto de las entradas MP
+#define CPU_ENABLED		1
+
+#define AP_TIMEOUT_MS	100				// espera de arranque de cada AP
+
+#pragma pack(push, 1)
+
+typedef struct							// ACPI: puntero a la RSDT
+{
+	char			signature[8];		// "RSD PTR "
+	unsigned char	checksum;
+	char			oem[6];
+	unsigned char	revision;
+	unsigned		rsdt;
+}
+Rsdp_t;
+
+typedef struct							// ACPI: encabezado de las tablas
+{
+	char			signature[4];
+	unsigned		length;
+	unsigned char	revision;
+	unsigned char	checksum;
+	char			oem[6];
+	char			oem_table[8];
+	unsigned		oem_revision;
+	unsigned		creator;
+	unsigned		creator_revision;
+}
+AcpiHeader_t;
+
+typedef struct							// ACPI: tabla MADT ("APIC")
+{
+	AcpiHeader_t	header;
+	unsigned		lapic_addr;
+	unsigned		flags;
+	unsigned char	entries[];
+}
+Madt_t;
+
+typedef struct							// MP: puntero flotante
+{
+	char			signature[4];		// "_MP_"
+	unsigned		config;
+	unsigned char	length;
+	unsigned char	revision;
+	unsigned char	checksum;
+	unsigned char	features[5];
+}
+MpFloat_t;
+
+typedef struct							// MP: tabla de configuración
+{
+	char			signature[4];		// "PCMP"
+	unsigned short	length;
+	unsigned char	revision;
+	unsigned char	checksum;
+	char			oem[20];
+	unsigned		oem_table;
+	unsigned short	oem_size;
+	unsigned short	count;
+	unsigned		lapic_addr;
+	unsigned short	ext_length;
+	unsigned char	ext_checksum;
+	unsigned char	reserved;
+	unsigned char	entries[];
+}
+MpConfig_t;
+
+#pragma pack(pop)
+
+Cpu_t mt_cpus[MAX_CPUS];
+unsigned mt_ncpus = 1;
+
+// Parámetros para el AP que está arrancando, usados por smpboot.asm
+unsigned mt_ap_stack;
+static Cpu_t *ap_cpu;
+
+extern char mt_ap_trampoline[], mt_ap_trampoline_end[];
+
+static bool
+checksum(void *p, unsigned len)
+{
+	unsigned char *s = p, sum = 0;
+
+	while ( len-- )
+		sum += *s++;
+	return sum == 0;
+}
+
+/* Buscar una estructura con firma alineada a 16 bytes */
+static void *
+scan(unsigned start, unsigned end, const char *sig, unsigned len)
+{
+	for ( ; start + 16 <= end ; start += 16 )
+		if ( strncmp((void *) start, sig, len) == 0 && checksum((void *) start, 16) )
+			return (void *) start;
+	return NULL;
+}
+
+static void *
+scan_bios(const char *sig, unsigned len)
+{
+	unsigned ebda = *(unsigned short *) EBDA_SEG << 4;
+	void *p = NULL;
+
+	if ( ebda )
+		p = scan(ebda, ebda + 1024, sig, len);
+	if ( !p )
+		p = scan(BASE_MEM_END - 1024, BASE_MEM_END, sig, len);
+	if ( !p )
+		p = scan(BIOS_START, BIOS_END, sig, len);
+	return p;
+}
+
+/* Procesadores según la MADT de ACPI */
+static unsigned
+acpi_cpus(unsigned apic_ids[], unsigned max)
+{
+	Rsdp_t *rsdp;
+	AcpiHeader_t *rsdt, *h;
+	Madt_t *madt = NULL;
+	unsigned *tables;
+	unsigned char *e, *end;
+	unsigned i, n = 0;
+
+	if ( !(rsdp = scan_bios("RSD PTR ", 8)) || !checksum(rsdp, sizeof(Rsdp_t)) )
+		return 0;
+	rsdt = (AcpiHeader_t *) rsdp->rsdt;
+	if ( strncmp(rsdt->signature, "RSDT", 4) || !checksum(rsdt, rsdt->length) )
+		return 0;
+
+	tables = (unsigned *)(rsdt + 1);
+	for ( i = 0 ; i < (rsdt->length - sizeof(AcpiHeader_t)) / 4 ; i++ )
+	{
+		h = (AcpiHeader_t *) tables[i];
+		if ( strncmp(h->signature, "APIC", 4) == 0 && checksum(h, h->length) )
+		{
+			madt = (Madt_t *) h;
+			break;
+		}
+	}
+	if ( !madt )
+		return 0;
+
+	end = (unsigned char *) madt + madt->header.length;
+	for ( e = madt->entries ; e < end && e[1] && n < max ; e += e[1] )
+		if ( e[0] == MADT_CPU && (*(unsigned *)(e + 4) & CPU_ENABLED) )
+			apic_ids[n++] = e[3];
+	return n;
+}
+
+/* Procesadores según las tablas MP */
+static unsigned
+mp_cpus(unsigned apic_ids[], unsigned max)
+{
+	MpFloat_t *mpf;
+	MpConfig_t *cfg;
+	unsigned char *e;
+	unsigned i, n = 0;
+
+	if ( !(mpf = scan_bios("_MP_", 4)) || !mpf->config )
+		return 0;
+	cfg = (MpConfig_t *) mpf->config;
+	if ( strncmp(cfg->signature, "PCMP", 4) || !checksum(cfg, cfg->length) )
+		return 0;
+
+	for ( i = 0, e = cfg->entries ; i < cfg->count && n < max ; i++ )
+		if ( e[0] == MP_CPU )
+		{
+			if ( e[3] & CPU_ENABLED )
+				apic_ids[n++] = e[1];
+			e += MP_CPU_SIZE;
+		}
+		else
+			e += MP_ENTRY_SIZE;
+	return n;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_smp_discover - obtiene los identificadores de APIC de los procesadores
+
+Retorna la cantidad de procesadores habilitados, incluyendo el actual, o cero
+si no hay tablas que los describan.
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+mt_smp_discover(unsigned apic_ids[], unsigned max)
+{
+	unsigned n;
+
+	if ( !(n = acpi_cpus(apic_ids, max)) )
+		n = mp_cpus(apic_ids, max);
+	return n;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_start_ap - arranca un procesador secundario
+
+La estructura de la CPU debe estar inicializada, con su tarea nula creada: el
+AP arranca en el stack de la tarea nula. Retorna false si el procesador no
+respondio.
+--------------------------------------------------------------------------------
+*/
+
+bool
+mt_start_ap(Cpu_t *cpu)
+{
+	unsigned i;
+
+	memcpy((void *) AP_TRAMPOLINE, mt_ap_trampoline, mt_ap_trampoline_end - mt_ap_trampoline);
+	ap_cpu = cpu;
+	mt_ap_stack = cpu->null_task->esp;
+	mt_lapic_init_sipi(cpu->apic_id, AP_TRAMPOLINE >> 12);
+	for ( i = 0 ; i < AP_TIMEOUT_MS && !cpu->online ; i++ )
+		mt_timer_busywait(1);
+	return cpu->online;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_ap_main - punto de entrada en C de los procesadores secundarios
+
+Carga las tablas de descriptores y el segmento de datos de la CPU, inicializa
+su APIC local y pasa a ejecutar su tarea nula. No retorna.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_ap_main(void)
+{
+	Cpu_t *cpu = ap_cpu;
+
+	mt_load_gdt_idt();
+	mt_load_fs(mt_cpu_segment(cpu->id, cpu));
+	mt_setup_apic_ap();
+	mt_ap_start(cpu);
+}
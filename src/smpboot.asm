@@ -0,0 +1,56 @@
+; Código de arranque de los procesadores secundarios.
+; Se copia a AP_TRAMPOLINE, por debajo de 1 MB, y el procesador lo ejecuta en
+; modo real al recibir STARTUP (CS = AP_TRAMPOLINE >> 4, IP = 0). Carga una
+; GDT provisoria con los mismos selectores que la definitiva, pasa a modo
+; protegido y salta a mt_ap_main() en el stack indicado en mt_ap_stack.
+; Todas las direcciones dentro de este código se calculan relativas a
+; AP_TRAMPOLINE, porque no se ejecuta donde fue linkeado.
+
+AP_TRAMPOLINE equ 0x8000		; mantener sincronizado con kernel.h
+
+%define REL(x) (AP_TRAMPOLINE + (x) - mt_ap_trampoline)
+
+global mt_ap_trampoline
+global mt_ap_trampoline_end
+
+extern mt_ap_stack
+extern mt_ap_main
+
+section .text
+
+bits 16
+
+mt_ap_trampoline:
+	cli
+	xor ax, ax
+	mov ds, ax
+	o32 lgdt [REL(tr_gdtr)]
+	mov eax, cr0
+	and eax, 0x9FFFFFFF			; habilitar cache (CD = NW = 0)
+	or eax, 1					; modo protegido
+	mov cr0, eax
+	jmp dword 0x08:REL(tr_32)
+
+bits 32
+
+tr_32:
+	mov ax, 0x10
+	mov ds, ax
+	mov es, ax
+	mov fs, ax
+	mov gs, ax
+	mov ss, ax
+	mov esp, [mt_ap_stack]
+	mov eax, mt_ap_main			; dirección absoluta, fuera del trampolín
+	jmp eax
+
+align 8
+tr_gdt:
+	dq 0						; descriptor nulo
+	dq 0x00CF9A000000FFFF		; código, base 0, 4 GB (0x08)
+	dq 0x00CF92000000FFFF		; datos, base 0, 4 GB (0x10)
+tr_gdtr:
+	dw tr_gdtr - tr_gdt - 1
+	dd REL(tr_gdt)
+
+mt_ap_trampoline_end:
@@ -0,0 +1,131 @@
+#include "kernel.h"
+
+/*
+	Softirqs: trabajo diferido de los manejadores de interrupcion.
+
+	Un manejador de interrupcion hace lo minimo con la interrupcion
+	deshabilitada y deja el resto pendiente con mt_raise_softirq(). Las
+	softirqs pendientes de cada CPU se ejecutan al salir de la interrupcion
+	de primer nivel, en common_handler (interrupts.asm), despues del EOI y
+	antes de mt_select_task(), con interrupciones habilitadas y en el stack
+	de interrupciones: no cambian de contexto ni cuestan un despertar de
+	tarea. Una interrupcion que llega mientras ejecutan se atiende como
+	anidada y las softirqs que marque se ejecutan en la misma pasada.
+	Como las interrupciones de primer nivel, ejecutan con el lock del kernel
+	tomado y no pueden bloquearse. Las softirqs de una CPU no se interrumpen
+	entre si, pero si pueden ser interrumpidas por los manejadores: los datos
+	que compartan con ellos deben accederse con interrupciones deshabilitadas.
+	Si los manejadores siguen marcando softirqs, despues de MAX_RESTART
+	pasadas el resto queda para la proxima interrupcion.
+*/
+
+#define MAX_RESTART		8
+
+typedef struct
+{
+	softirq_handler	handler;
+	HandlerStats_t	stats;
+}
+Softirq_t;
+
+static Softirq_t softirqs[NUM_SOFTIRQS];
+
+/*
+--------------------------------------------------------------------------------
+mt_set_softirq - registra el manejador de una softirq
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_set_softirq(unsigned num, const char *name, softirq_handler handler)
+{
+	Softirq_t *s = &softirqs[num];
+
+	DisableInts();
+	s->handler = handler;
+	s->stats.num = num;
+	s->stats.name = name;
+	RestoreInts();
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_raise_softirq - marca una softirq como pendiente en la CPU actual
+
+Normalmente se llama desde un manejador de interrupcion; desde una tarea, la
+softirq se ejecuta al salir de la proxima interrupcion de esta CPU.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_raise_softirq(unsigned num)
+{
+	unsigned flags = mt_irqsave();
+
+	mt_this_cpu()->softirq_pending |= 1 << num;
+	mt_irqrestore(flags);
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_do_softirqs - ejecuta las softirqs pendientes de la CPU actual
+
+Llamada desde common_handler con interrupciones deshabilitadas al terminar
+una interrupcion de primer nivel, y retorna con interrupciones
+deshabilitadas. No hace nada si la tarea interrumpida estaba en una seccion
+critica (una excepcion con interrupciones deshabilitadas): las softirqs
+quedan pendientes. Cada manejador se llama con interrupciones habilitadas;
+sus secciones DisableInts()/RestoreInts() las vuelven a habilitar al salir.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_do_softirqs(void)
+{
+	Cpu_t *cpu = mt_this_cpu();
+	unsigned pending, num, restarts = 0, cycles;
+	unsigned long long start;
+	Softirq_t *s;
+
+	if ( cpu->int_level != 1 || mt_curr_task->disint_level != 1 )
+		return;
+
+	while ( (pending = cpu->softirq_pending) && restarts++ < MAX_RESTART )
+	{
+		cpu->softirq_pending = 0;
+		for ( num = 0 ; pending ; num++, pending >>= 1 )
+		{
+			if ( !(pending & 1) || !(s = &softirqs[num])->handler )
+				continue;
+			mt_sti();
+			start = mt_rdtsc();
+			s->handler();
+			cycles = mt_rdtsc() - start;
+			s->stats.count++;
+			s->stats.cycles += cycles;
+			s->stats.max_cycles = max(s->stats.max_cycles, cycles);
+		}
+		mt_cli();
+	}
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_softirq_stats - copia los contadores de las softirqs registradas
+
+Retorna la cantidad de softirqs copiadas, a lo sumo max.
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+mt_softirq_stats(HandlerStats_t stats[], unsigned max)
+{
+	unsigned i, n = 0;
+
+	DisableInts();
+	for ( i = 0 ; i < NUM_SOFTIRQS && n < max ; i++ )
+		if ( softirqs[i].handler )
+			stats[n++] = softirqs[i].stats;
+	RestoreInts();
+	return n;
+}
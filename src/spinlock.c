@@ -0,0 +1,184 @@
+#include "kernel.h"
+
+/*
+	Spinlocks de tickets.
+
+	Cada CPU que quiere el lock toma un número con un incremento atómico y
+	espera a que el lock atienda ese número, de modo que se entregan en orden
+	de llegada. Las variantes irqsave deshabilitan además las interrupciones
+	de la CPU local, y deben usarse para los locks que también se toman desde
+	interrupciones.
+	Cada lock lleva la cuenta de cuántas veces se tomó, cuántas hubo que
+	esperar y los ciclos del TSC que se esperó y que estuvo tomado. Los que se
+	registran aparecen en la lista que muestra el comando locks.
+*/
+
+static Spinlock_t *spin_list;			/* locks registrados */
+static Spinlock_t list_lock;			/* protege la lista */
+
+/*
+--------------------------------------------------------------------------------
+mt_spin_init - inicializa un spinlock, libre y con estadisticas en cero
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_spin_init(Spinlock_t *lock, const char *name)
+{
+	memset(lock, 0, sizeof(Spinlock_t));
+	lock->name = name;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_spin_register, mt_spin_unregister - agrega o quita un lock de la lista
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_spin_register(Spinlock_t *lock)
+{
+	unsigned flags = mt_spin_lock_irqsave(&list_lock);
+
+	lock->list_next = spin_list;
+	spin_list = lock;
+	mt_spin_unlock_irqrestore(&list_lock, flags);
+}
+
+void
+mt_spin_unregister(Spinlock_t *lock)
+{
+	unsigned flags = mt_spin_lock_irqsave(&list_lock);
+	Spinlock_t **p;
+
+	for ( p = &spin_list ; *p ; p = &(*p)->list_next )
+		if ( *p == lock )
+		{
+			*p = lock->list_next;
+			break;
+		}
+	mt_spin_unlock_irqrestore(&list_lock, flags);
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_spin_lock, mt_spin_unlock - toma y libera un spinlock
+
+No modifican el estado de las interrupciones: si el lock puede tomarse desde
+una interrupcion, hay que llamarlas con interrupciones deshabilitadas o usar
+las variantes irqsave.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_spin_lock(Spinlock_t *lock)
+{
+	unsigned ticket = __sync_fetch_and_add(&lock->next, 1);
+	unsigned long long start;
+
+	if ( lock->serving != ticket )
+	{
+		start = mt_rdtsc();
+		while ( lock->serving != ticket )
+			mt_pause();
+		lock->contended++;
+		lock->spin_cycles += mt_rdtsc() - start;
+	}
+	lock->count++;
+	lock->acquired = mt_rdtsc();
+}
+
+void
+mt_spin_unlock(Spinlock_t *lock)
+{
+	unsigned long long held = mt_rdtsc() - lock->acquired;
+
+	lock->hold_cycles += held;
+	if ( held > lock->max_hold )
+		lock->max_hold = held;
+	__sync_synchronize();
+	lock->serving++;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_spin_lock_irqsave, mt_spin_unlock_irqrestore - spinlock con interrupciones
+												  deshabilitadas
+
+mt_spin_lock_irqsave deshabilita las interrupciones antes de tomar el lock y
+retorna el estado anterior, que se pasa a mt_spin_unlock_irqrestore para
+reponerlo despues de liberarlo.
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+mt_spin_lock_irqsave(Spinlock_t *lock)
+{
+	unsigned flags = mt_irqsave();
+
+	mt_spin_lock(lock);
+	return flags;
+}
+
+void
+mt_spin_unlock_irqrestore(Spinlock_t *lock, unsigned flags)
+{
+	mt_spin_unlock(lock);
+	mt_irqrestore(flags);
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_spin_stats - copia los locks registrados, con sus estadisticas
+
+Retorna la cantidad de locks copiados, a lo sumo max. El nombre se copia con
+la lista tomada, porque el de un lock que se quita despues puede liberarse
+(el de un semaforo es el de su cola).
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+mt_spin_stats(LockStats_t stats[], unsigned max)
+{
+	unsigned flags = mt_spin_lock_irqsave(&list_lock);
+	Spinlock_t *lock;
+	LockStats_t *st;
+	unsigned n = 0;
+
+	for ( lock = spin_list ; lock && n < max ; lock = lock->list_next )
+	{
+		st = &stats[n++];
+		strncpy(st->name, lock->name ? lock->name : "", LOCK_NAME_SIZE - 1);
+		st->name[LOCK_NAME_SIZE - 1] = 0;
+		st->count = lock->count;
+		st->contended = lock->contended;
+		st->spin_cycles = lock->spin_cycles;
+		st->hold_cycles = lock->hold_cycles;
+		st->max_hold = lock->max_hold;
+	}
+	mt_spin_unlock_irqrestore(&list_lock, flags);
+	return n;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_spin_reset_stats - pone en cero las estadisticas de los locks registrados
+
+No toma cada lock: los valores de uno que este en uso pueden quedar
+inconsistentes hasta la proxima vez que se lo tome.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_spin_reset_stats(void)
+{
+	unsigned flags = mt_spin_lock_irqsave(&list_lock);
+	Spinlock_t *lock;
+
+	for ( lock = spin_list ; lock ; lock = lock->list_next )
+	{
+		lock->count = lock->contended = 0;
+		lock->spin_cycles = lock->hold_cycles = lock->max_hold = 0;
+	}
+	mt_spin_unlock_irqrestore(&list_lock, flags);
+}
@@ -0,0 +1,262 @@
+#include "kernel.h"
+
+/*
+	Uso de los stacks de las tareas.
+
+	Mientras la medicion o el aprendizaje estan habilitados (ver
+	SetStackTracking y SetStackLearning), CreateTask llena cada stack nuevo
+	con STACK_PAINT. Como el stack crece hacia abajo, la cantidad usada es lo
+	que hay desde la primera palabra que ya no tiene el relleno, contando
+	desde el fondo, hasta el tope: es el maximo que uso la tarea hasta ahora
+	(high-watermark), no lo que usa en este momento. El relleno recorre el
+	stack entero, hasta 64 KB, en cada creacion, y anula la ventaja de tomar
+	del pool un stack sin borrarlo; por eso esta deshabilitado por omision y
+	el uso de las tareas creadas sin relleno no se conoce.
+	Al liberarse una tarea medida se registra su maximo bajo su nombre, en
+	una tabla de a lo sumo LEARN_MAX nombres. Si el aprendizaje esta
+	habilitado (ver SetStackLearning), las tareas que se crean despues con
+	ese nombre y sin pedir un stack mayor que el minimo reciben el maximo
+	registrado mas STACK_MARGIN, en lugar de MIN_STACK. El tamaño aprendido
+	solo es tan bueno como las ejecuciones que se midieron: una tarea que
+	alguna vez recorre un camino mas profundo que los registrados puede
+	desbordar su stack.
+*/
+
+#define LEARN_MAX		64				// nombres en la tabla
+
+typedef struct
+{
+	char			name[STACK_NAME_SIZE];
+	unsigned		max_used;
+	unsigned		samples;
+}
+Learned_t;
+
+static Learned_t learned[LEARN_MAX];
+static Spinlock_t learn_lock;
+static bool learning;
+static bool tracking;
+
+/* Entrada de la tabla para un nombre; si create es true, la agrega si falta */
+static Learned_t *
+lookup(char *name, bool create)
+{
+	unsigned h = 0, i;
+	char *p;
+	Learned_t *l;
+
+	for ( p = name ; *p && p < name + STACK_NAME_SIZE - 1 ; p++ )
+		h = h * 31 + *p;
+	for ( i = 0 ; i < LEARN_MAX ; i++ )
+	{
+		l = &learned[(h + i) % LEARN_MAX];
+		if ( !*l->name )
+		{
+			if ( !create )
+				return NULL;
+			strncpy(l->name, name, STACK_NAME_SIZE - 1);
+			return l;
+		}
+		if ( strncmp(l->name, name, STACK_NAME_SIZE - 1) == 0 )
+			return l;
+	}
+	return NULL;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_stack_init - inicializa el lock de la tabla de nombres
+
+Se llama desde mt_main() antes de crear la primera tarea.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_stack_init(void)
+{
+	mt_spin_init(&learn_lock, "stack");
+	mt_spin_register(&learn_lock);
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_stack_paint - llena el stack de una tarea nueva con STACK_PAINT
+
+Solo si la medicion o el aprendizaje estan habilitados.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_stack_paint(Task_t *task)
+{
+	unsigned *p = (unsigned *) task->stack, *end = (unsigned *)(task->stack + task->stack_size);
+
+	if ( !(task->stack_painted = tracking || learning) )
+		return;
+	while ( p < end )
+		*p++ = STACK_PAINT;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_stack_used - maximo de bytes del stack que uso una tarea
+
+Retorna 0 para las tareas cuyo stack no creo CreateTask, como la principal,
+y para las creadas sin relleno.
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+mt_stack_used(Task_t *task)
+{
+	if ( !task->stack || !task->stack_painted )
+		return 0;
+	return mt_stack_scan(task->stack, task->stack_size);
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_stack_scan - maximo de bytes usados de un stack rellenado
+
+Permite medir fuera de una seccion critica un stack cuya direccion y tamaño
+se copiaron dentro de ella.
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+mt_stack_scan(char *stack, unsigned size)
+{
+	unsigned *p = (unsigned *) stack, *end = (unsigned *)(stack + size);
+
+	while ( p < end && *p == STACK_PAINT )
+		p++;
+	return (char *) end - (char *) p;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_stack_learn - registra el maximo de stack usado por una tarea que termina
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_stack_learn(Task_t *task)
+{
+	unsigned used, flags;
+	Learned_t *l;
+
+	if ( !task->name || !task->stack || !task->stack_painted )
+		return;
+	used = mt_stack_used(task);
+	flags = mt_spin_lock_irqsave(&learn_lock);
+	if ( (l = lookup(task->name, true)) )
+	{
+		l->max_used = max(l->max_used, used);
+		l->samples++;
+	}
+	mt_spin_unlock_irqrestore(&learn_lock, flags);
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_stack_learned - tamaño de stack aprendido para un nombre de tarea
+
+Retorna 0 si el aprendizaje esta deshabilitado o no hay datos del nombre.
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+mt_stack_learned(char *name)
+{
+	unsigned size = 0, flags;
+	Learned_t *l;
+
+	if ( !learning || !name )
+		return 0;
+	flags = mt_spin_lock_irqsave(&learn_lock);
+	if ( (l = lookup(name, false)) )
+		size = max(l->max_used + STACK_MARGIN, MIN_LEARNED_STACK);
+	mt_spin_unlock_irqrestore(&learn_lock, flags);
+	return size;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_stack_stats - copia la tabla de tamaños aprendidos
+
+Retorna la cantidad de nombres copiados, a lo sumo max.
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+mt_stack_stats(StackStats_t stats[], unsigned max)
+{
+	unsigned i, n = 0, flags = mt_spin_lock_irqsave(&learn_lock);
+
+	for ( i = 0 ; i < LEARN_MAX && n < max ; i++ )
+		if ( *learned[i].name )
+		{
+			strcpy(stats[n].name, learned[i].name);
+			stats[n].max_used = learned[i].max_used;
+			stats[n].samples = learned[i].samples;
+			n++;
+		}
+	mt_spin_unlock_irqrestore(&learn_lock, flags);
+	return n;
+}
+
+/*
+--------------------------------------------------------------------------------
+GetStackUsed - maximo de bytes del stack que uso una tarea
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+GetStackUsed(Task_t *task)
+{
+	return mt_stack_used(task);
+}
+
+/*
+--------------------------------------------------------------------------------
+SetStackLearning, GetStackLearning - habilitan y consultan el uso de los
+									 tamaños de stack aprendidos
+
+Determina si CreateTask usa los tamaños aprendidos. Mientras esta habilitado
+tambien se miden los stacks, como con SetStackTracking.
+--------------------------------------------------------------------------------
+*/
+
+void
+SetStackLearning(bool on)
+{
+	learning = on;
+}
+
+bool
+GetStackLearning(void)
+{
+	return learning;
+}
+
+/*
+--------------------------------------------------------------------------------
+SetStackTracking, GetStackTracking - habilitan y consultan la medicion del uso
+									 de los stacks
+
+Afecta a las tareas que se crean despues. Los maximos de las tareas medidas
+se registran aunque el aprendizaje este deshabilitado.
+--------------------------------------------------------------------------------
+*/
+
+void
+SetStackTracking(bool on)
+{
+	tracking = on;
+}
+
+bool
+GetStackTracking(void)
+{
+	return tracking;
+}
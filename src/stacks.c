@@ -0,0 +1,118 @@
+#include "kernel.h"
+
+/*
+	stacks: uso de los stacks de las tareas (ver stack.c).
+
+	Para cada tarea muestra el tamaño de su stack, el maximo que uso y el
+	porcentaje, resaltando las que pasaron STACK_WARN_PCT; el uso solo se
+	conoce para las tareas creadas con la medicion o el aprendizaje
+	habilitados. Despues muestra los maximos registrados por nombre de tarea
+	y el tamaño que pediria la proxima tarea con ese nombre si el
+	aprendizaje estuviera habilitado. "stacks on" y "stacks off" habilitan y
+	deshabilitan el aprendizaje, "stacks track" y "stacks notrack" la
+	medicion.
+	La lista de tareas se copia con las interrupciones deshabilitadas, pero
+	los stacks se recorren despues, fuera de la seccion critica. Si una
+	tarea termina mientras tanto su stack vuelve al pool o al heap, que son
+	memoria estatica: la lectura es segura, aunque su resultado ya no
+	corresponda a la tarea.
+*/
+
+#define MAX_TASKS		64
+#define MAX_NAMES		64
+#define STACK_WARN_PCT	75
+
+#define HEAD_FMT		"%-15s %7s %7s %5s"
+#define LINE_FMT		"%-15.15s %7u %7u %4u%%"
+#define NOUSE_FMT		"%-15.15s %7u %7s %5s"
+#define LEARN_HEAD_FMT	"%-15s %7s %7s %9s"
+#define LEARN_FMT		"%-15.15s %7u %7u %9u"
+
+#define HEAD_FG			YELLOW
+#define LINE_FG			LIGHTGRAY
+#define WARN_FG			LIGHTRED
+
+typedef struct
+{
+	char			name[STACK_NAME_SIZE];
+	char *			stack;
+	unsigned		size;
+	unsigned		used;
+	bool			painted;
+}
+Sample_t;
+
+int
+stacks_main(int argc, char *argv[])
+{
+	Sample_t *samples, *s;
+	StackStats_t *names, *l;
+	unsigned i, n, pct;
+	Task_t *task;
+
+	if ( argc > 1 )
+	{
+		if ( strcmp(argv[1], "on") == 0 || strcmp(argv[1], "off") == 0 )
+			SetStackLearning(strcmp(argv[1], "on") == 0);
+		else if ( strcmp(argv[1], "track") == 0 || strcmp(argv[1], "notrack") == 0 )
+			SetStackTracking(strcmp(argv[1], "track") == 0);
+		else
+		{
+			cprintk(LIGHTRED, BLACK, "Uso: stacks [on|off|track|notrack]\n");
+			return 1;
+		}
+	}
+
+	samples = Malloc(MAX_TASKS * sizeof(Sample_t));
+	names = Malloc(MAX_NAMES * sizeof(StackStats_t));
+
+	/* Copiar la lista con las interrupciones deshabilitadas */
+	n = 0;
+	DisableInts();
+	for ( task = mt_task_list ; task && n < MAX_TASKS ; task = task->list_next )
+	{
+		if ( !task->stack )
+			continue;
+		s = &samples[n++];
+		strncpy(s->name, task->name ? task->name : "", STACK_NAME_SIZE - 1);
+		s->stack = task->stack;
+		s->size = task->stack_size;
+		s->painted = task->stack_painted;
+	}
+	RestoreInts();
+
+	/* Medir los stacks fuera de la seccion critica */
+	for ( i = 0 ; i < n ; i++ )
+		if ( samples[i].painted )
+			samples[i].used = mt_stack_scan(samples[i].stack, samples[i].size);
+
+	cprintk(HEAD_FG, BLACK, HEAD_FMT "\n", "Tarea", "Stack", "Usado", "%Uso");
+	for ( i = 0 ; i < n ; i++ )
+	{
+		s = &samples[i];
+		if ( !s->painted )
+		{
+			cprintk(LINE_FG, BLACK, NOUSE_FMT "\n", s->name, s->size, "-", "-");
+			continue;
+		}
+		pct = s->used * 100ULL / s->size;
+		cprintk(pct >= STACK_WARN_PCT ? WARN_FG : LINE_FG, BLACK, LINE_FMT "\n",
+			s->name, s->size, s->used, pct);
+	}
+
+	n = mt_stack_stats(names, MAX_NAMES);
+	cprintk(HEAD_FG, BLACK, "\nMedicion %s, aprendizaje %s\n",
+		GetStackTracking() ? "habilitada" : "deshabilitada",
+		GetStackLearning() ? "habilitado" : "deshabilitado");
+	cprintk(HEAD_FG, BLACK, LEARN_HEAD_FMT "\n", "Nombre", "Maximo", "Tareas", "Aprendido");
+	for ( i = 0 ; i < n ; i++ )
+	{
+		l = &names[i];
+		cprintk(LINE_FG, BLACK, LEARN_FMT "\n", l->name, l->max_used, l->samples,
+			max(l->max_used + STACK_MARGIN, MIN_LEARNED_STACK));
+	}
+
+	Free(samples);
+	Free(names);
+	return 0;
+}
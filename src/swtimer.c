@@ -0,0 +1,190 @@
+#include "kernel.h"
+
+/*
+	Timers de software.
+
+	Un timer llama a una funcion cuando vence, una vez o periodicamente, sin
+	necesitar una tarea propia. Los timers activos estan en una rueda de
+	TIMER_SLOTS ranuras indexada por el tick en que vencen; cada ranura es una
+	lista doblemente enlazada, asi que armar y cancelar un timer lleva tiempo
+	constante. En cada tick se recorre solamente la ranura del tick actual:
+	los timers que vencen en vueltas posteriores de la rueda quedan en ella.
+	Las funciones de los timers ejecutan en la softirq SoftirqTimer, que
+	tick() marca en cada tick, con interrupciones habilitadas pero con el
+	lock del kernel tomado, asi que no pueden bloquearse: pueden despertar
+	tareas, senalizar semaforos, usar las variantes Cond de las operaciones,
+	y armar, detener o destruir timers, incluso el propio. Las estructuras de
+	los timers se protegen con el lock del kernel y deshabilitando
+	interrupciones: cuando StopTimer retorna, la funcion del timer no esta
+	ejecutando en ninguna CPU.
+*/
+
+#define TIMER_SLOTS		256
+#define TIMER_MASK		(TIMER_SLOTS - 1)
+
+static Timer_t *wheel[TIMER_SLOTS];
+static unsigned active_count;			/* timers en la rueda */
+static unsigned long long timer_ticks;	/* ultimo tick procesado */
+
+/* Poner un timer en la ranura de su vencimiento */
+static void
+link_timer(Timer_t *timer)
+{
+	Timer_t **slot = &wheel[timer->expires & TIMER_MASK];
+
+	timer->prev = NULL;
+	if ( (timer->next = *slot) )
+		(*slot)->prev = timer;
+	*slot = timer;
+	timer->active = true;
+	active_count++;
+}
+
+static void
+unlink_timer(Timer_t *timer)
+{
+	if ( !timer->active )
+		return;
+	if ( timer->prev )
+		timer->prev->next = timer->next;
+	else
+		wheel[timer->expires & TIMER_MASK] = timer->next;
+	if ( timer->next )
+		timer->next->prev = timer->prev;
+	timer->prev = timer->next = NULL;
+	timer->active = false;
+	active_count--;
+}
+
+static unsigned
+msecs_to_ticks(unsigned msecs)
+{
+	return (msecs + MSPERTICK - 1) / MSPERTICK;
+}
+
+/*
+--------------------------------------------------------------------------------
+CreateTimer, DeleteTimer - creacion y destruccion de timers
+
+El timer se crea detenido. DeleteTimer lo detiene si estaba activo.
+--------------------------------------------------------------------------------
+*/
+
+Timer_t *
+CreateTimer(TimerFunc_t func, void *arg)
+{
+	Timer_t *timer = Malloc(sizeof(Timer_t));
+
+	timer->func = func;
+	timer->arg = arg;
+	return timer;
+}
+
+void
+DeleteTimer(Timer_t *timer)
+{
+	StopTimer(timer);
+	Free(timer);
+}
+
+/*
+--------------------------------------------------------------------------------
+StartTimer, StopTimer - armar y detener un timer
+
+StartTimer arma el timer para que venza dentro de al menos msecs
+milisegundos, redondeados a ticks; si periodic es true, vuelve a vencer cada
+msecs, sin acumular deriva. Si el timer estaba activo, se rearma. Ambas
+operaciones son de tiempo constante.
+--------------------------------------------------------------------------------
+*/
+
+void
+StartTimer(Timer_t *timer, unsigned msecs, bool periodic)
+{
+	unsigned ticks = max(msecs_to_ticks(msecs), 1);
+
+	DisableInts();
+	unlink_timer(timer);
+	timer->period = periodic ? ticks : 0;
+	timer->expires = mt_ticks + ticks + 1;		// al menos ticks completos
+	link_timer(timer);
+	RestoreInts();
+}
+
+void
+StopTimer(Timer_t *timer)
+{
+	DisableInts();
+	unlink_timer(timer);
+	RestoreInts();
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_run_timers - ejecuta los timers vencidos
+
+Manejador de la softirq SoftirqTimer. Procesa las ranuras de todos los ticks
+transcurridos desde la ultima vez, que pueden ser varios al salir del tick
+dinamico. Los timers periodicos se rearman antes de llamar a su funcion,
+para que esta pueda detenerlos. Como la funcion puede detener o destruir
+cualquier otro timer, despues de cada llamada se vuelve a recorrer la
+ranura desde el principio. La rueda se modifica con interrupciones
+deshabilitadas y las funciones se llaman con interrupciones habilitadas.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_run_timers(void)
+{
+	Timer_t *timer;
+
+	mt_cli();
+	while ( timer_ticks < mt_ticks )
+	{
+		timer_ticks++;
+		do
+		{
+			for ( timer = wheel[timer_ticks & TIMER_MASK] ; timer && timer->expires > timer_ticks ;
+					timer = timer->next )
+				;
+			if ( !timer )
+				break;
+			unlink_timer(timer);
+			if ( timer->period )
+			{
+				timer->expires += timer->period;
+				link_timer(timer);
+			}
+			mt_sti();
+			timer->func(timer->arg);
+			mt_cli();
+		}
+		while ( true );
+	}
+	mt_sti();
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_next_timer - ticks que se pueden saltear hasta el proximo vencimiento
+
+Se usa para el tick dinamico, con la misma convencion que mt_next_time():
+cero si hay que procesar el proximo tick, FOREVER si no hay timers activos.
+Recorre todos los timers, pero solo cuando la CPU esta ociosa.
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+mt_next_timer(void)
+{
+	unsigned long long next = ~0ULL;
+	Timer_t *timer;
+	unsigned i;
+
+	if ( !active_count )
+		return FOREVER;
+	for ( i = 0 ; i < TIMER_SLOTS ; i++ )
+		for ( timer = wheel[i] ; timer ; timer = timer->next )
+			next = min(next, timer->expires);
+	return next > mt_ticks + 1 ? min(next - mt_ticks - 1, FOREVER - 1ULL) : 0;
+}
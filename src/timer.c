@@ -1,13 +1,82 @@
 #include "kernel.h"
 
+#define PIT_FREQ		1193182			// Frecuencia de entrada del PIT
+#define PIT_CH0			0x40			// Contador del canal 0
+#define PIT_CMD			0x43			// Registro de comandos
+#define PIT_PERIODIC	0x34			// Canal 0, LSB/MSB, modo 2 (rate generator)
+#define PIT_ONESHOT		0x30			// Canal 0, LSB/MSB, modo 0 (one-shot)
+#define PIT_LATCH		0x00			// Canal 0, congelar la cuenta para leerla
+#define PIT_CH2			0x42			// Contador del canal 2
+#define PIT_CH2_ONESHOT	0xB0			// Canal 2, LSB/MSB, modo 0
+#define PIT_GATE		0x61			// Control del gate del canal 2
+#define GATE_ON			0x01			// Habilitar cuenta del canal 2
+#define SPEAKER_ON		0x02			// Conectar la salida al parlante
+#define CH2_OUT			0x20			// Salida del canal 2
+
+static unsigned period;					// cuentas del PIT por tick
+
+static void
+load_count(unsigned mode, unsigned count)
+{
+	outb(PIT_CMD, mode);
+	outb(PIT_CH0, count);
+	outb(PIT_CH0, count >> 8);
+}
+
 void
 mt_setup_timer(unsigned msecs)
 {
-	unsigned count = 1193182 *  msecs;
+	unsigned count = PIT_FREQ *  msecs;
 	count /= 1000;
 
-	outb(0x43, 0x26);
-	outb(0x40, count);
-	outb(0x40, count >> 8);
+	period = count;
+	load_count(PIT_PERIODIC, count);
+}
+
+// Volver al modo periódico, con la frecuencia de mt_setup_timer()
+void
+mt_timer_periodic(void)
+{
+	load_count(PIT_PERIODIC, period);
+}
+
+// Programar una única interrupción dentro de count cuentas (máximo 0xFFFF)
+void
+mt_timer_oneshot(unsigned count)
+{
+	load_count(PIT_ONESHOT, count);
+}
+
+// Cuentas que faltan para la próxima interrupción
+unsigned
+mt_timer_count(void)
+{
+	unsigned count;
+
+	outb(PIT_CMD, PIT_LATCH);
+	count = inb(PIT_CH0);
+	count |= inb(PIT_CH0) << 8;
+	return count;
+}
+
+// Cuentas del PIT por tick
+unsigned
+mt_timer_period(void)
+{
+	return period;
 }
 
+// Espera activa de msecs milisegundos (máximo 54) usando el canal 2 del PIT.
+// No depende de interrupciones, sirve para calibrar otros relojes.
+void
+mt_timer_busywait(unsigned msecs)
+{
+	unsigned count = PIT_FREQ * msecs / 1000;
+
+	outb(PIT_GATE, (inb(PIT_GATE) & ~SPEAKER_ON) | GATE_ON);
+	outb(PIT_CMD, PIT_CH2_ONESHOT);
+	outb(PIT_CH2, count);
+	outb(PIT_CH2, count >> 8);
+	while ( !(inb(PIT_GATE) & CH2_OUT) )
+		;
+}
@@ -0,0 +1,245 @@
+#include "kernel.h"
+
+/*
+	top y ps: uso de CPU por tarea.
+
+	Ambos comandos toman una instantánea de la lista de tareas con las
+	interrupciones deshabilitadas y la muestran después, fuera de la sección
+	crítica. ps muestra los totales acumulados desde la creación de cada tarea;
+	top se actualiza una vez por segundo hasta que se presiona una tecla, y
+	calcula el uso de CPU sobre el último intervalo. Los tiempos se muestran en
+	milisegundos si el TSC fue calibrado, o en millones de ciclos si no. Con
+	varias CPUs se muestra además, para cada una, su tarea actual, las tareas
+	en su cola de ready y cuántas recibió de otras CPUs.
+*/
+
+#define MAX_TASKS		64
+#define NAME_SIZE		16
+#define REFRESH			1000
+
+#define HEAD_FMT		"%-12s %-5s %4s %6s %7s %7s %7s %5s %5s %5s %4s"
+#define LINE_FMT		"%-12.12s %-5s %4u %4u.%u %7u %7u %7u %5u %5u %5u %4u"
+#define CPU_FMT			"CPU %u: %-15s ready %3u   migraciones %6u"
+
+#define TITLE_FG		LIGHTCYAN
+#define HEAD_FG			YELLOW
+#define LINE_FG			LIGHTGRAY
+
+typedef struct
+{
+	Task_t *			task;
+	char				name[NAME_SIZE];
+	TaskState_t			state;
+	unsigned			priority;
+	unsigned long long	run_cycles;
+	unsigned long long	ready_cycles;
+	unsigned long long	blocked_cycles;
+	unsigned			vol_switches;
+	unsigned			invol_switches;
+	unsigned			wakeups;
+	unsigned			migrations;
+	unsigned			permil;			// uso de CPU en milésimos
+}
+Sample_t;
+
+typedef struct
+{
+	char				curr[NAME_SIZE];
+	unsigned			nready;
+	unsigned			migrations;
+}
+CpuSample_t;
+
+typedef struct
+{
+	unsigned			ntasks;
+	unsigned			ncpus;
+	unsigned			idle_pct;
+	unsigned long long	stamp;
+	Sample_t			tasks[MAX_TASKS];
+	CpuSample_t			cpus[MAX_CPUS];
+}
+Snapshot_t;
+
+static const char *state_names[] =
+{
+	"Susp", "Ready", "Run", "Delay", "Wait", "Send", "Recv", "Term"
+};
+
+/* Copiar los datos de todas las tareas */
+static void
+snapshot(Snapshot_t *snap)
+{
+	Task_t *task;
+	Sample_t *s;
+	CpuSample_t *c;
+	unsigned i;
+
+	DisableInts();
+	snap->ntasks = 0;
+	snap->idle_pct = mt_idle_pct;
+	snap->stamp = mt_rdtsc();
+	for ( task = mt_task_list ; task && snap->ntasks < MAX_TASKS ; task = task->list_next )
+	{
+		mt_update_stats(task);
+		s = &snap->tasks[snap->ntasks++];
+		s->task = task;
+		strncpy(s->name, task->name ? task->name : "", NAME_SIZE - 1);
+		s->name[NAME_SIZE - 1] = 0;
+		s->state = task->state;
+		s->priority = task->priority;
+		s->run_cycles = task->run_cycles;
+		s->ready_cycles = task->ready_cycles;
+		s->blocked_cycles = task->blocked_cycles;
+		s->vol_switches = task->vol_switches;
+		s->invol_switches = task->invol_switches;
+		s->wakeups = task->wakeups;
+		s->migrations = task->migrations;
+	}
+	for ( snap->ncpus = mt_ncpus, i = 0 ; i < mt_ncpus ; i++ )
+	{
+		c = &snap->cpus[i];
+		task = mt_cpus[i].curr_task;
+		strncpy(c->curr, task && task->name ? task->name : "", NAME_SIZE - 1);
+		c->curr[NAME_SIZE - 1] = 0;
+		c->nready = mt_count_ready(i);
+		c->migrations = mt_cpus[i].migrations;
+	}
+	RestoreInts();
+}
+
+/*
+	Calcular el uso de CPU de cada tarea. Si no hay instantánea anterior,
+	sobre toda su vida; si no, sobre el intervalo entre ambas.
+*/
+static void
+compute_usage(Snapshot_t *snap, Snapshot_t *prev)
+{
+	unsigned i, j;
+	Sample_t *s;
+	unsigned long long run, total;
+
+	for ( i = 0 ; i < snap->ntasks ; i++ )
+	{
+		s = &snap->tasks[i];
+		run = s->run_cycles;
+		total = s->run_cycles + s->ready_cycles + s->blocked_cycles;
+		if ( prev )
+		{
+			total = snap->stamp - prev->stamp;
+			for ( j = 0 ; j < prev->ntasks ; j++ )
+				if ( prev->tasks[j].task == s->task )
+				{
+					run -= prev->tasks[j].run_cycles;
+					break;
+				}
+		}
+		s->permil = total ? run * 1000 / total : 0;
+	}
+}
+
+/* Ordenar por uso de CPU decreciente */
+static void
+sort_usage(Snapshot_t *snap)
+{
+	unsigned i, j;
+	Sample_t s;
+
+	for ( i = 1 ; i < snap->ntasks ; i++ )
+	{
+		s = snap->tasks[i];
+		for ( j = i ; j > 0 && snap->tasks[j - 1].permil < s.permil ; j-- )
+			snap->tasks[j] = snap->tasks[j - 1];
+		snap->tasks[j] = s;
+	}
+}
+
+static unsigned
+to_ms(unsigned long long cycles)
+{
+	unsigned khz = mt_tsc_khz();
+
+	return khz ? cycles / khz : cycles / 1000000;
+}
+
+static void
+show(Snapshot_t *snap, bool clear)
+{
+	unsigned i;
+	Sample_t *s;
+	CpuSample_t *c;
+
+	cprintk(TITLE_FG, BLACK, "Tareas: %u   CPUs: %u   Ocioso: %u%%   Tiempos en %s",
+		snap->ntasks, snap->ncpus, snap->idle_pct, mt_tsc_khz() ? "ms" : "Mciclos");
+	if ( clear )
+		mt_cons_clreol();
+	printk("\n");
+	for ( i = 0 ; snap->ncpus > 1 && i < snap->ncpus ; i++ )
+	{
+		c = &snap->cpus[i];
+		cprintk(LINE_FG, BLACK, CPU_FMT, i, c->curr, c->nready, c->migrations);
+		if ( clear )
+			mt_cons_clreol();
+		printk("\n");
+	}
+	cprintk(HEAD_FG, BLACK, HEAD_FMT, "Nombre", "Est", "Prio", "%CPU",
+		"CPU", "Ready", "Bloq", "Vol", "Invol", "Desp", "Migr");
+	printk("\n");
+	for ( i = 0 ; i < snap->ntasks ; i++ )
+	{
+		s = &snap->tasks[i];
+		cprintk(LINE_FG, BLACK, LINE_FMT, s->name, state_names[s->state],
+			s->priority, s->permil / 10, s->permil % 10,
+			to_ms(s->run_cycles), to_ms(s->ready_cycles),
+			to_ms(s->blocked_cycles), s->vol_switches, s->invol_switches,
+			s->wakeups, s->migrations);
+		if ( clear )
+			mt_cons_clreol();
+		printk("\n");
+	}
+}
+
+int
+ps_main(int argc, char *argv[])
+{
+	Snapshot_t *snap = Malloc(sizeof(Snapshot_t));
+
+	snapshot(snap);
+	compute_usage(snap, NULL);
+	show(snap, false);
+	Free(snap);
+	return 0;
+}
+
+int
+top_main(int argc, char *argv[])
+{
+	Snapshot_t *snap = Malloc(sizeof(Snapshot_t));
+	Snapshot_t *prev = Malloc(sizeof(Snapshot_t));
+	Snapshot_t *tmp;
+	unsigned c;
+	bool cursor;
+
+	mt_cons_clear();
+	cursor = mt_cons_cursor(false);
+	snapshot(prev);
+	do
+	{
+		snapshot(snap);
+		compute_usage(snap, prev);
+		sort_usage(snap);
+		mt_cons_gotoxy(0, 0);
+		show(snap, true);
+		mt_cons_clreom();
+		tmp = prev;
+		prev = snap;
+		snap = tmp;
+	}
+	while ( !mt_kbd_getch_timed(&c, REFRESH) );
+
+	mt_cons_cursor(cursor);
+	mt_cons_clear();
+	Free(snap);
+	Free(prev);
+	return 0;
+}
@@ -0,0 +1,157 @@
+#include "kernel.h"
+
+/*
+	Registro de eventos del scheduler.
+
+	Cada CPU guarda sus eventos en su propio buffer circular de tamaño fijo,
+	con la marca de tiempo del TSC. Cuando se llena se pisan los más viejos.
+	Como cada buffer tiene un solo escritor, su CPU, y los eventos se
+	registran con las interrupciones de esa CPU deshabilitadas, el registro
+	no usa locks ni depende del lock del kernel. La lectura combina los
+	buffers de todas las CPUs en orden de TSC, lo que supone que los TSC de
+	las CPUs están sincronizados; para obtener una secuencia coherente se
+	hace con el registro detenido.
+*/
+
+#define TRACE_SIZE		1024			// eventos por CPU, debe ser potencia de 2
+#define TRACE_MASK		(TRACE_SIZE - 1)
+
+typedef struct
+{
+	unsigned		head;				// total de eventos registrados
+	TraceEntry_t	entries[TRACE_SIZE];
+}
+TraceRing_t;
+
+static TraceRing_t rings[MAX_CPUS];
+static bool enabled = true;
+
+/* Posición del evento más viejo disponible en el buffer de una CPU */
+static unsigned
+first(TraceRing_t *ring)
+{
+	return ring->head > TRACE_SIZE ? ring->head - TRACE_SIZE : 0;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_trace - registra un evento en el buffer de la CPU actual
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_trace(unsigned event, Task_t *task, unsigned arg)
+{
+	unsigned flags;
+	Cpu_t *cpu;
+	TraceEntry_t *e;
+
+	if ( !enabled )
+		return;
+	flags = mt_irqsave();
+	cpu = mt_this_cpu();
+	e = &rings[cpu->id].entries[rings[cpu->id].head & TRACE_MASK];
+	e->tsc = mt_rdtsc();
+	e->cpu = cpu->id;
+	e->event = event;
+	e->task = task;
+	e->arg = arg;
+	rings[cpu->id].head++;
+	mt_irqrestore(flags);
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_trace_enable - habilita o deshabilita el registro, retorna el estado anterior
+--------------------------------------------------------------------------------
+*/
+
+bool
+mt_trace_enable(bool on)
+{
+	bool prev = enabled;
+
+	enabled = on;
+	return prev;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_trace_clear - descarta los eventos registrados
+
+Los eventos que otra CPU registre mientras tanto pueden perderse.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_trace_clear(void)
+{
+	unsigned i;
+
+	for ( i = 0 ; i < MAX_CPUS ; i++ )
+		rings[i].head = 0;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_trace_count - cantidad de eventos disponibles en los buffers
+--------------------------------------------------------------------------------
+*/
+
+unsigned
+mt_trace_count(void)
+{
+	unsigned i, n = 0;
+
+	for ( i = 0 ; i < MAX_CPUS ; i++ )
+		n += rings[i].head - first(&rings[i]);
+	return n;
+}
+
+/*
+--------------------------------------------------------------------------------
+mt_trace_start, mt_trace_next - recorren los eventos en orden de TSC
+
+mt_trace_start prepara el recorrido salteando los skip eventos más viejos;
+mt_trace_next obtiene el siguiente evento, o retorna false si no quedan.
+Para obtener una secuencia coherente el registro debe estar deshabilitado.
+--------------------------------------------------------------------------------
+*/
+
+void
+mt_trace_start(TraceCursor_t *cur, unsigned skip)
+{
+	TraceEntry_t e;
+	unsigned i;
+
+	for ( i = 0 ; i < MAX_CPUS ; i++ )
+		cur->pos[i] = first(&rings[i]);
+	while ( skip-- && mt_trace_next(cur, &e) )
+		;
+}
+
+bool
+mt_trace_next(TraceCursor_t *cur, TraceEntry_t *entry)
+{
+	TraceEntry_t *e, *best = NULL;
+	unsigned i, cpu = 0;
+
+	for ( i = 0 ; i < MAX_CPUS ; i++ )
+	{
+		if ( cur->pos[i] < first(&rings[i]) )		// pisado mientras tanto
+			cur->pos[i] = first(&rings[i]);
+		if ( cur->pos[i] >= rings[i].head )
+			continue;
+		e = &rings[i].entries[cur->pos[i] & TRACE_MASK];
+		if ( !best || e->tsc < best->tsc )
+		{
+			best = e;
+			cpu = i;
+		}
+	}
+	if ( !best )
+		return false;
+	*entry = *best;
+	cur->pos[cpu]++;
+	return true;
+}
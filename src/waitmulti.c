@@ -0,0 +1,92 @@
+#include "kernel.h"
+
+/*
+	waitmulti: prueba de WaitMultiple.
+
+	Una tarea escribe en un pipe cada PIPE_MS y otra senaliza un semaforo
+	cada SEM_MS. El shell espera a la vez el teclado, el pipe y el semaforo,
+	con un timeout de TIMEOUT_MS, y muestra que completo cada espera, sin
+	tareas auxiliares ni polling. Termina al presionar una tecla.
+*/
+
+#define PIPE_MS			700
+#define SEM_MS			1100
+#define TIMEOUT_MS		500
+#define PIPE_SIZE		64
+
+static Pipe_t *pipe;
+static Semaphore_t *sem;
+
+static void
+writer(void *arg)
+{
+	unsigned n = 0;
+
+	while ( true )
+	{
+		Delay(PIPE_MS);
+		n++;
+		PutPipe(pipe, &n, sizeof n);
+	}
+}
+
+static void
+signaler(void *arg)
+{
+	while ( true )
+	{
+		Delay(SEM_MS);
+		SignalSem(sem);
+	}
+}
+
+int
+waitmulti_main(int argc, char *argv[])
+{
+	unsigned prio = GetPriority(CurrentTask());
+	unsigned key, index, n, nbytes;
+	Task_t *wt, *st;
+	bool done = false;
+	WaitObject_t objects[] =
+	{
+		{ WaitForMsgQueue,	mt_kbd_queue(),	&key },
+		{ WaitForPipe,		NULL },
+		{ WaitForSem,		NULL },
+	};
+
+	objects[1].object = pipe = CreatePipe("Waitmulti", PIPE_SIZE);
+	objects[2].object = sem = CreateSem("Waitmulti", 0);
+	Ready(wt = CreateTask(writer, 0, NULL, "Waitmulti pipe", prio));
+	Ready(st = CreateTask(signaler, 0, NULL, "Waitmulti sem", prio));
+
+	cprintk(LIGHTCYAN, BLACK, "Presione una tecla para terminar\n");
+	while ( !done )
+	{
+		key = 0;
+		if ( !WaitMultiple(objects, 3, TIMEOUT_MS, &index) )
+		{
+			printk("timeout\n");
+			continue;
+		}
+		switch ( index )
+		{
+			case 0:
+				printk("tecla %u\n", key);
+				done = true;
+				break;
+			case 1:
+				nbytes = GetPipeCond(pipe, &n, sizeof n);
+				printk("pipe: %u bytes, valor %u\n", nbytes, n);
+				break;
+			case 2:
+				printk("semaforo\n");
+				break;
+		}
+	}
+
+	DeleteTask(wt);
+	DeleteTask(st);
+	DeletePipe(pipe);
+	DeleteSem(sem);
+	return 0;
+}